@@ -0,0 +1,263 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <numbers>
+#include <random>
+
+#include <BioFVM/microenvironment.h>
+
+#include "agents_sorter.h"
+#include "base_membrane_data.h"
+#include "base_motility_data.h"
+#include "base_motility_model.h"
+#include "base_potential_data.h"
+#include "base_potential_model.h"
+#include "base_wall_membrane_model.h"
+#include "grid_space_partitioner.h"
+#include "mech_environment.h"
+#include "sdf_membrane_model.h"
+
+namespace micromech::bench {
+
+enum class placement_t
+{
+	// agents are spread uniformly over the domain
+	uniform,
+	// agents are spread uniformly in balls of clusters_count clusters with uniformly placed centers
+	clusters,
+};
+
+struct environment_params
+{
+	biofvm::index_t dims = 3;
+	biofvm::index_t agents_count = 10000;
+
+	// fraction of the domain covered by agents of the mean radius
+	biofvm::real_t volume_fraction = 0.3;
+
+	placement_t placement = placement_t::uniform;
+	biofvm::index_t clusters_count = 1;
+	// fraction of a cluster ball covered by its agents
+	biofvm::real_t cluster_volume_fraction = 0.6;
+
+	// empty space around the populated domain, so that agents pushed out of it stay in the mesh
+	biofvm::real_t margin = 0;
+
+	biofvm::real_t timestep = 1;
+
+	biofvm::real_t radius = 10;
+	// radii are uniform in radius * [1 - heterogeneity, 1 + heterogeneity]
+	biofvm::real_t radius_heterogeneity = 0;
+
+	biofvm::real_t neighbors_skin = 0;
+	bool symmetric_forces = true;
+
+	bool motile = false;
+	biofvm::index_t maximum_number_of_attachments = 0;
+
+	std::uint32_t seed = 1;
+};
+
+// Environment with the base models and agents placed in a domain sized for the volume fraction
+class bench_environment
+{
+	static constexpr biofvm::real_t relative_maximum_adhesion_distance = 1.25;
+
+	static biofvm::real_t agent_volume(biofvm::index_t dims, biofvm::real_t radius)
+	{
+		if (dims == 1)
+			return 2 * radius;
+		if (dims == 2)
+			return std::numbers::pi_v<biofvm::real_t> * radius * radius;
+		return 4. / 3 * std::numbers::pi_v<biofvm::real_t> * radius * radius * radius;
+	}
+
+	// voxels of the partitioner must cover the largest adhesion distance plus the skin
+	static biofvm::index_t voxel_size(const environment_params& params)
+	{
+		const biofvm::real_t max_radius = params.radius * (1 + params.radius_heterogeneity);
+		return (biofvm::index_t)std::ceil(2 * relative_maximum_adhesion_distance * max_radius + params.neighbors_skin);
+	}
+
+	// the side of the populated domain is a multiple of the voxel size
+	static biofvm::index_t domain_size(const environment_params& params)
+	{
+		const biofvm::real_t volume =
+			params.agents_count * agent_volume(params.dims, params.radius) / params.volume_fraction;
+		const biofvm::index_t voxel = voxel_size(params);
+		const biofvm::index_t voxels = (biofvm::index_t)std::ceil(std::pow(volume, 1. / params.dims) / voxel);
+
+		return std::max<biofvm::index_t>(voxels, 1) * voxel;
+	}
+
+	static biofvm::index_t margin_size(const environment_params& params)
+	{
+		const biofvm::index_t voxel = voxel_size(params);
+		return (biofvm::index_t)std::ceil(params.margin / voxel) * voxel;
+	}
+
+	static biofvm::cartesian_mesh make_mesh(const environment_params& params)
+	{
+		const biofvm::index_t size = domain_size(params) + 2 * margin_size(params);
+		const biofvm::index_t voxel = voxel_size(params);
+
+		return biofvm::cartesian_mesh(params.dims, { 0, 0, 0 },
+									  { size, params.dims > 1 ? size : voxel, params.dims > 2 ? size : voxel },
+									  { voxel, voxel, voxel });
+	}
+
+	// the walls of the mesh as a distance field, so that both membrane models evaluate the same boundary
+	static signed_distance_field make_walls_field(const biofvm::cartesian_mesh& mesh)
+	{
+		sdf_primitive walls { sdf_primitive::shape_t::box };
+		for (biofvm::index_t d = 0; d < 3; d++)
+		{
+			walls.a[d] = mesh.bounding_box_mins[d];
+			walls.b[d] = mesh.bounding_box_maxs[d];
+		}
+
+		return signed_distance_field::from_primitives(mesh, mesh.voxel_shape[0] / 4., { walls });
+	}
+
+	// agents of each cluster are placed uniformly in its ball
+	void place_clusters(std::mt19937& gen)
+	{
+		const biofvm::index_t size = domain_size(params);
+		const biofvm::index_t offset = margin_size(params);
+
+		const biofvm::index_t cluster_agents =
+			(params.agents_count + params.clusters_count - 1) / params.clusters_count;
+		const biofvm::real_t cluster_radius =
+			std::pow(cluster_agents * agent_volume(params.dims, params.radius) / params.cluster_volume_fraction
+						 / agent_volume(params.dims, 1),
+					 1. / params.dims);
+
+		// centers keep their balls inside the domain if it is large enough
+		const biofvm::real_t low = std::min<biofvm::real_t>(cluster_radius, size / 2.);
+		std::uniform_real_distribution<biofvm::real_t> center(low, size - low);
+		std::uniform_real_distribution<biofvm::real_t> unit(-1, 1);
+
+		// agents of clusters crossing the domain boundary are clamped into the domain
+		const biofvm::real_t upper = std::nextafter((biofvm::real_t)size, (biofvm::real_t)0);
+
+		biofvm::real_t centers[3];
+
+		for (biofvm::index_t i = 0; i < params.agents_count; i++)
+		{
+			if (i % cluster_agents == 0)
+				for (biofvm::index_t d = 0; d < params.dims; d++)
+					centers[d] = center(gen);
+
+			// rejection sampling of the unit ball
+			biofvm::real_t point[3], norm;
+			do
+			{
+				norm = 0;
+				for (biofvm::index_t d = 0; d < params.dims; d++)
+				{
+					point[d] = unit(gen);
+					norm += point[d] * point[d];
+				}
+			} while (norm > 1);
+
+			for (biofvm::index_t d = 0; d < params.dims; d++)
+				me.agent_data.bio_agent_data.positions[i * params.dims + d] =
+					offset + std::clamp<biofvm::real_t>(centers[d] + cluster_radius * point[d], 0, upper);
+		}
+	}
+
+	void place_uniformly(std::mt19937& gen)
+	{
+		const biofvm::index_t offset = margin_size(params);
+		std::uniform_real_distribution<biofvm::real_t> position(offset, offset + domain_size(params));
+
+		for (biofvm::index_t i = 0; i < params.agents_count * params.dims; i++)
+			me.agent_data.bio_agent_data.positions[i] = position(gen);
+	}
+
+public:
+	environment_params params;
+
+	biofvm::cartesian_mesh mesh;
+	std::unique_ptr<biofvm::real_t[]> initial_conditions;
+	biofvm::microenvironment m;
+	mech_environment me;
+	grid_space_partitioner partitioner;
+
+	base_potential_model potential;
+	base_wall_membrane_model membrane;
+	sdf_membrane_model sdf_membrane;
+	base_motility_model motility;
+
+	bench_environment(const environment_params& params)
+		: params(params),
+		  mesh(make_mesh(params)),
+		  initial_conditions(std::make_unique<biofvm::real_t[]>(1)),
+		  m(mesh, 1, 1, initial_conditions.get()),
+		  me(m, params.timestep, 1),
+		  partitioner(voxel_size(params), mesh),
+		  potential(partitioner, me, params.neighbors_skin, params.symmetric_forces),
+		  membrane(me, partitioner),
+		  sdf_membrane(me, make_walls_field(mesh), partitioner),
+		  motility(me)
+	{
+		std::mt19937 gen(params.seed);
+		std::uniform_real_distribution<biofvm::real_t> radius(params.radius * (1 - params.radius_heterogeneity),
+															  params.radius * (1 + params.radius_heterogeneity));
+
+		me.agent_data.add(params.agents_count);
+
+		for (biofvm::index_t i = 0; i < params.agents_count; i++)
+		{
+			me.agent_data.radius[i] = radius(gen);
+			me.agent_data.is_movable[i] = true;
+			me.agent_data.agent_type_indices[i] = 0;
+
+			setup_agent(i);
+		}
+
+		if (params.placement == placement_t::clusters)
+			place_clusters(gen);
+		else
+			place_uniformly(gen);
+
+		// agents are ordered along the space filling curve as in the production runs
+		agents_sorter sorter(partitioner, 1);
+
+#pragma omp parallel
+		sorter.sort(me);
+	}
+
+	void setup_agent(biofvm::index_t i)
+	{
+		auto& potential_data = static_cast<base_potential_data&>(*me.agent_data.potential_data);
+		auto& membrane_data = static_cast<base_membrane_data&>(*me.agent_data.membrane_data);
+		auto& motility_data = static_cast<base_motility_data&>(*me.agent_data.motility_data);
+
+		potential_data.cell_cell_adhesion_strength[i] = 0.4;
+		potential_data.cell_cell_repulsion_strength[i] = 10;
+		potential_data.cell_adhesion_affinities[i] = 1;
+		potential_data.relative_maximum_adhesion_distance[i] = relative_maximum_adhesion_distance;
+		potential_data.maximum_number_of_attachments[i] = params.maximum_number_of_attachments;
+		potential_data.attachment_elastic_constant[i] = 0.01;
+		potential_data.attachment_rate[i] = params.maximum_number_of_attachments > 0 ? 0.5 : 0;
+		potential_data.detachment_rate[i] = params.maximum_number_of_attachments > 0 ? 0.05 : 0;
+
+		membrane_data.cell_BM_repulsion_strength[i] = 1;
+
+		motility_data.is_motile[i] = params.motile;
+		motility_data.persistence_time[i] = 10;
+		motility_data.migration_speed[i] = 1;
+		motility_data.migration_bias[i] = 0;
+	}
+
+	// pairs of agents in the neighbors lists
+	std::size_t pairs_count() const
+	{
+		return params.symmetric_forces ? me.agent_data.neighbors.size() : me.agent_data.neighbors.size() / 2;
+	}
+};
+
+} // namespace micromech::bench
@@ -0,0 +1,168 @@
+#pragma once
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+namespace micromech::bench {
+
+struct measurement
+{
+	std::size_t iterations = 0;
+	double mean_ns = 0;
+	double min_ns = 0;
+};
+
+// Runs kernel repeatedly by all threads of a parallel region of threads_count threads until min_time_s elapses and
+// at least min_iterations are done. Only the kernel is timed, the setup runs before each iteration.
+inline measurement measure(int threads_count, double min_time_s, std::size_t min_iterations,
+						   const std::function<void()>& setup, const std::function<void()>& kernel)
+{
+	using clock = std::chrono::steady_clock;
+
+	measurement result;
+	double total_ns = 0;
+	bool done = false;
+
+#pragma omp parallel num_threads(threads_count)
+	{
+		// warmup
+		setup();
+		kernel();
+
+		clock::time_point start;
+
+		while (!done)
+		{
+			setup();
+
+#pragma omp barrier
+#pragma omp master
+			start = clock::now();
+
+			kernel();
+
+#pragma omp barrier
+#pragma omp master
+			{
+				const double ns = std::chrono::duration<double, std::nano>(clock::now() - start).count();
+
+				result.min_ns = result.iterations == 0 ? ns : std::min(result.min_ns, ns);
+				result.iterations++;
+				total_ns += ns;
+
+				done = result.iterations >= min_iterations && total_ns >= min_time_s * 1e9;
+			}
+#pragma omp barrier
+		}
+	}
+
+	result.mean_ns = total_ns / result.iterations;
+
+	return result;
+}
+
+// Command line of the form --name=value1,value2
+class arguments
+{
+	std::vector<std::string> args_;
+
+public:
+	arguments(int argc, char** argv) : args_(argv + 1, argv + argc) {}
+
+	std::string get(const std::string& name, const std::string& default_value) const
+	{
+		const std::string prefix = "--" + name + "=";
+
+		for (const auto& arg : args_)
+			if (arg.rfind(prefix, 0) == 0)
+				return arg.substr(prefix.size());
+
+		return default_value;
+	}
+
+	template <typename T>
+	std::vector<T> list(const std::string& name, const std::string& default_value) const
+	{
+		std::vector<T> values;
+		std::stringstream ss(get(name, default_value));
+		std::string item;
+
+		while (std::getline(ss, item, ','))
+		{
+			T value;
+			std::stringstream(item) >> value;
+			values.push_back(value);
+		}
+
+		return values;
+	}
+
+	bool has(const std::string& name) const
+	{
+		return std::find(args_.begin(), args_.end(), "--" + name) != args_.end();
+	}
+};
+
+// Prints the results as a table to stdout and optionally as CSV to a file
+class reporter
+{
+	std::vector<std::string> columns_;
+	std::FILE* csv_;
+
+public:
+	reporter(std::vector<std::string> columns, const std::string& csv_path)
+		: columns_(std::move(columns)), csv_(csv_path.empty() ? nullptr : std::fopen(csv_path.c_str(), "w"))
+	{
+		for (const auto& column : columns_)
+			std::printf(&column == &columns_.front() ? "%-18s" : "%14s", column.c_str());
+		std::printf("\n");
+
+		if (csv_ != nullptr)
+		{
+			for (std::size_t i = 0; i < columns_.size(); i++)
+				std::fprintf(csv_, i == 0 ? "%s" : ",%s", columns_[i].c_str());
+			std::fprintf(csv_, "\n");
+		}
+	}
+
+	reporter(const reporter&) = delete;
+	reporter& operator=(const reporter&) = delete;
+
+	~reporter()
+	{
+		if (csv_ != nullptr)
+			std::fclose(csv_);
+	}
+
+	void row(const std::vector<std::string>& values)
+	{
+		for (const auto& value : values)
+			std::printf(&value == &values.front() ? "%-18s" : "%14s", value.c_str());
+		std::printf("\n");
+		std::fflush(stdout);
+
+		if (csv_ != nullptr)
+		{
+			for (std::size_t i = 0; i < values.size(); i++)
+				std::fprintf(csv_, i == 0 ? "%s" : ",%s", values[i].c_str());
+			std::fprintf(csv_, "\n");
+			std::fflush(csv_);
+		}
+	}
+};
+
+inline std::string format(double value, const char* fmt = "%.4g")
+{
+	char buffer[32];
+	std::snprintf(buffer, sizeof(buffer), fmt, value);
+	return buffer;
+}
+
+} // namespace micromech::bench
@@ -0,0 +1,127 @@
+#include <cstdio>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "bench_environment.h"
+#include "harness.h"
+
+using namespace biofvm;
+using namespace micromech;
+using namespace micromech::bench;
+
+struct kernel_benchmark
+{
+	std::string name;
+	// whether the kernel works over the neighbors pairs
+	bool pairs;
+	std::function<void()> kernel;
+};
+
+template <index_t dims>
+std::vector<kernel_benchmark> make_benchmarks(bench_environment& env)
+{
+	auto& me = env.me;
+
+	std::vector<kernel_benchmark> benchmarks = {
+		{ "partitioning", false,
+		  [&] {
+			  env.partitioner.update_partitioning(me.agent_data.bio_agent_data.positions.data(),
+												  me.agent_data.agents_count());
+		  } },
+		// the skin is 0, so the neighbors are rebuilt by each call
+		{ "neighbors", true, [&] { env.potential.update_neighbors<dims>(me); } },
+		{ "potentials", true, [&] { env.potential.compute_agents_potentials<dims>(me); } },
+		{ "springs_attach", true, [&] { env.potential.attach_detach_springs<dims>(me); } },
+		{ "springs_contract", false, [&] { env.potential.compute_springs_potentials<dims>(me); } },
+		{ "motility", false, [&] { env.motility.update_motility_velocities<dims>(me); } },
+		{ "membrane", false, [&] { env.membrane.compute_basement_membrane_interactions<dims>(me); } },
+		{ "sdf_membrane", false, [&] { env.sdf_membrane.compute_basement_membrane_interactions<dims>(me); } },
+		{ "positions", false, [&] { env.potential.update_positions<dims>(me); } },
+	};
+
+	return benchmarks;
+}
+
+template <index_t dims>
+void run_benchmarks(bench_environment& env, const std::vector<int>& threads, const std::string& filter,
+					double min_time, std::size_t min_iterations, reporter& report)
+{
+	// neighbors and springs are prepared once, so the stages which use them can be measured alone
+#pragma omp parallel
+	{
+		env.potential.update_neighbors<dims>(env.me);
+		for (int i = 0; i < 10; i++)
+			env.potential.attach_detach_springs<dims>(env.me);
+	}
+
+	const std::size_t pairs = env.pairs_count();
+	const index_t agents_count = env.me.agent_data.agents_count();
+
+	for (auto& benchmark : make_benchmarks<dims>(env))
+	{
+		if (benchmark.name.find(filter) == std::string::npos)
+			continue;
+
+		for (int threads_count : threads)
+		{
+			auto result = measure(threads_count, min_time, min_iterations, [] {}, benchmark.kernel);
+
+			report.row({ benchmark.name, std::to_string(dims), std::to_string(agents_count),
+						 format(env.params.volume_fraction), format(env.params.radius_heterogeneity),
+						 std::to_string(threads_count), std::to_string(result.iterations), format(result.mean_ns),
+						 format(result.min_ns), format(result.mean_ns / agents_count),
+						 benchmark.pairs ? format(pairs / (result.mean_ns * 1e-9)) : "-" });
+		}
+	}
+}
+
+// Measures the mechanics kernels separately over a sweep of the agents count, the volume fraction, the
+// dimensionality, the heterogeneity of radii and the number of threads.
+// Options (comma separated lists): --agents, --dims, --fraction, --heterogeneity, --threads,
+// --filter=<substring of benchmark names>, --min-time=<seconds>, --min-iterations, --csv=<file>
+int main(int argc, char** argv)
+{
+	arguments args(argc, argv);
+
+	const auto agents = args.list<index_t>("agents", "10000,100000");
+	const auto dims = args.list<index_t>("dims", "2,3");
+	const auto fractions = args.list<real_t>("fraction", "0.1,0.4");
+	const auto heterogeneities = args.list<real_t>("heterogeneity", "0,0.5");
+	const auto threads =
+		args.list<int>("threads", omp_get_max_threads() == 1 ? "1" : "1," + std::to_string(omp_get_max_threads()));
+	const auto filter = args.get("filter", "");
+	const auto min_time = args.list<double>("min-time", "0.2").front();
+	const auto min_iterations = args.list<std::size_t>("min-iterations", "5").front();
+
+	reporter report({ "benchmark", "dims", "agents", "fraction", "heterogeneity", "threads", "iterations", "ns",
+					  "min_ns", "ns/agent", "pairs/s" },
+					args.get("csv", ""));
+
+	for (index_t d : dims)
+		for (index_t agents_count : agents)
+			for (real_t fraction : fractions)
+				for (real_t heterogeneity : heterogeneities)
+				{
+					environment_params params;
+					params.dims = d;
+					params.agents_count = agents_count;
+					params.volume_fraction = fraction;
+					params.radius_heterogeneity = heterogeneity;
+					params.motile = true;
+					params.maximum_number_of_attachments = 4;
+
+					bench_environment env(params);
+
+					if (d == 1)
+						run_benchmarks<1>(env, threads, filter, min_time, min_iterations, report);
+					else if (d == 2)
+						run_benchmarks<2>(env, threads, filter, min_time, min_iterations, report);
+					else if (d == 3)
+						run_benchmarks<3>(env, threads, filter, min_time, min_iterations, report);
+				}
+
+	return 0;
+}
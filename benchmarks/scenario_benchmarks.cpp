@@ -0,0 +1,360 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <omp.h>
+
+#include "agents_sorter.h"
+#include "bench_environment.h"
+#include "harness.h"
+#include "mech_trace.h"
+
+using namespace biofvm;
+using namespace micromech;
+using namespace micromech::bench;
+
+struct scenario
+{
+	std::string name;
+	environment_params params;
+	index_t sort_interval;
+};
+
+std::vector<scenario> make_scenarios(real_t scale)
+{
+	std::vector<scenario> scenarios(4);
+
+	// a single dense tumor spheroid in an otherwise empty domain
+	scenarios[0].name = "spheroid_3d";
+	scenarios[0].params.dims = 3;
+	scenarios[0].params.agents_count = 20000;
+	scenarios[0].params.volume_fraction = 0.05;
+	scenarios[0].params.placement = placement_t::clusters;
+	scenarios[0].params.clusters_count = 1;
+	scenarios[0].params.cluster_volume_fraction = 0.6;
+	scenarios[0].params.radius_heterogeneity = 0.2;
+
+	// a confluent layer of cells which are pushed into the empty margin around it
+	scenarios[1].name = "monolayer_2d";
+	scenarios[1].params.dims = 2;
+	scenarios[1].params.agents_count = 20000;
+	scenarios[1].params.volume_fraction = 0.9;
+	scenarios[1].params.margin = 100;
+
+	// sparse motile cells leaving their initial colonies
+	scenarios[2].name = "migrating_3d";
+	scenarios[2].params.dims = 3;
+	scenarios[2].params.agents_count = 10000;
+	scenarios[2].params.volume_fraction = 0.02;
+	scenarios[2].params.placement = placement_t::clusters;
+	scenarios[2].params.clusters_count = 20;
+	scenarios[2].params.cluster_volume_fraction = 0.3;
+	scenarios[2].params.motile = true;
+
+	// a few adhesive aggregates held together by springs
+	scenarios[3].name = "aggregate_3d";
+	scenarios[3].params.dims = 3;
+	scenarios[3].params.agents_count = 10000;
+	scenarios[3].params.volume_fraction = 0.05;
+	scenarios[3].params.placement = placement_t::clusters;
+	scenarios[3].params.clusters_count = 4;
+	scenarios[3].params.cluster_volume_fraction = 0.5;
+	scenarios[3].params.maximum_number_of_attachments = 6;
+
+	for (auto& s : scenarios)
+	{
+		s.params.agents_count = std::max<index_t>(1, s.params.agents_count * scale);
+		s.params.timestep = 0.1;
+		s.params.neighbors_skin = 2;
+		s.sort_interval = 10;
+	}
+
+	return scenarios;
+}
+
+struct baseline
+{
+	int threads = 0;
+	index_t agents = 0;
+	double steps_per_s = 0;
+};
+
+// The baseline of a scenario is a single line "threads agents steps/s" in <baseline_dir>/<scenario>.baseline
+bool read_baseline(const std::string& path, baseline& b)
+{
+	std::ifstream file(path);
+	return (bool)(file >> b.threads >> b.agents >> b.steps_per_s);
+}
+
+void write_baseline(const std::string& path, const baseline& b)
+{
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+	std::ofstream file(path);
+	file << b.threads << " " << b.agents << " " << b.steps_per_s << std::endl;
+}
+
+// Runs the scenario through the runtime models as a production step does, returns the best steps/s of repetitions
+double run_scenario(const scenario& s, int threads_count, std::size_t warmup_steps, std::size_t steps,
+					std::size_t repetitions, const std::string& trace_path, std::size_t trace_steps)
+{
+	bench_environment env(s.params);
+	agents_sorter sorter(env.partitioner, s.sort_interval);
+
+	mech_environment& me = env.me;
+	potential_model& potential = env.potential;
+	membrane_model& membrane = env.membrane;
+	motility_model& motility = env.motility;
+
+	auto step = [&] {
+		sorter.sort(me);
+		membrane.compute_basement_membrane_interactions(me);
+		motility.update_motility_velocities(me);
+		potential.update_neighbors(me);
+		potential.update_velocities(me);
+		potential.update_positions(me);
+	};
+
+	// springs form and the dense regions relax during the warmup
+	measure(threads_count, 0, warmup_steps, [] {}, step);
+
+	// the timeline of a few steps is written apart from the measured ones
+	if (!trace_path.empty())
+	{
+		mech_trace::instance().enable();
+		measure(threads_count, 0, trace_steps, [] {}, step);
+		mech_trace::instance().disable();
+
+		mech_trace::instance().write(trace_path);
+	}
+
+	double best = 0;
+	for (std::size_t r = 0; r < repetitions; r++)
+	{
+		auto result = measure(threads_count, 0, steps, [] {}, step);
+		best = std::max(best, 1e9 / result.mean_ns);
+	}
+
+	return best;
+}
+
+// Runs steps of the scenario from its initial state and returns the final positions in double. Agents are sorted only
+// when the environment is created, so the agents of runs built with different precisions stay in the same order.
+std::vector<double> run_trajectory(const scenario& s, int threads_count, std::size_t steps)
+{
+	bench_environment env(s.params);
+
+	mech_environment& me = env.me;
+
+#pragma omp parallel num_threads(threads_count)
+	for (std::size_t i = 0; i < steps; i++)
+	{
+		env.membrane.compute_basement_membrane_interactions(me);
+		env.motility.update_motility_velocities(me);
+		env.potential.update_neighbors(me);
+		env.potential.update_velocities(me);
+		env.potential.update_positions(me);
+	}
+
+	const auto& positions = me.agent_data.bio_agent_data.positions;
+
+	return std::vector<double>(positions.begin(), positions.begin() + me.agent_data.agents_count() * s.params.dims);
+}
+
+// The positions of a scenario are stored in <positions_dir>/<scenario>.positions as the count of values followed by
+// the values, all binary
+void write_positions(const std::string& path, const std::vector<double>& positions)
+{
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path());
+	std::ofstream file(path, std::ios::binary);
+
+	const std::uint64_t count = positions.size();
+	file.write((const char*)&count, sizeof(count));
+	file.write((const char*)positions.data(), count * sizeof(double));
+}
+
+bool read_positions(const std::string& path, std::vector<double>& positions)
+{
+	std::ifstream file(path, std::ios::binary);
+
+	std::uint64_t count = 0;
+	if (!file.read((char*)&count, sizeof(count)))
+		return false;
+
+	positions.resize(count);
+	return (bool)file.read((char*)positions.data(), count * sizeof(double));
+}
+
+constexpr const char* precision_name()
+{
+#ifdef MICROMECH_MIXED_PRECISION
+	return sizeof(real_t) == sizeof(float) ? "float" : "mixed";
+#else
+	return sizeof(real_t) == sizeof(float) ? "float" : "double";
+#endif
+}
+
+// Precision validation - the reference build writes the final positions of the scenarios, a build of another
+// precision compares its final positions with them and reports the maximal and the rms deviation of agents in um.
+// The runs must use the same scenarios, --scale, --steps and --threads.
+int compare_trajectories(const arguments& args, const std::vector<std::string>& selected)
+{
+	const auto scale = args.list<real_t>("scale", "1").front();
+	const auto threads_count = args.list<int>("threads", std::to_string(omp_get_max_threads())).front();
+	const auto steps = args.list<std::size_t>("steps", "100").front();
+	const auto write_dir = args.get("write-positions", "");
+	const auto compare_dir = args.get("compare-positions", "");
+	const auto tolerance = args.list<double>("tolerance", "-1").front();
+
+	reporter report({ "scenario", "dims", "agents", "threads", "steps", "precision", "max dev [um]", "rms dev [um]" },
+					args.get("csv", ""));
+
+	bool failed = false;
+
+	for (const auto& s : make_scenarios(scale))
+	{
+		if (!selected.empty() && std::find(selected.begin(), selected.end(), s.name) == selected.end())
+			continue;
+
+		const auto positions = run_trajectory(s, threads_count, steps);
+
+		std::string max_column = "-", rms_column = "-";
+
+		if (!write_dir.empty())
+		{
+			write_positions(write_dir + "/" + s.name + ".positions", positions);
+			max_column = rms_column = "saved";
+		}
+		else
+		{
+			std::vector<double> reference;
+
+			if (!read_positions(compare_dir + "/" + s.name + ".positions", reference)
+				|| reference.size() != positions.size())
+			{
+				max_column = rms_column = "missing";
+				failed = true;
+			}
+			else
+			{
+				double max_deviation = 0, sum = 0;
+
+				for (std::size_t i = 0; i < positions.size(); i += s.params.dims)
+				{
+					double deviation = 0;
+					for (index_t d = 0; d < s.params.dims; d++)
+						deviation += (positions[i + d] - reference[i + d]) * (positions[i + d] - reference[i + d]);
+
+					max_deviation = std::max(max_deviation, std::sqrt(deviation));
+					sum += deviation;
+				}
+
+				max_column = format(max_deviation);
+				rms_column = format(std::sqrt(sum / s.params.agents_count));
+
+				if (tolerance >= 0 && max_deviation > tolerance)
+				{
+					failed = true;
+					max_column += " FAIL";
+				}
+			}
+		}
+
+		report.row({ s.name, std::to_string(s.params.dims), std::to_string(s.params.agents_count),
+					 std::to_string(threads_count), std::to_string(steps), precision_name(), max_column,
+					 rms_column });
+	}
+
+	return failed ? 1 : 0;
+}
+
+// Measures whole steps of reference scenarios and compares them with the saved baselines. A missing baseline, or one
+// measured with a different number of threads or agents, is recorded. The program fails if steps/s of a scenario
+// drop below (1 - threshold) of its baseline.
+// Options: --scenario=<comma separated names>, --scale=<agents multiplier>, --threads, --steps, --warmup,
+// --repetitions, --baseline-dir=<directory>, --threshold=<relative drop>, --save-baseline, --csv=<file>,
+// --trace=<prefix of the Chrome Trace files of the scenarios>, --trace-steps
+// With --write-positions=<directory> or --compare-positions=<directory> [--tolerance=<um>] the scenarios are not
+// measured but validated across precisions, see compare_trajectories.
+int main(int argc, char** argv)
+{
+	arguments args(argc, argv);
+
+	std::vector<std::string> selected;
+	if (!args.get("scenario", "").empty())
+		selected = args.list<std::string>("scenario", "");
+
+	if (!args.get("write-positions", "").empty() || !args.get("compare-positions", "").empty())
+		return compare_trajectories(args, selected);
+
+	const auto scale = args.list<real_t>("scale", "1").front();
+	const auto threads_count = args.list<int>("threads", std::to_string(omp_get_max_threads())).front();
+	const auto steps = args.list<std::size_t>("steps", "100").front();
+	const auto warmup_steps = args.list<std::size_t>("warmup", "20").front();
+	const auto repetitions = args.list<std::size_t>("repetitions", "3").front();
+	const auto baseline_dir = args.get("baseline-dir", "");
+	const auto threshold = args.list<double>("threshold", "0.1").front();
+	const bool save_baseline = args.has("save-baseline");
+	const auto trace_prefix = args.get("trace", "");
+	const auto trace_steps = args.list<std::size_t>("trace-steps", "10").front();
+
+	reporter report({ "scenario", "dims", "agents", "threads", "steps", "ms/step", "steps/s", "agent-steps/s",
+					  "baseline", "change" },
+					args.get("csv", ""));
+
+	bool regressed = false;
+
+	for (const auto& s : make_scenarios(scale))
+	{
+		if (!selected.empty() && std::find(selected.begin(), selected.end(), s.name) == selected.end())
+			continue;
+
+		const std::string trace_path = trace_prefix.empty() ? "" : trace_prefix + s.name + ".json";
+		const double steps_per_s =
+			run_scenario(s, threads_count, warmup_steps, steps, repetitions, trace_path, trace_steps);
+
+		baseline current { threads_count, s.params.agents_count, steps_per_s };
+		baseline saved;
+
+		std::string baseline_column = "-", change_column = "-";
+
+		if (!baseline_dir.empty())
+		{
+			const std::string path = baseline_dir + "/" + s.name + ".baseline";
+
+			if (!save_baseline && read_baseline(path, saved) && saved.threads == current.threads
+				&& saved.agents == current.agents)
+			{
+				const double change = steps_per_s / saved.steps_per_s - 1;
+
+				baseline_column = format(saved.steps_per_s);
+				change_column = format(change * 100, "%+.1f%%");
+
+				if (change < -threshold)
+				{
+					regressed = true;
+					change_column += " FAIL";
+				}
+			}
+			else
+			{
+				write_baseline(path, current);
+				baseline_column = "saved";
+			}
+		}
+
+		report.row({ s.name, std::to_string(s.params.dims), std::to_string(s.params.agents_count),
+					 std::to_string(threads_count), std::to_string(steps), format(1e3 / steps_per_s),
+					 format(steps_per_s), format(steps_per_s * s.params.agents_count), baseline_column,
+					 change_column });
+	}
+
+	if (regressed)
+		std::printf("steps/s regressed by more than %g%% of the baseline\n", threshold * 100);
+
+	return regressed ? 1 : 0;
+}
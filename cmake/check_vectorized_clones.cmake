@@ -0,0 +1,66 @@
+# Checks that the clones of the vectorized kernels use packed instructions in the registers of their instruction set -
+# ymm for avx2 and zmm for avx512f. The pair kernels solve their lanes with square roots, the motility lanes normalize
+# their vectors with divisions.
+#
+# cmake -DOBJDUMP=<objdump> -DOBJECTS=<objects of MicroMechanicsCore> -P check_vectorized_clones.cmake
+
+# source,function,packed instruction
+set(kernels
+  "base_potential_model,update_cell_forces[a-z_]*internal,vsqrtp[sd]"
+  "base_motility_model,update_motility_internal,vdivp[sd]")
+
+set(clones_count 0)
+set(scalar_clones "")
+foreach(kernel IN LISTS kernels)
+  string(REPLACE "," ";" kernel "${kernel}")
+  list(GET kernel 0 source)
+  list(GET kernel 1 function_regex)
+  list(GET kernel 2 instruction)
+
+  set(object ${OBJECTS})
+  list(FILTER object INCLUDE REGEX "${source}")
+  if(NOT object)
+    message(FATAL_ERROR "The object of ${source}.cpp was not found")
+  endif()
+
+  execute_process(
+    COMMAND ${OBJDUMP} -d --no-show-raw-insn ${object}
+    OUTPUT_VARIABLE disassembly
+    RESULT_VARIABLE result)
+  if(NOT result EQUAL 0)
+    message(FATAL_ERROR "${OBJDUMP} failed on ${object}")
+  endif()
+
+  # one list item per function, objdump separates them by an empty line
+  string(REPLACE ";" "," disassembly "${disassembly}")
+  string(REPLACE "\n\n" ";" functions "${disassembly}")
+
+  set(kernel_clones_count 0)
+  foreach(function IN LISTS functions)
+    foreach(isa_register avx2:ymm avx512f:zmm)
+      string(REPLACE ":" ";" isa_register "${isa_register}")
+      list(GET isa_register 0 isa)
+      list(GET isa_register 1 register)
+
+      if(function MATCHES "<([^>\n]*${function_regex}[^>\n]*)\\.${isa}>:")
+        set(name "${CMAKE_MATCH_1}")
+        math(EXPR kernel_clones_count "${kernel_clones_count} + 1")
+        if(NOT function MATCHES "${instruction}[ \t]+[^\n]*%${register}")
+          list(APPEND scalar_clones "${name}.${isa}")
+        endif()
+      endif()
+    endforeach()
+  endforeach()
+
+  if(kernel_clones_count EQUAL 0)
+    message(FATAL_ERROR "No clones of ${function_regex} were found")
+  endif()
+  math(EXPR clones_count "${clones_count} + ${kernel_clones_count}")
+endforeach()
+
+if(scalar_clones)
+  list(JOIN scalar_clones "\n  " scalar_clones)
+  message(FATAL_ERROR "Clones without their packed instructions in their vector registers:\n  ${scalar_clones}")
+endif()
+
+message(STATUS "${clones_count} clones of the kernels are vectorized")
@@ -0,0 +1,35 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+// Indices of the agents with a flag set, in increasing order - the phases iterate them instead of branching on the
+// flag of every agent, so their worksharing loops are balanced over the relevant agents only. The set is rebuilt
+// when the version of the agent data changes or when the flags differ from those it was built from.
+class active_set
+{
+	std::vector<biofvm::index_t> indices_;
+	std::atomic<std::uint64_t> version_;
+
+	// the flags the set was built from and the one of the two buffers holding them - the other one is written by the
+	// next rebuild while threads may still compare the current one
+	std::vector<std::uint8_t> flags_[2];
+	std::atomic<int> flags_buffer_;
+
+public:
+	active_set() : version_(~0ULL), flags_buffer_(0) {}
+
+	// Must be called by all threads of the parallel region. Flags of existing agents changed in place increment
+	// version, so that the other caches of the agent data keyed on it are rebuilt as well.
+	void update(const std::uint8_t* flags, biofvm::index_t agents_count, std::uint64_t& version);
+
+	const biofvm::index_t* data() const { return indices_.data(); }
+	biofvm::index_t size() const { return indices_.size(); }
+};
+
+} // namespace micromech
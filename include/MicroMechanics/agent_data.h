@@ -4,6 +4,7 @@
 
 namespace micromech {
 
+class checkpoint_fields;
 struct mech_environment;
 
 struct agent_data
@@ -14,8 +15,18 @@ struct agent_data
 
 	biofvm::index_t agents_count() const;
 
+	// resizes the data to agents_count(), one or more agents were appended
 	virtual void add() = 0;
 	virtual void remove(biofvm::index_t index) = 0;
+
+	// copies the data of the agent from to the agent to, which starts without springs
+	virtual void copy(biofvm::index_t from, biofvm::index_t to) = 0;
+
+	// moves data of agent permutation[i] to index i; inverse_permutation maps old agent indices to the new ones
+	virtual void permute(const biofvm::index_t* permutation, const biofvm::index_t* inverse_permutation) = 0;
+
+	// lists the per-agent arrays and values which are stored in checkpoints
+	virtual void list_checkpoint_fields(checkpoint_fields&) {}
 };
 
 } // namespace micromech
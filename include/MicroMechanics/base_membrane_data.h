@@ -3,18 +3,22 @@
 #include <vector>
 
 #include "agent_data.h"
+#include "types.h"
 
 namespace micromech {
 
 struct base_membrane_data : public agent_data
 {
-	// std::vector<biofvm::real_t> cell_BM_adhesion_strength;
-	std::vector<biofvm::real_t> cell_BM_repulsion_strength;
+	// std::vector<mech_real_t> cell_BM_adhesion_strength;
+	std::vector<mech_real_t> cell_BM_repulsion_strength;
 
 	base_membrane_data(mech_environment& me);
 
 	virtual void add() override;
 	virtual void remove(biofvm::index_t index) override;
+	virtual void copy(biofvm::index_t from, biofvm::index_t to) override;
+	virtual void permute(const biofvm::index_t* permutation, const biofvm::index_t* inverse_permutation) override;
+	virtual void list_checkpoint_fields(checkpoint_fields& fields) override;
 };
 
 } // namespace micromech
@@ -2,38 +2,80 @@
 
 #include <cstdint>
 #include <functional>
+#include <span>
 
 #include <BioFVM/agent_data.h>
 
+#include "active_set.h"
 #include "agent_data.h"
+#include "types.h"
 
 namespace micromech {
 
+// views of the agent data passed to the bias direction rules, indexed by the agent
+struct migration_bias_direction_views
+{
+	biofvm::index_t dims;
+	const biofvm::real_t* positions;
+	const mech_real_t* velocity;
+	const mech_real_t* motility_vector;
+	const mech_real_t* migration_bias;
+	mech_real_t* migration_bias_direction;
+};
+
 struct base_motility_data : public agent_data
 {
-	using direction_update_func = std::function<void(biofvm::real_t*)>;
+	using direction_update_func = std::function<void(mech_real_t*)>;
+	using direction_rule_func =
+		std::function<void(std::span<const biofvm::index_t>, const migration_bias_direction_views&)>;
 
 	std::vector<std::uint8_t> is_motile;
-	std::vector<biofvm::real_t> persistence_time;
-	std::vector<biofvm::real_t> migration_speed;
+	std::vector<mech_real_t> persistence_time;
+	std::vector<mech_real_t> migration_speed;
 
-	std::vector<biofvm::real_t> migration_bias_direction;
-	std::vector<biofvm::real_t> migration_bias;
+	std::vector<mech_real_t> migration_bias_direction;
+	std::vector<mech_real_t> migration_bias;
 
-	std::vector<biofvm::real_t> motility_vector;
+	std::vector<mech_real_t> motility_vector;
 
 	std::vector<std::uint8_t> restrict_to_2d;
 
+	// Chemotaxis sets the bias direction of an agent without a direction callback when it changes its direction -
+	// along the gradient of substrate chemotaxis_index times chemotaxis_direction when it is nonzero, otherwise along
+	// the sum of the substrate gradients weighted by chemotactic_sensitivities when any of them is nonzero. The used
+	// substrates are collected when the active sets change, so changes of these parameters or of the callbacks of
+	// existing agents must be followed by invalidate_active_sets.
 	std::vector<biofvm::index_t> chemotaxis_index;
 	std::vector<biofvm::index_t> chemotaxis_direction;
-	std::vector<biofvm::real_t> chemotactic_sensitivities;
+	std::vector<mech_real_t> chemotactic_sensitivities;
 
+	// per-agent bias direction callbacks, called for each agent which changes its direction; they take precedence
+	// over the rules of the agent types
 	std::vector<direction_update_func> update_migration_bias_direction;
 
+	// Bias direction rules of the agent types - a rule is called once per step with the ascending indices of all
+	// agents of its type which change their direction and have no per-agent callback, and it sets their
+	// migration_bias_direction; agents of types with a rule do not use chemotaxis
+	std::vector<direction_rule_func> migration_bias_direction_rules;
+
+	// the motile agents, updated by update_motile_agents
+	active_set motile_agents;
+
 	base_motility_data(mech_environment& me);
 
+	// Must be called by all threads of the parallel region. is_motile changed in place for existing agents is
+	// detected and increments the active sets version of the agent data.
+	void update_motile_agents();
+
+	// Throws std::invalid_argument if the agent type is out of range, an empty rule removes the rule of the type. It
+	// invalidates the active sets, as the agents of the type start or stop using chemotaxis.
+	void set_migration_bias_direction_rule(biofvm::index_t agent_type, direction_rule_func rule);
+
 	virtual void add() override;
 	virtual void remove(biofvm::index_t index) override;
+	virtual void copy(biofvm::index_t from, biofvm::index_t to) override;
+	virtual void permute(const biofvm::index_t* permutation, const biofvm::index_t* inverse_permutation) override;
+	virtual void list_checkpoint_fields(checkpoint_fields& fields) override;
 };
 
 } // namespace micromech
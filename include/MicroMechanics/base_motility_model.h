@@ -1,5 +1,8 @@
 #pragma once
 
+#include <cstdint>
+#include <vector>
+
 #include <BioFVM/mesh.h>
 #include <BioFVM/types.h>
 
@@ -10,10 +13,36 @@ namespace micromech {
 
 class base_motility_model : public motility_model
 {
+	// keys the random numbers together with the agent, so they do not depend on the threads
+	std::uint64_t step_;
+
+	// Substrates used by the chemotaxis of the motile agents, collected again only when the active sets change. Their
+	// gradients are computed at the voxels of the turning agents, not on the whole microenvironment mesh.
+	std::vector<biofvm::index_t> chemotaxis_substrates_;
+	std::vector<std::uint8_t> substrates_used_;
+	std::uint64_t chemotaxis_substrates_version_;
+
+	void update_chemotaxis_substrates(mech_environment& me);
+
+	// whether each motile agent changes its direction in this step, and the agents of the bias direction rules
+	// grouped by their types in rule_agents_[rule_agents_offsets_[t] .. rule_agents_offsets_[t + 1])
+	std::vector<std::uint8_t> turning_;
+	std::vector<std::vector<biofvm::index_t>> thread_rule_agents_;
+	std::vector<biofvm::index_t> rule_agents_, rule_agents_offsets_;
+
+	// draws the persistence of the motile agents and calls the bias direction rules for the turning ones
+	void update_turning_agents(mech_environment& me);
+
 public:
 	base_motility_model(mech_environment& me);
 
 	virtual void update_motility_velocities(mech_environment& me) override;
+
+	virtual void list_checkpoint_fields(checkpoint_fields& fields) override;
+
+	// instantiated for 1, 2 and 3 dims
+	template <biofvm::index_t dims>
+	void update_motility_velocities(mech_environment& me);
 };
 
 } // namespace micromech
@@ -3,34 +3,75 @@
 #include <BioFVM/agent_data.h>
 
 #include "agent_data.h"
+#include "types.h"
 
 namespace micromech {
 
 struct base_potential_data : public agent_data
 {
-	std::vector<biofvm::real_t> cell_cell_adhesion_strength;
-	std::vector<biofvm::real_t> cell_cell_repulsion_strength;
+	std::vector<mech_real_t> cell_cell_adhesion_strength;
+	std::vector<mech_real_t> cell_cell_repulsion_strength;
 
-	std::vector<biofvm::real_t> cell_adhesion_affinities;
+	std::vector<mech_real_t> cell_adhesion_affinities;
 
-	std::vector<biofvm::real_t> relative_maximum_adhesion_distance;
+	std::vector<mech_real_t> relative_maximum_adhesion_distance;
 
 	std::vector<biofvm::index_t> maximum_number_of_attachments;
-	std::vector<biofvm::real_t> attachment_elastic_constant;
+	std::vector<mech_real_t> attachment_elastic_constant;
 
-	std::vector<biofvm::real_t> attachment_rate;
-	std::vector<biofvm::real_t> detachment_rate;
+	std::vector<mech_real_t> attachment_rate;
+	std::vector<mech_real_t> detachment_rate;
 
-	std::vector<biofvm::real_t> simple_pressure;
+	std::vector<mech_real_t> simple_pressure;
 
-	std::vector<biofvm::real_t> previous_velocity;
+	std::vector<mech_real_t> previous_velocity;
 
-	std::vector<std::vector<biofvm::index_t>> springs;
+	// Type parameters - when enabled, the strengths, the affinities and the elastic constants of agents are taken from
+	// the tables of their types and the per-agent arrays above are empty. Agents which override them have a slot in
+	// the compact override tables, override_slots holds the slot of each agent or -1. Switched by
+	// set_type_parameters.
+	bool type_parameters;
+	std::vector<mech_real_t> type_cell_cell_adhesion_strength;
+	std::vector<mech_real_t> type_cell_cell_repulsion_strength;
+	std::vector<mech_real_t> type_cell_adhesion_affinities;
+	std::vector<mech_real_t> type_attachment_elastic_constant;
+
+	std::vector<biofvm::index_t> override_slots;
+	std::vector<biofvm::index_t> override_agents;
+	std::vector<mech_real_t> override_cell_cell_adhesion_strength;
+	std::vector<mech_real_t> override_cell_cell_repulsion_strength;
+	std::vector<mech_real_t> override_cell_adhesion_affinities;
+	std::vector<mech_real_t> override_attachment_elastic_constant;
+
+	// positions at the last neighbors rebuild, invalidated when agents are added, removed or permuted
+	std::vector<biofvm::real_t> reference_positions;
+	bool reference_positions_valid;
+
+	// springs of the agent i are stored inline in springs starting at i * springs_capacity, there are springs_counts[i]
+	// of them
+	std::vector<biofvm::index_t> springs;
+	std::vector<biofvm::index_t> springs_counts;
+	biofvm::index_t springs_capacity;
 
 	base_potential_data(mech_environment& me);
 
+	// grows the capacity of the inline springs arrays keeping the attached springs
+	void reserve_springs(biofvm::index_t capacity);
+
+	// Enabling releases the per-agent arrays and the agents take the values of their types, disabling fills the
+	// per-agent arrays with the values the agents had and drops the overrides
+	void set_type_parameters(bool enabled);
+
+	// In the type parameters mode returns the override slot of the agent, a new one starts with the values of its type
+	biofvm::index_t override_parameters(biofvm::index_t index);
+	// the agent takes the values of its type again
+	void clear_override(biofvm::index_t index);
+
 	virtual void add() override;
 	virtual void remove(biofvm::index_t index) override;
+	virtual void copy(biofvm::index_t from, biofvm::index_t to) override;
+	virtual void permute(const biofvm::index_t* permutation, const biofvm::index_t* inverse_permutation) override;
+	virtual void list_checkpoint_fields(checkpoint_fields& fields) override;
 };
 
 } // namespace micromech
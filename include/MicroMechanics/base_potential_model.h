@@ -1,30 +1,106 @@
 #pragma once
 
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
 #include <BioFVM/mesh.h>
 #include <BioFVM/types.h>
 
 #include "grid_space_partitioner.h"
 #include "mech_environment.h"
 #include "potential_model.h"
+#include "types.h"
 
 namespace micromech {
 
+struct base_potential_data;
+
 class base_potential_model : public potential_model
 {
-	void compute_agents_potentials(mech_environment& me);
-	void attach_detach_springs(mech_environment& me);
-	void compute_springs_potentials(mech_environment& me);
-
 	grid_space_partitioner& partitioner_;
 
+	// Immovable agents are partitioned separately, only when the agents change - they are queried together with the
+	// movable agents, which are the only ones partitioned at each rebuild of the neighbors
+	grid_space_partitioner static_partitioner_;
+	std::vector<biofvm::index_t> static_agents_;
+	std::uint64_t static_version_;
+
+	// Verlet lists - neighbors are searched within the adhesion distance plus the skin and rebuilt (together with
+	// the partitioning) only when an agent moves by more than half of the skin since the last rebuild
+	biofvm::real_t neighbors_skin_;
+	biofvm::real_t max_squared_displacement_;
+	std::size_t neighbors_rebuilds_count_;
+
+	// symmetric forces - neighbors hold each pair only once, the pair is solved by its owner and the buffered result
+	// is applied to the other agent through the reverse pairs, so each agent is updated only by its own thread; with
+	// full lists the reverse pairs hold only the pairs of the immovable agents, which get their pressure through them
+	bool symmetric_forces_;
+	std::vector<mech_real_t> pair_forces_, pair_pressures_;
+	std::vector<biofvm::index_t> reverse_pair_offsets_, reverse_pair_cursors_;
+	std::vector<std::pair<biofvm::index_t, biofvm::index_t>> reverse_pairs_;
+
+	void update_reverse_pairs(mech_agent_data& data);
+
+	// the largest maximum_number_of_attachments, which sizes the inline springs arrays
+	biofvm::index_t max_attachments_;
+
+	// springs - attachments are proposed per neighbors pair and each agent accepts its proposals in the order of their
+	// random priorities up to its free attachments, a spring is attached when both agents accept it; all random draws
+	// are keyed by the step and the agents, so the result does not depend on the threads
+	std::uint64_t springs_step_;
+	std::vector<std::uint8_t> proposed_springs_, accepted_springs_;
+	std::vector<biofvm::index_t> spring_proposals_offsets_, spring_proposals_cursors_;
+	std::vector<std::tuple<biofvm::real_t, biofvm::index_t, biofvm::index_t>> spring_proposals_;
+
+	// returns the number of springs attached by the calling thread
+	biofvm::index_t resolve_spring_proposals(mech_agent_data& data, base_potential_data& potential_data);
+
+	// types x types coefficients of the repulsion, the adhesion and the springs precomputed from the type parameters
+	std::vector<mech_real_t> repulsion_coefficients_, adhesion_coefficients_, spring_coefficients_;
+
+	// neighbors and partitioning gauges of the metrics, reduced only when the metrics are enabled
+	biofvm::index_t metrics_count_, metrics_max_;
+
+	// active sets version of the agent data and the partitioning count of the partitioner when the neighbors were built
+	std::uint64_t neighbors_version_;
+	std::uint64_t neighbors_partitioning_;
+
+	void record_neighbors_metrics(mech_environment& me);
+
 public:
-	base_potential_model(grid_space_partitioner& partitioner, mech_environment& me);
+	base_potential_model(grid_space_partitioner& partitioner, mech_environment& me, biofvm::real_t neighbors_skin = 0,
+						 bool symmetric_forces = false);
 
 	virtual void update_velocities(mech_environment& me) override;
 
 	virtual void update_neighbors(mech_environment& me) override;
 
 	virtual void update_positions(mech_environment& me) override;
+
+	virtual void list_checkpoint_fields(checkpoint_fields& fields) override;
+
+	// the phases for the dimensionality known at compile time, they are instantiated for 1, 2 and 3 dims
+	template <biofvm::index_t dims>
+	void update_velocities(mech_environment& me);
+
+	template <biofvm::index_t dims>
+	void update_neighbors(mech_environment& me);
+
+	template <biofvm::index_t dims>
+	void update_positions(mech_environment& me);
+
+	// stages of update_velocities in their order, exposed to be measured separately
+	void update_pair_coefficients(mech_environment& me);
+	template <biofvm::index_t dims>
+	void compute_agents_potentials(mech_environment& me);
+	template <biofvm::index_t dims>
+	void attach_detach_springs(mech_environment& me);
+	template <biofvm::index_t dims>
+	void compute_springs_potentials(mech_environment& me);
+
+	std::size_t neighbors_rebuilds_count() const;
 };
 
 } // namespace micromech
@@ -1,5 +1,9 @@
 #pragma once
 
+#include <BioFVM/types.h>
+
+#include "boundary_band.h"
+#include "grid_space_partitioner.h"
 #include "mech_environment.h"
 #include "membrane_model.h"
 
@@ -7,10 +11,19 @@ namespace micromech {
 
 class base_wall_membrane_model : public membrane_model
 {
+	// an agent is repelled only by the walls closer than its radius, so with a partitioner only the movable agents in
+	// its two outermost layers of voxels are evaluated
+	boundary_band band_;
+
 public:
 	base_wall_membrane_model(mech_environment& me);
+	base_wall_membrane_model(mech_environment& me, grid_space_partitioner& partitioner);
 
 	virtual void compute_basement_membrane_interactions(mech_environment& me);
+
+	// instantiated for 1, 2 and 3 dims
+	template <biofvm::index_t dims>
+	void compute_basement_membrane_interactions(mech_environment& me);
 };
 
 } // namespace micromech
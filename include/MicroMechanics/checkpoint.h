@@ -0,0 +1,89 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+struct mech_environment;
+class potential_model;
+class membrane_model;
+class motility_model;
+
+// Named arrays and values of a snapshot - the agent data and the models list the state they need to resume into it
+class checkpoint_fields
+{
+public:
+	struct field
+	{
+		std::string name;
+		std::size_t element_size;
+		std::size_t count;
+		const void* data;
+		// resizes the field to count elements and returns its data
+		std::function<void*(std::size_t)> resize;
+		// a single value, which can not be resized
+		bool scalar;
+	};
+
+private:
+	std::string group_;
+	std::vector<field> fields_;
+
+public:
+	// names of the fields added next are prefixed by the group
+	void begin_group(const std::string& group) { group_ = group + "."; }
+
+	template <typename T>
+	void add(const std::string& name, std::vector<T>& values)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+
+		auto resize = [&values](std::size_t count) {
+			values.resize(count);
+			return (void*)values.data();
+		};
+
+		fields_.push_back({ group_ + name, sizeof(T), values.size(), values.data(), resize, false });
+	}
+
+	template <typename T>
+	void add(const std::string& name, T& value)
+	{
+		static_assert(std::is_trivially_copyable_v<T>);
+
+		auto resize = [&value](std::size_t) { return (void*)&value; };
+
+		fields_.push_back({ group_ + name, sizeof(T), 1, &value, resize, true });
+	}
+
+	const std::vector<field>& fields() const { return fields_; }
+};
+
+// Versioned binary snapshot of the mechanics - the agent data, the data of the models, the step counters of the
+// models which key their random numbers and the random seed. Neighbors are not stored, they are rebuilt by the next
+// update_neighbors, and neither are the migration bias direction callbacks and rules.
+//
+// The file holds a header, the fields table and the chunks table, followed by the fields split into chunks of
+// chunk_bytes. Chunks are aligned to the page size and listed with their stored sizes and compression, so that they
+// can be compressed independently; this version stores them uncompressed.
+//
+// Chunks are written in parallel. Loading maps the file into memory and copies the chunks in parallel directly into
+// the resized arrays.
+//
+// Models default to the ones of mech_environment. Saving throws std::invalid_argument if chunk_bytes is 0. Loading
+// throws std::runtime_error if the file is not a snapshot of a compatible environment - the same dims, agent types,
+// substrates and precision of the fields - or if its tables do not match the sizes of the fields and of the file.
+void save_checkpoint(const std::string& path, mech_environment& me, potential_model* potential = nullptr,
+					 membrane_model* membrane = nullptr, motility_model* motility = nullptr,
+					 std::size_t chunk_bytes = 1 << 22);
+
+void load_checkpoint(const std::string& path, mech_environment& me, potential_model* potential = nullptr,
+					 membrane_model* membrane = nullptr, motility_model* motility = nullptr);
+
+} // namespace micromech
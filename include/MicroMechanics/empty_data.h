@@ -10,6 +10,8 @@ struct empty_data : public agent_data
 
 	virtual void add() override {}
 	virtual void remove(biofvm::index_t) override {}
+	virtual void copy(biofvm::index_t, biofvm::index_t) override {}
+	virtual void permute(const biofvm::index_t*, const biofvm::index_t*) override {}
 };
 
 } // namespace micromech
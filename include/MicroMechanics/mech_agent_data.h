@@ -1,11 +1,16 @@
 #pragma once
 
 #include <cstdint>
+#include <functional>
 #include <memory>
+#include <span>
+#include <vector>
 
 #include <BioFVM/agent_data.h>
 
+#include "active_set.h"
 #include "agent_data.h"
+#include "types.h"
 
 namespace micromech {
 
@@ -13,26 +18,80 @@ struct mech_environment;
 
 struct mech_agent_data
 {
+private:
+	struct alignas(64) thread_requests
+	{
+		std::vector<biofvm::index_t> divisions, deaths;
+	};
+
+	// one queue per thread and a last one shared by the threads beyond them
+	std::vector<thread_requests> requests_;
+
+	thread_requests& thread_queue();
+
+public:
 	biofvm::agent_data bio_agent_data;
 
 	mech_environment& me;
 
-	std::vector<biofvm::real_t> velocity;
-	std::vector<biofvm::real_t> radius;
+	std::vector<mech_real_t> velocity;
+	std::vector<mech_real_t> radius;
 	std::vector<std::uint8_t> is_movable;
 
 	std::vector<biofvm::index_t> agent_type_indices;
 
-	std::vector<std::vector<biofvm::index_t>> neighbors;
+	// neighbors of the agent i are stored in neighbors starting at neighbors_offsets[i], there are neighbors_counts[i]
+	// of them
+	std::vector<biofvm::index_t> neighbors;
+	std::vector<biofvm::index_t> neighbors_offsets;
+	std::vector<biofvm::index_t> neighbors_counts;
 
 	std::unique_ptr<agent_data> potential_data, membrane_data, motility_data;
 
+	// incremented when agents are added, removed, copied or reordered or their active flags change in place, the
+	// active sets are rebuilt after it changes
+	std::uint64_t active_sets_version;
+
+	// the movable agents, updated by update_movable_agents
+	active_set movable_agents;
+
 	mech_agent_data(mech_environment& me);
 
 	void add();
 	void remove(biofvm::index_t index);
 
+	// appends count agents, the data are resized once
+	void add(biofvm::index_t count);
+
+	// Removes the agents at indices - the remaining agents keep their order and their springs and neighbors are
+	// remapped to the new indices. Called by a single thread of a parallel region, the compaction runs in tasks.
+	void remove(std::span<const biofvm::index_t> indices);
+
+	// copies the data of the agent from to the agent to, which starts without springs and neighbors
+	void copy(biofvm::index_t from, biofvm::index_t to);
+
+	// Division and death requests can be queued by any thread of a parallel region, they are applied by
+	// apply_requests at a step boundary
+	void request_division(biofvm::index_t parent);
+	void request_death(biofvm::index_t index);
+
+	// Must be called by a single thread. A child is appended for each division request, copied from its parent, in the
+	// order of the parents, and on_division(parent, child) is called for it; agents which die do not divide.
+	// The dying agents are removed afterwards.
+	void apply_requests(const std::function<void(biofvm::index_t, biofvm::index_t)>& on_division = {});
+
+	// reorders all per-agent data so that the agent permutation[i] becomes the agent i
+	void permute(const biofvm::index_t* permutation);
+
 	biofvm::index_t agents_count() const;
+
+	// Must be called by all threads of the parallel region. is_movable changed in place for existing agents is
+	// detected and increments active_sets_version.
+	void update_movable_agents();
+
+	// must be called when the chemotaxis parameters of existing agents change, changes of is_movable and is_motile
+	// are detected by the active sets
+	void invalidate_active_sets();
 };
 
 } // namespace micromech
@@ -5,6 +5,7 @@
 #include <BioFVM/microenvironment.h>
 
 #include "mech_agent_data.h"
+#include "mech_metrics.h"
 #include "membrane_model.h"
 #include "motility_model.h"
 #include "potential_model.h"
@@ -21,6 +22,8 @@ struct mech_environment
 
 	mech_agent_data agent_data;
 
+	mech_metrics metrics;
+
 	std::unique_ptr<potential_model> potential_m;
 	std::unique_ptr<membrane_model> membrane_m;
 	std::unique_ptr<motility_model> motility_m;
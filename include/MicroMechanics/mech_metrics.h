@@ -0,0 +1,183 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <fstream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+enum class mech_phase : biofvm::index_t
+{
+	sort,
+	membrane,
+	motility,
+	neighbors,
+	velocities,
+	positions,
+	// copying of the agent data to the trajectory writer, including the waits for a free buffer
+	output,
+	count
+};
+
+enum class mech_counter : biofvm::index_t
+{
+	// pairs whose potentials were computed, a pair in both neighbors lists counts twice
+	pairs_evaluated,
+	springs_attached,
+	springs_detached,
+	neighbors_rebuilds,
+	// frames and bytes written by the trajectory writer in the background, with the time of encoding and writing
+	// them; stall is the time the steps waited for a free buffer
+	output_frames,
+	output_bytes,
+	output_write_ns,
+	output_stall_ns,
+	// phases of the last step before each sort of agents_sorter and of the first step after it, without sorting and
+	// output - their difference is the time saved by sorting, to be compared with the time of the sort phase
+	steps_before_sort_ns,
+	steps_after_sort_ns,
+	count
+};
+
+// gauges keep the value of the last neighbors rebuild
+enum class mech_gauge : biofvm::index_t
+{
+	neighbors_per_agent_mean,
+	neighbors_per_agent_max,
+	// over the voxels of the partitioner which contain an agent
+	agents_per_voxel_mean,
+	agents_per_voxel_max,
+	count
+};
+
+enum class metrics_format
+{
+	json,
+	csv
+};
+
+constexpr std::size_t mech_phases_count = (std::size_t)mech_phase::count;
+constexpr std::size_t mech_counters_count = (std::size_t)mech_counter::count;
+constexpr std::size_t mech_gauges_count = (std::size_t)mech_gauge::count;
+
+// Wall time of a phase summed over steps - the time of each thread in the phase, and its minimum, maximum and mean
+// over the threads of each step
+struct phase_statistics
+{
+	std::int64_t min_thread_ns = 0;
+	std::int64_t max_thread_ns = 0;
+	double mean_thread_ns = 0;
+
+	// the slowest thread relative to the mean one, 1 for perfectly balanced phases
+	double imbalance() const { return mean_thread_ns > 0 ? max_thread_ns / mean_thread_ns : 1; }
+};
+
+struct metrics_summary
+{
+	std::uint64_t steps = 0;
+	std::array<phase_statistics, mech_phases_count> phases;
+	std::array<std::uint64_t, mech_counters_count> counters {};
+};
+
+// Per-phase timings and counters of the mechanics. Phases are timed by each thread of the parallel region and
+// counters can be added by any thread; both are aggregated at the end of each step.
+// Disabled metrics cost a branch per phase, building without MICROMECH_METRICS_ENABLED removes even that.
+class mech_metrics
+{
+	struct alignas(64) thread_slot
+	{
+		std::array<std::int64_t, mech_phases_count> starts;
+		std::array<std::int64_t, mech_phases_count> elapsed;
+		std::array<std::uint64_t, mech_counters_count> counters;
+	};
+
+	bool enabled_ = false;
+
+	std::vector<thread_slot> threads_;
+	std::array<double, mech_gauges_count> gauges_ {};
+
+	metrics_summary last_step_, interval_, total_;
+
+	std::ofstream output_;
+	metrics_format format_ = metrics_format::json;
+	std::uint64_t dump_interval_ = 0;
+
+	void begin_phase_internal(mech_phase phase);
+	void end_phase_internal(mech_phase phase);
+	void add_internal(mech_counter counter, std::uint64_t value);
+	void end_step_internal();
+
+	void write_json(std::ostream& os, const metrics_summary& summary) const;
+	void write_csv_header(std::ostream& os) const;
+	void write_csv_row(std::ostream& os, const metrics_summary& summary) const;
+
+public:
+	bool enabled() const
+	{
+#ifdef MICROMECH_METRICS_ENABLED
+		return enabled_;
+#else
+		return false;
+#endif
+	}
+
+	// Must be called outside of a parallel region. Every dump_interval steps the summary of the interval is appended
+	// to output_path, as a JSON object per line or as a CSV row. Empty output_path or 0 interval disable dumping.
+	void enable(const std::string& output_path = "", metrics_format format = metrics_format::json,
+				std::uint64_t dump_interval = 0);
+	void disable();
+
+	// clears the summaries and gauges
+	void reset();
+
+	// phases may nest, each thread times its own part of the phase
+	void begin_phase(mech_phase phase)
+	{
+		if (enabled())
+			begin_phase_internal(phase);
+	}
+
+	void end_phase(mech_phase phase)
+	{
+		if (enabled())
+			end_phase_internal(phase);
+	}
+
+	void add(mech_counter counter, std::uint64_t value)
+	{
+		if (enabled())
+			add_internal(counter, value);
+	}
+
+	// must be called by a single thread
+	void set(mech_gauge gauge, double value)
+	{
+		if (enabled())
+			gauges_[(std::size_t)gauge] = value;
+	}
+
+	// Must be called by all threads of the parallel region after the phases of a step
+	void end_step()
+	{
+		if (enabled())
+			end_step_internal();
+	}
+
+	const metrics_summary& last_step() const { return last_step_; }
+	const metrics_summary& total() const { return total_; }
+	double gauge(mech_gauge gauge) const { return gauges_[(std::size_t)gauge]; }
+
+	void write_json(std::ostream& os) const { write_json(os, total_); }
+	void write_csv(std::ostream& os) const;
+
+	static const char* name(mech_phase phase);
+	static const char* name(mech_counter counter);
+	static const char* name(mech_gauge gauge);
+};
+
+} // namespace micromech
@@ -0,0 +1,100 @@
+#pragma once
+
+#include <stdexcept>
+#include <utility>
+
+#include <BioFVM/types.h>
+
+#include "checkpoint.h"
+#include "mech_environment.h"
+
+namespace micromech {
+
+// Statically composed simulation - the models are called through their phases templated by dims, so a step contains
+// no virtual calls and no dispatch on the dimensionality of the mesh. The models of mech_environment are not used,
+// they remain for the models chosen at runtime.
+template <biofvm::index_t dims, typename potential_t, typename membrane_t, typename motility_t>
+class mech_simulation
+{
+	mech_environment& me_;
+
+	potential_t potential_;
+	membrane_t membrane_;
+	motility_t motility_;
+
+public:
+	mech_simulation(mech_environment& me, potential_t potential, membrane_t membrane, motility_t motility)
+		: me_(me), potential_(std::move(potential)), membrane_(std::move(membrane)), motility_(std::move(motility))
+	{
+		if (me.m.mesh.dims != dims)
+			throw std::invalid_argument("mech_simulation dims do not match the dims of the mesh");
+	}
+
+	// as the methods of the models, the phases are called by all threads of the enclosing parallel region
+	// and they are timed by the metrics of the environment
+
+	void compute_basement_membrane_interactions()
+	{
+		me_.metrics.begin_phase(mech_phase::membrane);
+		membrane_.template compute_basement_membrane_interactions<dims>(me_);
+		me_.metrics.end_phase(mech_phase::membrane);
+	}
+
+	void update_motility_velocities()
+	{
+		me_.metrics.begin_phase(mech_phase::motility);
+		motility_.template update_motility_velocities<dims>(me_);
+		me_.metrics.end_phase(mech_phase::motility);
+	}
+
+	void update_neighbors()
+	{
+		me_.metrics.begin_phase(mech_phase::neighbors);
+		potential_.template update_neighbors<dims>(me_);
+		me_.metrics.end_phase(mech_phase::neighbors);
+	}
+
+	void update_velocities()
+	{
+		me_.metrics.begin_phase(mech_phase::velocities);
+		potential_.template update_velocities<dims>(me_);
+		me_.metrics.end_phase(mech_phase::velocities);
+	}
+
+	void update_positions()
+	{
+		me_.metrics.begin_phase(mech_phase::positions);
+		potential_.template update_positions<dims>(me_);
+		me_.metrics.end_phase(mech_phase::positions);
+	}
+
+	// sorting of agents is not a part of the step, so end_step of the metrics is left to the caller
+	void simulate_step()
+	{
+		compute_basement_membrane_interactions();
+		update_motility_velocities();
+		update_neighbors();
+		update_velocities();
+		update_positions();
+	}
+
+	// checkpoints of the environment with the state of the models of the simulation, called outside of a parallel
+	// region
+	void save_checkpoint(const std::string& path)
+	{
+		micromech::save_checkpoint(path, me_, &potential_, &membrane_, &motility_);
+	}
+
+	void load_checkpoint(const std::string& path)
+	{
+		micromech::load_checkpoint(path, me_, &potential_, &membrane_, &motility_);
+	}
+
+	mech_environment& environment() { return me_; }
+
+	potential_t& potential() { return potential_; }
+	membrane_t& membrane() { return membrane_; }
+	motility_t& motility() { return motility_; }
+};
+
+} // namespace micromech
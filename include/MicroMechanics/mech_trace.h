@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+// worksharing loops of the models
+enum class trace_loop : biofvm::index_t
+{
+	neighbors_count,
+	neighbors_fill,
+	pressure_clear,
+	forces,
+	forces_reverse,
+	springs_detach,
+	springs_propose,
+	springs_accept,
+	springs_contract,
+	motility,
+	membrane,
+	positions,
+	count
+};
+
+// Timeline of the worksharing loops of each thread, written in the Chrome Trace format which also opens in Perfetto.
+// A traced loop is a nowait loop followed by barrier(), so the trace shows the work of each thread in the loop as well
+// as its wait at the barrier:
+//     trace.begin(loop);
+//     #pragma omp for nowait
+//     for (...) ...
+//     trace.barrier(loop);
+// The explicit barrier costs the same as the implicit one, disabled tracing costs a branch per loop and building
+// without MICROMECH_METRICS_ENABLED removes even that.
+class mech_trace
+{
+	struct record
+	{
+		trace_loop loop;
+		std::int64_t begin, wait, end;
+	};
+
+	struct alignas(64) thread_buffer
+	{
+		std::vector<record> records;
+		std::int64_t begin, wait;
+		std::uint64_t dropped;
+	};
+
+	bool enabled_ = false;
+	std::size_t max_records_ = 0;
+	std::int64_t origin_ = 0;
+
+	std::vector<thread_buffer> threads_;
+
+	void begin_internal();
+	void wait_internal();
+	void end_internal(trace_loop loop);
+
+public:
+	static mech_trace& instance();
+
+	bool enabled() const
+	{
+#ifdef MICROMECH_METRICS_ENABLED
+		return enabled_;
+#else
+		return false;
+#endif
+	}
+
+	// Must be called outside of a parallel region, clears the recorded loops. Each thread keeps at most
+	// max_records_per_thread loops, the later ones are dropped.
+	void enable(std::size_t max_records_per_thread = 1 << 20);
+	void disable();
+
+	void begin(trace_loop)
+	{
+		if (enabled())
+			begin_internal();
+	}
+
+	// the calling thread finished its iterations of the loop and waits for the others
+	void barrier(trace_loop loop)
+	{
+		if (enabled())
+			wait_internal();
+
+#pragma omp barrier
+
+		if (enabled())
+			end_internal(loop);
+	}
+
+	std::size_t records_count() const;
+
+	// Writes the recorded loops as complete events of their threads, throws std::runtime_error if the file can not be
+	// written
+	void write(const std::string& path) const;
+
+	static const char* name(trace_loop loop);
+};
+
+} // namespace micromech
@@ -2,12 +2,16 @@
 
 namespace micromech {
 
+class checkpoint_fields;
 struct mech_environment;
 
 class membrane_model
 {
 public:
 	virtual void compute_basement_membrane_interactions(mech_environment& me) = 0;
+
+	// lists the state of the model which is stored in checkpoints
+	virtual void list_checkpoint_fields(checkpoint_fields&) {}
 };
 
 } // namespace micromech
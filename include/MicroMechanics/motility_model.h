@@ -2,12 +2,16 @@
 
 namespace micromech {
 
+class checkpoint_fields;
 struct mech_environment;
 
 class motility_model
 {
 public:
 	virtual void update_motility_velocities(mech_environment& me) = 0;
+
+	// lists the state of the model which is stored in checkpoints
+	virtual void list_checkpoint_fields(checkpoint_fields&) {}
 };
 
 } // namespace micromech
@@ -9,6 +9,9 @@ class no_wall_membrane_model : public membrane_model
 {
 public:
 	virtual void compute_basement_membrane_interactions(mech_environment&) {}
+
+	template <biofvm::index_t>
+	void compute_basement_membrane_interactions(mech_environment&) {}
 };
 
 } // namespace micromech
@@ -2,6 +2,7 @@
 
 namespace micromech {
 
+class checkpoint_fields;
 struct mech_environment;
 
 class potential_model
@@ -12,6 +13,9 @@ public:
 	virtual void update_neighbors(mech_environment& me) = 0;
 
 	virtual void update_positions(mech_environment& me) = 0;
+
+	// lists the state of the model which is stored in checkpoints
+	virtual void list_checkpoint_fields(checkpoint_fields&) {}
 };
 
 } // namespace micromech
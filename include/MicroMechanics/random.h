@@ -1,19 +1,62 @@
 #pragma once
 
+#include <cstdint>
+
 #include <BioFVM/types.h>
 
 namespace micromech {
 
+// streams of the keyed random numbers, each stage draws from its own streams so the stages are not correlated
+enum random_stream : std::uint32_t
+{
+	motility_persistence_stream = 0,
+	motility_walk_stream,
+	spring_detachment_stream,
+	spring_attachment_stream,
+	spring_priority_stream,
+	first_user_stream = 1024
+};
+
 class random
 {
+	std::uint64_t seed_ = 0;
+	std::uint64_t epoch_ = 0;
+
 public:
 	static random& instance();
 
+	// sequential numbers of the calling thread, they depend on the number of threads and their scheduling
 	biofvm::real_t uniform(const biofvm::real_t min = 0, const biofvm::real_t max = 1);
 
 	biofvm::real_t normal(const biofvm::real_t mean = 0, const biofvm::real_t std = 1);
 
+	// Counter-based numbers - they are determined only by the seed and the keys (step, agent, stream), so they do not
+	// depend on the drawing thread. Each key yields its own sequence of numbers, counter selects a block of it.
+
+	// uniform number from [0, 1), the first number of the counter-th block of the sequence
+	biofvm::real_t keyed_uniform(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+								 std::uint64_t counter = 0);
+
+	// fills the first count uniform numbers from [0, 1) of the sequence
+	void keyed_uniform(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+					   biofvm::real_t* __restrict__ numbers, biofvm::index_t count);
+
+	// fills the first count standard normal numbers of the sequence
+	void keyed_normal(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+					  biofvm::real_t* __restrict__ numbers, biofvm::index_t count);
+
+	// fills numbers[i] with keyed_uniform(step, first_agent + i, stream) for count consecutive agents
+	void keyed_uniform_per_agent(std::uint64_t step, std::uint64_t first_agent, std::uint32_t stream,
+								 biofvm::real_t* __restrict__ numbers, biofvm::index_t count);
+
+	// fills numbers[i * per_agent .. (i + 1) * per_agent) with the first per_agent numbers of the sequence of
+	// (step, agents[i], stream) for count agents, per_agent is at most 2
+	void keyed_uniform_for_agents(std::uint64_t step, const biofvm::index_t* __restrict__ agents, std::uint32_t stream,
+								  biofvm::real_t* __restrict__ numbers, biofvm::index_t count,
+								  biofvm::index_t per_agent = 1);
+
 	void set_seed(unsigned int seed);
+	std::uint64_t seed() const;
 };
 
 } // namespace micromech
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <BioFVM/types.h>
+
+#include "boundary_band.h"
+#include "grid_space_partitioner.h"
+#include "mech_environment.h"
+#include "membrane_model.h"
+#include "signed_distance_field.h"
+
+namespace micromech {
+
+// Basement membranes of arbitrary geometry - ducts, vessels or organoid shells - given by a signed distance field
+// instead of immovable wall agents. An agent closer to a membrane than its radius is repelled along the gradient of
+// the field the same way as from the walls of base_wall_membrane_model, at the cost of one lookup of the field.
+class sdf_membrane_model : public membrane_model
+{
+	signed_distance_field field_;
+
+	// with a partitioner only the movable agents in the voxels near the membranes are evaluated, which assumes
+	// distances which are true distances
+	boundary_band band_;
+
+public:
+	// throws std::invalid_argument if the dims of the field differ from the dims of the environment
+	sdf_membrane_model(mech_environment& me, signed_distance_field field);
+	sdf_membrane_model(mech_environment& me, signed_distance_field field, grid_space_partitioner& partitioner);
+
+	virtual void compute_basement_membrane_interactions(mech_environment& me);
+
+	// instantiated for 1, 2 and 3 dims
+	template <biofvm::index_t dims>
+	void compute_basement_membrane_interactions(mech_environment& me);
+
+	const signed_distance_field& field() const { return field_; }
+};
+
+} // namespace micromech
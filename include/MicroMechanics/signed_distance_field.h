@@ -0,0 +1,130 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include <BioFVM/mesh.h>
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+// Analytic shape whose surface is a membrane, agents are kept either inside or outside of it
+struct sdf_primitive
+{
+	enum class shape_t
+	{
+		// center a and radius
+		sphere,
+		// segment from a to b and radius, a duct or a vessel
+		capsule,
+		// corners a and b
+		box
+	};
+
+	// how the region of the primitive is combined with the region of the primitives before it
+	enum class combine_t
+	{
+		// agents are in both regions
+		intersect,
+		// agents are in either region, e.g. branching ducts
+		unite,
+		// agents are in the previous region but not in this one, e.g. an obstacle carved from a box
+		subtract
+	};
+
+	shape_t shape;
+	biofvm::point_t<biofvm::real_t, 3> a = { 0, 0, 0 };
+	biofvm::point_t<biofvm::real_t, 3> b = { 0, 0, 0 };
+	biofvm::real_t radius = 0;
+	bool inside = true;
+	// ignored for the first primitive
+	combine_t combine = combine_t::intersect;
+};
+
+// Signed distance to the membranes sampled on a regular grid together with its gradient. The distance is positive
+// where agents may be and the gradient points away from the membranes. Unused dims of the grid have a single node and
+// the field is extrapolated linearly from the cells on the sides of the grid, so agents which left it are still
+// pushed back.
+//
+// The file holds a header with the dims, the shape, the origin and the spacing of the grid, followed by the distances
+// of the nodes, x fastest, and optionally by their gradients, all as doubles. Missing gradients are computed by
+// central differences.
+class signed_distance_field
+{
+	biofvm::index_t dims_;
+	biofvm::point_t<biofvm::index_t, 3> shape_;
+	biofvm::point_t<biofvm::index_t, 3> strides_;
+	biofvm::point_t<biofvm::real_t, 3> origin_;
+	biofvm::real_t spacing_;
+
+	std::vector<biofvm::real_t> distances_;
+	// dims per node
+	std::vector<biofvm::real_t> gradients_;
+
+	void compute_gradients();
+
+public:
+	// throws std::invalid_argument if the grid is empty or the sizes of distances and gradients do not match it
+	signed_distance_field(biofvm::index_t dims, biofvm::point_t<biofvm::index_t, 3> shape,
+						  biofvm::point_t<biofvm::real_t, 3> origin, biofvm::real_t spacing,
+						  std::vector<biofvm::real_t> distances, std::vector<biofvm::real_t> gradients = {});
+
+	// throws std::runtime_error if the file can not be read or is not a distance field
+	static signed_distance_field load(const std::string& path);
+
+	// Samples the region of the primitives, combined in their order, on a grid covering the bounding box of the mesh.
+	// Combined distances are exact only near the surface of the region, elsewhere they underestimate the true
+	// distances. Throws std::invalid_argument if there are no primitives or the spacing is not positive.
+	static signed_distance_field from_primitives(const biofvm::cartesian_mesh& mesh, biofvm::real_t spacing,
+												 const std::vector<sdf_primitive>& primitives);
+
+	// throws std::runtime_error if the file can not be written
+	void save(const std::string& path) const;
+
+	biofvm::index_t dims() const { return dims_; }
+	biofvm::real_t spacing() const { return spacing_; }
+
+	// Multilinear interpolation of the distance and the gradient at a position, one lookup of the 2^dims surrounding
+	// nodes
+	template <biofvm::index_t dims>
+	biofvm::real_t lookup(const biofvm::real_t* __restrict__ position, biofvm::real_t* __restrict__ gradient) const
+	{
+		biofvm::index_t cell[dims];
+		biofvm::real_t weight[dims];
+
+		for (biofvm::index_t d = 0; d < dims; d++)
+		{
+			const biofvm::real_t coordinate = (position[d] - origin_[d]) / spacing_;
+
+			cell[d] = std::clamp<biofvm::index_t>((biofvm::index_t)std::floor(coordinate), 0, shape_[d] - 2);
+			weight[d] = coordinate - cell[d];
+			gradient[d] = 0;
+		}
+
+		biofvm::real_t distance = 0;
+
+		for (biofvm::index_t corner = 0; corner < (1 << dims); corner++)
+		{
+			biofvm::index_t node = 0;
+			biofvm::real_t corner_weight = 1;
+
+			for (biofvm::index_t d = 0; d < dims; d++)
+			{
+				const bool upper = (corner >> d) & 1;
+				node += (cell[d] + upper) * strides_[d];
+				corner_weight *= upper ? weight[d] : 1 - weight[d];
+			}
+
+			distance += corner_weight * distances_[node];
+			for (biofvm::index_t d = 0; d < dims; d++)
+				gradient[d] += corner_weight * gradients_[node * dims + d];
+		}
+
+		return distance;
+	}
+};
+
+} // namespace micromech
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+#include "types.h"
+
+namespace micromech {
+
+struct base_potential_data;
+struct mech_environment;
+
+// per-agent fields of the trajectory, combined as flags
+enum trajectory_field : std::uint32_t
+{
+	trajectory_positions = 1 << 0,
+	trajectory_simple_pressure = 1 << 1,
+	trajectory_velocity = 1 << 2,
+	trajectory_agent_type = 1 << 3,
+	trajectory_springs_counts = 1 << 4
+};
+
+struct trajectory_options
+{
+	std::uint32_t fields = trajectory_positions;
+
+	// frames which are copied but not yet written, capture waits when all of them are in flight
+	biofvm::index_t buffers_count = 2;
+
+	// agents of a chunk, chunks of a field are encoded independently
+	biofvm::index_t chunk_agents = 1 << 16;
+
+	// Lossy quantization of the real fields - their values are rounded to multiples of quantum and stored as
+	// variable-length integers. 0 stores them exactly.
+	double quantum = 0;
+
+	// Quantized and integer fields are stored as differences from the previous frame, except for key frames written
+	// every keyframe_interval frames and when the agents count changes
+	bool delta = false;
+	biofvm::index_t keyframe_interval = 16;
+};
+
+// Streaming output of the agents - capture copies the selected fields into a free buffer at a step boundary and a
+// background thread encodes and writes them while the simulation continues. At most buffers_count frames are held
+// in memory, capture blocks when the writer falls behind.
+//
+// The file holds a header with the fields and the encoding, followed by frames. A frame holds the step, the agents
+// count and the chunks of each field with their encoded sizes.
+//
+// The written frames and bytes and the time of writing them are added to the counters of the metrics of the
+// environment, so they appear in its summaries together with the phases.
+class trajectory_writer
+{
+	struct frame_buffer
+	{
+		std::uint64_t step;
+		biofvm::index_t agents_count;
+
+		std::vector<biofvm::real_t> positions;
+		std::vector<mech_real_t> simple_pressure;
+		std::vector<mech_real_t> velocity;
+		std::vector<biofvm::index_t> agent_type;
+		std::vector<biofvm::index_t> springs_counts;
+	};
+
+	mech_environment& me_;
+	base_potential_data* potential_data_;
+	trajectory_options options_;
+
+	std::ofstream file_;
+
+	std::vector<frame_buffer> buffers_;
+	std::deque<std::size_t> free_, filled_;
+	std::size_t current_;
+
+	std::mutex mutex_;
+	std::condition_variable changed_;
+	bool closing_;
+
+	// state of the encoder, owned by the background thread
+	std::uint64_t frames_encoded_;
+	biofvm::index_t previous_agents_count_;
+	std::vector<std::int64_t> previous_values_[5];
+	std::vector<char> encoded_;
+
+	std::atomic<std::uint64_t> frames_written_, bytes_written_, write_ns_;
+	std::atomic<bool> failed_;
+	std::uint64_t frames_reported_, bytes_reported_, write_ns_reported_;
+
+	std::thread thread_;
+
+	void write_frames();
+	void encode(const frame_buffer& frame);
+
+	template <typename T>
+	void encode_field(std::size_t field_index, const T* values, biofvm::index_t components,
+					  biofvm::index_t agents_count, bool keyframe);
+
+public:
+	// throws std::invalid_argument if a field is not a part of the agent data and std::runtime_error if the file can
+	// not be opened
+	trajectory_writer(const std::string& path, mech_environment& me, trajectory_options options = {});
+	~trajectory_writer();
+
+	trajectory_writer(const trajectory_writer&) = delete;
+	trajectory_writer& operator=(const trajectory_writer&) = delete;
+
+	// Must be called by all threads of the parallel region at a step boundary, copies the fields in parallel
+	void capture(std::uint64_t step);
+
+	// Must be called outside of a parallel region, waits until all captured frames are written and stops the
+	// background thread. Throws std::runtime_error if writing failed.
+	void close();
+};
+
+} // namespace micromech
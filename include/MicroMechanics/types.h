@@ -0,0 +1,16 @@
+#pragma once
+
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+// Precision of the mechanics - positions are stored by BioFVM in biofvm::real_t, velocities, radii and the parameters
+// of agents in mech_real_t. The mixed precision build keeps them in float while the positions stay in the precision
+// of BioFVM, differences of positions are formed in it before they are narrowed.
+#ifdef MICROMECH_MIXED_PRECISION
+using mech_real_t = float;
+#else
+using mech_real_t = biofvm::real_t;
+#endif
+
+} // namespace micromech
@@ -0,0 +1,40 @@
+#include "active_set.h"
+
+#include <algorithm>
+
+using namespace biofvm;
+using namespace micromech;
+
+void active_set::update(const std::uint8_t* flags, index_t agents_count, std::uint64_t& version)
+{
+	const int buffer = flags_buffer_.load(std::memory_order_relaxed);
+
+	if (version_.load(std::memory_order_relaxed) == version)
+	{
+		// the count of agents is the same while the version is
+		if (std::equal(flags, flags + agents_count, flags_[buffer].data()))
+			return;
+
+		// flags were changed in place - all threads compared the version before it is incremented
+#pragma omp barrier
+
+#pragma omp single
+		version++;
+	}
+
+#pragma omp single
+	{
+		indices_.clear();
+
+		for (index_t i = 0; i < agents_count; i++)
+			if (flags[i])
+				indices_.push_back(i);
+
+		flags_[1 - buffer].assign(flags, flags + agents_count);
+	}
+
+	// each thread stores the version after the barrier of single, so no thread can see it before all of them passed
+	// the check above and each of them sees it in the next update; the same holds for the buffer of the flags
+	version_.store(version, std::memory_order_relaxed);
+	flags_buffer_.store(1 - buffer, std::memory_order_relaxed);
+}
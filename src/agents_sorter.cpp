@@ -0,0 +1,72 @@
+#include "agents_sorter.h"
+
+using namespace biofvm;
+using namespace micromech;
+
+// the slowest threads of the phases of the step which sorting may speed up
+static std::uint64_t sorted_phases_ns(const metrics_summary& step)
+{
+	std::int64_t elapsed = 0;
+
+	for (std::size_t p = 0; p < mech_phases_count; p++)
+		if (p != (std::size_t)mech_phase::sort && p != (std::size_t)mech_phase::output)
+			elapsed += step.phases[p].max_thread_ns;
+
+	return elapsed;
+}
+
+agents_sorter::agents_sorter(grid_space_partitioner& partitioner, index_t sort_interval)
+	: partitioner_(partitioner),
+	  sort_interval_(sort_interval),
+	  steps_since_sort_(0),
+	  sorts_count_(0),
+	  measure_after_sort_(false)
+{}
+
+bool agents_sorter::sort(mech_environment& me)
+{
+	if (sort_interval_ == 0)
+		return false;
+
+#pragma omp single
+	{
+		steps_since_sort_++;
+
+		// the last step is the first one after the sort
+		if (measure_after_sort_)
+		{
+			me.metrics.add(mech_counter::steps_after_sort_ns, sorted_phases_ns(me.metrics.last_step()));
+			measure_after_sort_ = false;
+		}
+	}
+
+	if (steps_since_sort_ < sort_interval_)
+		return false;
+
+	me.metrics.begin_phase(mech_phase::sort);
+
+	partitioner_.update_partitioning(me.agent_data.bio_agent_data.positions.data(), me.agent_data.agents_count());
+
+#pragma omp single
+	{
+		me.agent_data.permute(partitioner_.partitioned_agents());
+
+		steps_since_sort_ = 0;
+		sorts_count_++;
+
+		// the last step is the last one before the sort, if any step was measured
+		if (me.metrics.enabled() && me.metrics.last_step().steps != 0)
+		{
+			me.metrics.add(mech_counter::steps_before_sort_ns, sorted_phases_ns(me.metrics.last_step()));
+			measure_after_sort_ = true;
+		}
+	}
+
+	partitioner_.apply_partitioned_order(me.agent_data.active_sets_version);
+
+	me.metrics.end_phase(mech_phase::sort);
+
+	return true;
+}
+
+std::size_t agents_sorter::sorts_count() const { return sorts_count_; }
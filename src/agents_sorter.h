@@ -0,0 +1,37 @@
+#pragma once
+
+#include <BioFVM/types.h>
+
+#include "grid_space_partitioner.h"
+#include "mech_environment.h"
+
+namespace micromech {
+
+// Periodically permutes all agent data along the space filling curve of the partitioner voxels, so that agents close
+// in space are also close in memory. With the metrics enabled, the phases of the steps around each sort are added to
+// the steps_before_sort_ns and steps_after_sort_ns counters.
+class agents_sorter
+{
+	grid_space_partitioner& partitioner_;
+
+	biofvm::index_t sort_interval_;
+	biofvm::index_t steps_since_sort_;
+
+	std::size_t sorts_count_;
+
+	// whether the first step after the last sort is measured by the metrics
+	bool measure_after_sort_;
+
+public:
+	// sort_interval of 0 disables sorting
+	agents_sorter(grid_space_partitioner& partitioner, biofvm::index_t sort_interval);
+
+	// Must be called by all threads of the parallel region, returns true if agents were sorted
+	// Sorting invalidates neighbors, so it should precede update_neighbors, which then reuses the partitioning of the
+	// sort - positions must not change in between
+	bool sort(mech_environment& me);
+
+	std::size_t sorts_count() const;
+};
+
+} // namespace micromech
@@ -1,5 +1,8 @@
 #include "base_membrane_data.h"
 
+#include "checkpoint.h"
+#include "permutation_utils.h"
+
 using namespace biofvm;
 using namespace micromech;
 
@@ -14,3 +17,18 @@ void base_membrane_data::remove(index_t index)
 
 	cell_BM_repulsion_strength[index] = cell_BM_repulsion_strength[agents_count()];
 }
+
+void base_membrane_data::copy(index_t from, index_t to)
+{
+	cell_BM_repulsion_strength[to] = cell_BM_repulsion_strength[from];
+}
+
+void base_membrane_data::permute(const index_t* permutation, const index_t*)
+{
+	permute_vector(cell_BM_repulsion_strength, permutation, agents_count());
+}
+
+void base_membrane_data::list_checkpoint_fields(checkpoint_fields& fields)
+{
+	fields.add("cell_BM_repulsion_strength", cell_BM_repulsion_strength);
+}
@@ -1,13 +1,35 @@
 #include "base_motility_data.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 #include <BioFVM/data_utils.h>
 
+#include "checkpoint.h"
 #include "mech_environment.h"
+#include "permutation_utils.h"
 
 using namespace biofvm;
 using namespace micromech;
 
-base_motility_data::base_motility_data(mech_environment& me) : agent_data(me) {}
+base_motility_data::base_motility_data(mech_environment& me)
+	: agent_data(me), migration_bias_direction_rules(me.agent_types_count)
+{}
+
+void base_motility_data::update_motile_agents()
+{
+	motile_agents.update(is_motile.data(), agents_count(), me.agent_data.active_sets_version);
+}
+
+void base_motility_data::set_migration_bias_direction_rule(index_t agent_type, direction_rule_func rule)
+{
+	if (agent_type < 0 || agent_type >= (index_t)migration_bias_direction_rules.size())
+		throw std::invalid_argument("set_migration_bias_direction_rule agent type is out of range");
+
+	migration_bias_direction_rules[agent_type] = std::move(rule);
+
+	me.agent_data.invalidate_active_sets();
+}
 
 void base_motility_data::add()
 {
@@ -38,19 +60,77 @@ void base_motility_data::remove(index_t index)
 	persistence_time[index] = persistence_time[agents_count()];
 	migration_speed[index] = migration_speed[agents_count()];
 
-	move_vector(migration_bias_direction.data() + index * me.m.mesh.dims,
-				migration_bias_direction.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims);
+	std::copy_n(migration_bias_direction.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims,
+				migration_bias_direction.data() + index * me.m.mesh.dims);
 	migration_bias[index] = migration_bias[agents_count()];
 
-	move_vector(motility_vector.data() + index * me.m.mesh.dims,
-				motility_vector.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims);
+	std::copy_n(motility_vector.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims,
+				motility_vector.data() + index * me.m.mesh.dims);
 
 	restrict_to_2d[index] = restrict_to_2d[agents_count()];
 
 	chemotaxis_index[index] = chemotaxis_index[agents_count()];
 	chemotaxis_direction[index] = chemotaxis_direction[agents_count()];
-	move_vector(chemotactic_sensitivities.data() + index * me.m.substrates_count,
-				chemotactic_sensitivities.data() + agents_count() * me.m.substrates_count, me.m.substrates_count);
+	std::copy_n(chemotactic_sensitivities.data() + agents_count() * me.m.substrates_count, me.m.substrates_count,
+				chemotactic_sensitivities.data() + index * me.m.substrates_count);
 
 	update_migration_bias_direction[index] = update_migration_bias_direction[agents_count()];
 }
+
+void base_motility_data::copy(index_t from, index_t to)
+{
+	is_motile[to] = is_motile[from];
+	persistence_time[to] = persistence_time[from];
+	migration_speed[to] = migration_speed[from];
+
+	std::copy_n(migration_bias_direction.data() + from * me.m.mesh.dims, me.m.mesh.dims,
+				migration_bias_direction.data() + to * me.m.mesh.dims);
+	migration_bias[to] = migration_bias[from];
+
+	std::copy_n(motility_vector.data() + from * me.m.mesh.dims, me.m.mesh.dims,
+				motility_vector.data() + to * me.m.mesh.dims);
+
+	restrict_to_2d[to] = restrict_to_2d[from];
+
+	chemotaxis_index[to] = chemotaxis_index[from];
+	chemotaxis_direction[to] = chemotaxis_direction[from];
+	std::copy_n(chemotactic_sensitivities.data() + from * me.m.substrates_count, me.m.substrates_count,
+				chemotactic_sensitivities.data() + to * me.m.substrates_count);
+
+	update_migration_bias_direction[to] = update_migration_bias_direction[from];
+}
+
+void base_motility_data::permute(const index_t* permutation, const index_t*)
+{
+	permute_vector(is_motile, permutation, agents_count());
+	permute_vector(persistence_time, permutation, agents_count());
+	permute_vector(migration_speed, permutation, agents_count());
+
+	permute_vector(migration_bias_direction, permutation, agents_count(), me.m.mesh.dims);
+	permute_vector(migration_bias, permutation, agents_count());
+
+	permute_vector(motility_vector, permutation, agents_count(), me.m.mesh.dims);
+
+	permute_vector(restrict_to_2d, permutation, agents_count());
+
+	permute_vector(chemotaxis_index, permutation, agents_count());
+	permute_vector(chemotaxis_direction, permutation, agents_count());
+	permute_vector(chemotactic_sensitivities, permutation, agents_count(), me.m.substrates_count);
+
+	permute_vector(update_migration_bias_direction, permutation, agents_count());
+}
+
+// the bias direction callbacks and rules are not stored, they have to be set again after loading
+void base_motility_data::list_checkpoint_fields(checkpoint_fields& fields)
+{
+	fields.add("is_motile", is_motile);
+	fields.add("persistence_time", persistence_time);
+	fields.add("migration_speed", migration_speed);
+	fields.add("migration_bias_direction", migration_bias_direction);
+	fields.add("migration_bias", migration_bias);
+	fields.add("motility_vector", motility_vector);
+	fields.add("restrict_to_2d", restrict_to_2d);
+	fields.add("chemotaxis_index", chemotaxis_index);
+	fields.add("chemotaxis_direction", chemotaxis_direction);
+	fields.add("chemotactic_sensitivities", chemotactic_sensitivities);
+}
@@ -1,14 +1,81 @@
 #include "base_motility_model.h"
 
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+#include <span>
+
+#include <BioFVM/microenvironment.h>
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
 #include "base_motility_data.h"
+#include "checkpoint.h"
+#include "mech_trace.h"
 #include "potentials_helper.h"
 #include "random.h"
+#include "target_clones.h"
 
 using namespace biofvm;
 using namespace micromech;
 
-constexpr biofvm::real_t zero_threshold = 1e-16;
+#ifdef _OPENMP
+static std::size_t thread_number() { return omp_get_thread_num(); }
+static std::size_t max_threads_count() { return omp_get_max_threads(); }
+#else
+static std::size_t thread_number() { return 0; }
+static std::size_t max_threads_count() { return 1; }
+#endif
+
+constexpr mech_real_t zero_threshold = 1e-16;
+
+// number of agents whose random numbers are generated together, the turning agents of a batch are solved in lanes
+constexpr index_t agents_batch_size = 64;
+
+// Sine and cosine of 2 pi u for u in [0, 1) without branches or calls, so the lanes vectorize in every clone. The
+// angle is reduced exactly around the nearest quarter turn to [-pi/4, pi/4], where the polynomials of fdlibm are
+// within an ulp.
+MICROMECH_FORCE_INLINE void sincos_2pi(real_t u, real_t& sine, real_t& cosine)
+{
+	constexpr real_t sine_coefficients[] = { -1.66666666666666324348e-01, 8.33333333332248946124e-03,
+											 -1.98412698298579493134e-04, 2.75573137070700676789e-06,
+											 -2.50507602534068634195e-08, 1.58969099521155010221e-10 };
+	constexpr real_t cosine_coefficients[] = { 4.16666666666666019037e-02, -1.38888888888741095749e-03,
+											   2.48015872894767294178e-05, -2.75573143513906633035e-07,
+											   2.08757232129817482790e-09, -1.13596475577881948265e-11 };
+	constexpr index_t degree = 5;
+
+	const index_t quadrant = (index_t)(4 * u + (real_t)0.5);
+	const real_t x = (4 * u - quadrant) * (std::numbers::pi_v<real_t> / 2);
+	const real_t z = x * x;
+
+	real_t sine_polynomial = sine_coefficients[degree], cosine_polynomial = cosine_coefficients[degree];
+	for (index_t k = degree - 1; k >= 0; k--)
+	{
+		sine_polynomial = sine_coefficients[k] + z * sine_polynomial;
+		cosine_polynomial = cosine_coefficients[k] + z * cosine_polynomial;
+	}
+
+	const real_t s = x + x * z * sine_polynomial;
+
+	// 1 - z/2 is rounded once and its error added back
+	const real_t half_z = z / 2;
+	const real_t w = 1 - half_z;
+	const real_t c = w + (((1 - w) - half_z) + z * z * cosine_polynomial);
+
+	// the odd quarter turns swap the sine and the cosine, the signs follow the quadrant
+	const real_t reduced_sine = quadrant & 1 ? c : s;
+	const real_t reduced_cosine = quadrant & 1 ? s : c;
+
+	sine = quadrant & 2 ? -reduced_sine : reduced_sine;
+	cosine = (quadrant + 1) & 2 ? -reduced_cosine : reduced_cosine;
+}
 
+// The lanes are the turning agents of a batch, their walks are stored dimension-major with agents_batch_size stride.
+// random_walks draws the unit directions from the pairs of uniform numbers of the lanes, length reads a vector whose
+// components are stride apart.
 template <index_t dims>
 struct motility_helper
 {};
@@ -16,166 +83,519 @@ struct motility_helper
 template <>
 struct motility_helper<1>
 {
-	static void random_walk(bool, biofvm::real_t* __restrict__ walk)
+	static MICROMECH_FORCE_INLINE void random_walks(index_t count, const std::uint8_t* __restrict__,
+													const real_t* __restrict__ rands, mech_real_t* __restrict__ walks)
 	{
-		biofvm::real_t rand = random::instance().uniform();
-		walk[0] = rand < 0.5 ? -1 : 1;
+#pragma omp simd
+		for (index_t l = 0; l < count; l++)
+			walks[l] = rands[2 * l] < 0.5 ? -1 : 1;
 	}
 
-	static constexpr void update_motility_vector(biofvm::real_t* __restrict__ motility_vector,
-												 const biofvm::real_t* __restrict__ walk,
-												 const biofvm::real_t* __restrict__ migration_bias_direction,
-												 const biofvm::real_t migration_bias)
+	static constexpr mech_real_t length(const mech_real_t* __restrict__ vector, index_t = 1)
 	{
-		motility_vector[0] = (1 - migration_bias) * walk[0] + migration_bias * migration_bias_direction[0];
+		return std::abs(vector[0]);
 	}
+};
 
-	static constexpr void normalize_and_scale(biofvm::real_t* __restrict__ vector, biofvm::real_t scale)
+template <>
+struct motility_helper<2>
+{
+	static MICROMECH_FORCE_INLINE void random_walks(index_t count, const std::uint8_t* __restrict__,
+													const real_t* __restrict__ rands, mech_real_t* __restrict__ walks)
 	{
-		biofvm::real_t length = std::abs(vector[0]);
+#pragma omp simd
+		for (index_t l = 0; l < count; l++)
+		{
+			real_t sine, cosine;
+			sincos_2pi(rands[2 * l], sine, cosine);
 
-		vector[0] = length > zero_threshold ? vector[0] * scale / length : 0;
+			walks[l] = cosine;
+			walks[agents_batch_size + l] = sine;
+		}
+	}
+
+	static constexpr mech_real_t length(const mech_real_t* __restrict__ vector, index_t stride = 1)
+	{
+		return std::sqrt(vector[0] * vector[0] + vector[stride] * vector[stride]);
 	}
 };
 
 template <>
-struct motility_helper<2>
+struct motility_helper<3>
 {
-	static void random_walk(bool, biofvm::real_t* __restrict__ walk)
+	// planar lanes walk in the xy plane, their flags are gathered with the lanes
+	static MICROMECH_FORCE_INLINE void random_walks(index_t count, const std::uint8_t* __restrict__ planar,
+													const real_t* __restrict__ rands, mech_real_t* __restrict__ walks)
 	{
-		biofvm::real_t theta = random::instance().uniform(0, 2 * std::numbers::pi_v<biofvm::real_t>);
-		walk[0] = std::cos(theta);
-		walk[1] = std::sin(theta);
+#pragma omp simd
+		for (index_t l = 0; l < count; l++)
+		{
+			real_t sine, cosine;
+			sincos_2pi(rands[2 * l], sine, cosine);
+
+			const real_t spatial_z = rands[2 * l + 1] * 2 - 1;
+			const real_t spatial_r = std::sqrt(1 - spatial_z * spatial_z);
+
+			const real_t z = planar[l] ? 0 : spatial_z;
+			const real_t r = planar[l] ? 1 : spatial_r;
+
+			walks[l] = cosine * r;
+			walks[agents_batch_size + l] = sine * r;
+			walks[2 * agents_batch_size + l] = z;
+		}
 	}
 
-	static constexpr void update_motility_vector(biofvm::real_t* __restrict__ motility_vector,
-												 const biofvm::real_t* __restrict__ walk,
-												 const biofvm::real_t* __restrict__ migration_bias_direction,
-												 const biofvm::real_t migration_bias)
+	static constexpr mech_real_t length(const mech_real_t* __restrict__ vector, index_t stride = 1)
 	{
-		motility_vector[0] = (1 - migration_bias) * walk[0] + migration_bias * migration_bias_direction[0];
-		motility_vector[1] = (1 - migration_bias) * walk[1] + migration_bias * migration_bias_direction[1];
+		return std::sqrt(vector[0] * vector[0] + vector[stride] * vector[stride]
+						 + vector[2 * stride] * vector[2 * stride]);
 	}
+};
 
-	static constexpr void normalize_and_scale(biofvm::real_t* __restrict__ vector, biofvm::real_t scale)
+// Blends the walks of the lanes with the bias directions and scales them to the migration speed in the lane buffer
+// vectors, then scatters them to the agents
+template <index_t dims>
+MICROMECH_FORCE_INLINE void update_motility_vectors(index_t count, const index_t* __restrict__ agents,
+													const mech_real_t* __restrict__ walks,
+													const mech_real_t* __restrict__ migration_bias_direction,
+													const mech_real_t* __restrict__ migration_bias,
+													const mech_real_t* __restrict__ migration_speed,
+													mech_real_t* __restrict__ motility_vector)
+{
+	mech_real_t vectors[dims * agents_batch_size];
+
+#pragma omp simd
+	for (index_t l = 0; l < count; l++)
 	{
-		biofvm::real_t length = std::sqrt(vector[0] * vector[0] + vector[1] * vector[1]);
+		const index_t i = agents[l];
+		const mech_real_t bias = migration_bias[i];
+		const mech_real_t speed = migration_speed[i];
+
+		for (index_t d = 0; d < dims; d++)
+			vectors[d * agents_batch_size + l] =
+				(1 - bias) * walks[d * agents_batch_size + l] + bias * migration_bias_direction[i * dims + d];
+
+		const mech_real_t length = motility_helper<dims>::length(vectors + l, agents_batch_size);
+
+		for (index_t d = 0; d < dims; d++)
+			vectors[d * agents_batch_size + l] =
+				length > zero_threshold ? vectors[d * agents_batch_size + l] * speed / length : 0;
+	}
+
+#pragma omp simd
+	for (index_t l = 0; l < count; l++)
+		for (index_t d = 0; d < dims; d++)
+			motility_vector[agents[l] * dims + d] = vectors[d * agents_batch_size + l];
+}
 
-		vector[0] = length > zero_threshold ? vector[0] * scale / length : 0;
-		vector[1] = length > zero_threshold ? vector[1] * scale / length : 0;
+base_motility_model::base_motility_model(mech_environment& me) : step_(0), chemotaxis_substrates_version_(~0ULL)
+{
+	if (dynamic_cast<base_motility_data*>(me.agent_data.motility_data.get()) == nullptr)
+	{
+		me.agent_data.motility_data = std::make_unique<base_motility_data>(me);
 	}
+}
+
+// the substrate densities and the chemotaxis parameters of the agents
+struct chemotaxis_parameters
+{
+	const cartesian_mesh& mesh;
+	const real_t* __restrict__ position;
+	const real_t* __restrict__ densities;
+	index_t substrates_count;
+	const index_t* __restrict__ chemotaxis_index;
+	const index_t* __restrict__ chemotaxis_direction;
+	const mech_real_t* __restrict__ chemotactic_sensitivities;
+	const index_t* __restrict__ used_substrates;
+	index_t used_count;
 };
 
-template <>
-struct motility_helper<3>
+// The chemotaxis lanes are the turning agents without a callback or a rule. Their voxels and parameters are gathered
+// first, then the gradient of each used substrate is computed at the voxels of the lanes - by central differences
+// inside the mesh and one-sided at its boundary - and weighted for all lanes at once, by chemotaxis_direction for
+// chemotaxis_index or by the sensitivity otherwise, so no lane branches. Lanes without any weight keep their bias
+// direction.
+template <index_t dims>
+MICROMECH_FORCE_INLINE void update_chemotaxis_directions(index_t count, const index_t* __restrict__ lanes,
+														 const chemotaxis_parameters& parameters,
+														 mech_real_t* __restrict__ migration_bias_direction)
 {
-	static void random_walk(bool restrict_to_2d, biofvm::real_t* __restrict__ walk)
+	const auto& mesh = parameters.mesh;
+	const real_t* __restrict__ position = parameters.position;
+	const real_t* __restrict__ densities = parameters.densities;
+	const index_t* __restrict__ chemotaxis_index = parameters.chemotaxis_index;
+	const index_t* __restrict__ chemotaxis_direction = parameters.chemotaxis_direction;
+	const mech_real_t* __restrict__ chemotactic_sensitivities = parameters.chemotactic_sensitivities;
+	const index_t substrates_count = parameters.substrates_count;
+
+	const index_t strides[3] = { 1, mesh.grid_shape[0], mesh.grid_shape[0] * mesh.grid_shape[1] };
+
+	index_t voxels[agents_batch_size], indices[agents_batch_size], signs[agents_batch_size];
+	index_t lower[dims * agents_batch_size], upper[dims * agents_batch_size];
+	real_t distance[dims * agents_batch_size];
+	mech_real_t directions[dims * agents_batch_size];
+	std::uint8_t sensitive[agents_batch_size];
+
+	// The voxels of voxel_position, clamped so an agent which left the mesh uses the gradient of its boundary, and the
+	// offsets of their lower and upper neighbors
+#pragma omp simd
+	for (index_t l = 0; l < count; l++)
 	{
-		if (restrict_to_2d)
+		const index_t i = lanes[l];
+
+		index_t voxel = 0;
+
+		for (index_t d = 0; d < dims; d++)
 		{
-			motility_helper<2>::random_walk(true, walk);
-			walk[2] = 0;
+			const index_t k = d * agents_batch_size + l;
+
+			const index_t unclamped =
+				(index_t)((position[i * dims + d] - mesh.bounding_box_mins[d]) / mesh.voxel_shape[d]);
+			const index_t coordinate = std::min<index_t>(std::max<index_t>(unclamped, 0), mesh.grid_shape[d] - 1);
+
+			const index_t below = coordinate > 0;
+			const index_t above = coordinate + 1 < mesh.grid_shape[d];
+
+			voxel += coordinate * strides[d];
+
+			lower[k] = -below * strides[d];
+			upper[k] = above * strides[d];
+			distance[k] = (below + above) * mesh.voxel_shape[d];
+			directions[k] = 0;
 		}
-		else
+
+		voxels[l] = voxel;
+		indices[l] = chemotaxis_index[i];
+		signs[l] = chemotaxis_direction[i];
+		sensitive[l] = 0;
+	}
+
+	for (index_t u = 0; u < parameters.used_count; u++)
+	{
+		const index_t s = parameters.used_substrates[u];
+
+#pragma omp simd
+		for (index_t l = 0; l < count; l++)
 		{
-			const biofvm::real_t theta = random::instance().uniform(0, 2 * std::numbers::pi_v<biofvm::real_t>);
-			const biofvm::real_t z = random::instance().uniform(-1, 1);
-			const biofvm::real_t r = std::sqrt(1 - z * z);
+			const mech_real_t sensitivity = chemotactic_sensitivities[lanes[l] * substrates_count + s];
+			const mech_real_t sign = indices[l] == s ? (mech_real_t)signs[l] : 0;
+			const mech_real_t weight = signs[l] != 0 ? sign : sensitivity;
+
+			for (index_t d = 0; d < dims; d++)
+			{
+				const index_t k = d * agents_batch_size + l;
+
+				const real_t difference = densities[(voxels[l] + upper[k]) * substrates_count + s]
+										  - densities[(voxels[l] + lower[k]) * substrates_count + s];
+				const real_t gradient = distance[k] == 0 ? 0 : difference / distance[k];
 
-			walk[0] = std::cos(theta) * r;
-			walk[1] = std::sin(theta) * r;
-			walk[2] = z;
+				directions[k] += weight * gradient;
+			}
+			sensitive[l] |= weight != 0;
 		}
 	}
 
-	static constexpr void update_motility_vector(biofvm::real_t* __restrict__ motility_vector,
-												 const biofvm::real_t* __restrict__ walk,
-												 const biofvm::real_t* __restrict__ migration_bias_direction,
-												 const biofvm::real_t migration_bias)
+#pragma omp simd
+	for (index_t l = 0; l < count; l++)
 	{
-		motility_vector[0] = (1 - migration_bias) * walk[0] + migration_bias * migration_bias_direction[0];
-		motility_vector[1] = (1 - migration_bias) * walk[1] + migration_bias * migration_bias_direction[1];
-		motility_vector[2] = (1 - migration_bias) * walk[2] + migration_bias * migration_bias_direction[2];
+		const mech_real_t length = motility_helper<dims>::length(directions + l, agents_batch_size);
+
+		for (index_t d = 0; d < dims; d++)
+			directions[d * agents_batch_size + l] =
+				length > zero_threshold ? directions[d * agents_batch_size + l] / length : 0;
 	}
 
-	static constexpr void normalize_and_scale(biofvm::real_t* __restrict__ vector, biofvm::real_t scale)
+	// scattered back only for the sensitive lanes
+	for (index_t l = 0; l < count; l++)
+		if (sensitive[l])
+			for (index_t d = 0; d < dims; d++)
+				migration_bias_direction[lanes[l] * dims + d] = directions[d * agents_batch_size + l];
+}
+
+void base_motility_model::update_chemotaxis_substrates(mech_environment& me)
+{
+	auto& motility_data = static_cast<base_motility_data&>(*me.agent_data.motility_data.get());
+
+	// the parameters of the agents are expected to change only together with the active sets
+	if (chemotaxis_substrates_version_ == me.agent_data.active_sets_version)
+		return;
+
+	const index_t substrates_count = me.m.substrates_count;
+	const index_t motile_count = motility_data.motile_agents.size();
+	const index_t* __restrict__ motile_agents = motility_data.motile_agents.data();
+
+#pragma omp single
+	substrates_used_.assign(substrates_count, 0);
+
+	// first we mark the substrates used by the agents which would compute their direction by chemotaxis
 	{
-		biofvm::real_t length = std::sqrt(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+		std::vector<std::uint8_t> used(substrates_count, 0);
 
-		vector[0] = length > zero_threshold ? vector[0] * scale / length : 0;
-		vector[1] = length > zero_threshold ? vector[1] * scale / length : 0;
-		vector[2] = length > zero_threshold ? vector[2] * scale / length : 0;
+#pragma omp for nowait
+		for (index_t m = 0; m < motile_count; m++)
+		{
+			const index_t i = motile_agents[m];
+
+			if (motility_data.update_migration_bias_direction[i] != nullptr
+				|| motility_data.migration_bias_direction_rules[me.agent_data.agent_type_indices[i]] != nullptr)
+				continue;
+
+			if (motility_data.chemotaxis_direction[i] != 0)
+				used[motility_data.chemotaxis_index[i]] = 1;
+			else
+				for (index_t s = 0; s < substrates_count; s++)
+					used[s] |= motility_data.chemotactic_sensitivities[i * substrates_count + s] != 0;
+		}
+
+#pragma omp critical(micromech_chemotaxis_substrates)
+		for (index_t s = 0; s < substrates_count; s++)
+			substrates_used_[s] |= used[s];
 	}
-};
 
-base_motility_model::base_motility_model(mech_environment& me)
+#pragma omp barrier
+
+	// second we list them, the version is stored only after all threads compared it
+#pragma omp single
+	{
+		chemotaxis_substrates_.clear();
+
+		for (index_t s = 0; s < substrates_count; s++)
+			if (substrates_used_[s])
+				chemotaxis_substrates_.push_back(s);
+
+		chemotaxis_substrates_version_ = me.agent_data.active_sets_version;
+	}
+}
+
+// an agent turns when its uniform number is less than the timestep over its persistence time
+MICROMECH_TARGET_CLONES void update_turning_batch(index_t count, const index_t* __restrict__ agents,
+												  const real_t* __restrict__ rands, real_t timestep,
+												  const mech_real_t* __restrict__ persistence_time,
+												  std::uint8_t* __restrict__ turning)
 {
-	if (dynamic_cast<base_motility_data*>(me.agent_data.motility_data.get()) == nullptr)
+#pragma omp simd
+	for (index_t k = 0; k < count; k++)
+		turning[k] = rands[k] < timestep / persistence_time[agents[k]];
+}
+
+void base_motility_model::update_turning_agents(mech_environment& me)
+{
+	auto& data = me.agent_data;
+	auto& motility_data = static_cast<base_motility_data&>(*data.motility_data.get());
+
+	const index_t motile_count = motility_data.motile_agents.size();
+	const index_t* __restrict__ motile_agents = motility_data.motile_agents.data();
+	const index_t* __restrict__ agent_types = data.agent_type_indices.data();
+	const mech_real_t* __restrict__ persistence_time = motility_data.persistence_time.data();
+	const auto& update_migration_bias_direction_f = motility_data.update_migration_bias_direction;
+	const auto& rules = motility_data.migration_bias_direction_rules;
+
+	const bool has_rules = std::any_of(rules.begin(), rules.end(), [](const auto& rule) { return rule != nullptr; });
+
+#pragma omp single
 	{
-		me.agent_data.motility_data = std::make_unique<base_motility_data>(me);
+		turning_.resize(motile_count);
+		thread_rule_agents_.resize(max_threads_count());
+
+		for (auto& agents : thread_rule_agents_)
+			agents.clear();
+	}
+
+	auto& rule_agents = thread_rule_agents_[thread_number()];
+
+	// static schedule assigns ascending chunks to ascending threads, so the lists of the threads are concatenated in
+	// the order of the agents
+#pragma omp for schedule(static)
+	for (index_t begin = 0; begin < motile_count; begin += agents_batch_size)
+	{
+		const index_t count = std::min(agents_batch_size, motile_count - begin);
+
+		real_t persistence_rands[agents_batch_size];
+
+		random::instance().keyed_uniform_for_agents(step_, motile_agents + begin, motility_persistence_stream,
+													persistence_rands, count);
+
+		std::uint8_t* __restrict__ batch_turning = turning_.data() + begin;
+
+		update_turning_batch(count, motile_agents + begin, persistence_rands, me.timestep, persistence_time,
+							 batch_turning);
+
+		if (has_rules)
+			for (index_t k = 0; k < count; k++)
+			{
+				const index_t i = motile_agents[begin + k];
+
+				if (batch_turning[k] && update_migration_bias_direction_f[i] == nullptr
+					&& rules[agent_types[i]] != nullptr)
+					rule_agents.push_back(i);
+			}
+	}
+
+	if (!has_rules)
+		return;
+
+	// the agents of the rules are grouped by their types
+#pragma omp single
+	{
+		const index_t types_count = rules.size();
+
+		rule_agents_offsets_.assign(types_count + 1, 0);
+
+		for (const auto& agents : thread_rule_agents_)
+			for (index_t i : agents)
+				rule_agents_offsets_[agent_types[i] + 1]++;
+
+		for (index_t t = 0; t < types_count; t++)
+			rule_agents_offsets_[t + 1] += rule_agents_offsets_[t];
+
+		rule_agents_.resize(rule_agents_offsets_[types_count]);
+
+		std::vector<index_t> cursors(rule_agents_offsets_.begin(), rule_agents_offsets_.end() - 1);
+
+		for (const auto& agents : thread_rule_agents_)
+			for (index_t i : agents)
+				rule_agents_[cursors[agent_types[i]]++] = i;
+	}
+
+	const migration_bias_direction_views views { me.m.mesh.dims,
+												 data.bio_agent_data.positions.data(),
+												 data.velocity.data(),
+												 motility_data.motility_vector.data(),
+												 motility_data.migration_bias.data(),
+												 motility_data.migration_bias_direction.data() };
+
+	// each rule is called once, the rules of different types in parallel
+#pragma omp for schedule(dynamic, 1)
+	for (index_t t = 0; t < (index_t)rules.size(); t++)
+	{
+		const index_t begin = rule_agents_offsets_[t];
+		const index_t end = rule_agents_offsets_[t + 1];
+
+		if (begin < end)
+			rules[t](std::span<const index_t>(rule_agents_.data() + begin, end - begin), views);
 	}
 }
 
+// Iterates only the motile agents in batches. The turning agents of a batch are compacted into lanes, get their bias
+// direction from the per-agent callbacks, the rules of their types or chemotaxis, and their walks and motility vectors
+// are then computed together.
 template <index_t dims>
-void update_motility_internal(
-	index_t agents_count, real_t time_step, real_t* __restrict__ motility_vector, real_t* __restrict__ velocity,
-	const real_t* __restrict__ persistence_time, const real_t* __restrict__ migration_bias,
-	real_t* __restrict__ migration_bias_direction, const std::uint8_t* __restrict__ restrict_to_2d,
-	const std::uint8_t* __restrict__ is_motile, const real_t* __restrict__ migration_speed,
-	const base_motility_data::direction_update_func* __restrict__ update_migration_bias_direction_f)
+MICROMECH_TARGET_CLONES void update_motility_internal(
+	index_t motile_count, const index_t* __restrict__ motile_agents, const std::uint8_t* __restrict__ turning,
+	std::uint64_t step, mech_real_t* __restrict__ motility_vector, mech_real_t* __restrict__ velocity,
+	const mech_real_t* __restrict__ migration_bias, mech_real_t* __restrict__ migration_bias_direction,
+	const std::uint8_t* __restrict__ restrict_to_2d, const mech_real_t* __restrict__ migration_speed,
+	const base_motility_data::direction_update_func* __restrict__ update_migration_bias_direction_f,
+	const base_motility_data::direction_rule_func* __restrict__ rules, const index_t* __restrict__ agent_types,
+	const chemotaxis_parameters& chemotaxis)
 {
-#pragma omp for
-	for (index_t i = 0; i < agents_count; i++)
+	mech_trace::instance().begin(trace_loop::motility);
+
+#pragma omp for nowait
+	for (index_t begin = 0; begin < motile_count; begin += agents_batch_size)
 	{
-		if (is_motile[i] == 0)
-			continue;
+		const index_t count = std::min(agents_batch_size, motile_count - begin);
 
-		if (random::instance().uniform() < time_step / persistence_time[i])
-		{
-			real_t random_walk[dims];
+		index_t lanes[agents_batch_size];
+		std::uint8_t planar[agents_batch_size];
+		index_t lanes_count = 0;
 
-			motility_helper<dims>::random_walk(restrict_to_2d, random_walk);
+		for (index_t k = 0; k < count; k++)
+			if (turning[begin + k])
+			{
+				const index_t i = motile_agents[begin + k];
+
+				planar[lanes_count] = restrict_to_2d[i];
+				lanes[lanes_count++] = i;
+			}
+
+		if (lanes_count > 0)
+		{
+			index_t chemotaxis_lanes[agents_batch_size];
+			index_t chemotaxis_count = 0;
 
-			if (update_migration_bias_direction_f[i] != nullptr)
+			for (index_t l = 0; l < lanes_count; l++)
 			{
-				update_migration_bias_direction_f[i](migration_bias_direction + i * dims);
+				const index_t i = lanes[l];
+
+				if (update_migration_bias_direction_f[i] != nullptr)
+					update_migration_bias_direction_f[i](migration_bias_direction + i * dims);
+				else if (rules[agent_types[i]] == nullptr)
+					chemotaxis_lanes[chemotaxis_count++] = i;
 			}
 
-			motility_helper<dims>::update_motility_vector(motility_vector + i * dims, random_walk,
-														  migration_bias_direction + i * dims, migration_bias[i]);
+			if (chemotaxis.used_count > 0 && chemotaxis_count > 0)
+				update_chemotaxis_directions<dims>(chemotaxis_count, chemotaxis_lanes, chemotaxis,
+												   migration_bias_direction);
+
+			real_t walk_rands[2 * agents_batch_size];
+			mech_real_t walks[dims * agents_batch_size];
+
+			random::instance().keyed_uniform_for_agents(step, lanes, motility_walk_stream, walk_rands, lanes_count, 2);
 
-			motility_helper<dims>::normalize_and_scale(motility_vector + i * dims, migration_speed[i]);
+			motility_helper<dims>::random_walks(lanes_count, planar, walk_rands, walks);
+
+			update_motility_vectors<dims>(lanes_count, lanes, walks, migration_bias_direction, migration_bias,
+										  migration_speed, motility_vector);
 		}
 
-		potentials_helper<dims>::add(velocity + i * dims, motility_vector + i * dims);
+		for (index_t k = 0; k < count; k++)
+		{
+			const index_t i = motile_agents[begin + k];
+
+			potentials_helper<dims>::add(velocity + i * dims, motility_vector + i * dims);
+		}
 	}
+
+	mech_trace::instance().barrier(trace_loop::motility);
 }
 
+template <index_t dims>
 void base_motility_model::update_motility_velocities(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& motility_data = static_cast<base_motility_data&>(*data.motility_data.get());
 
+	motility_data.update_motile_agents();
+
+	update_chemotaxis_substrates(me);
 
+	update_turning_agents(me);
+
+	const chemotaxis_parameters chemotaxis { me.m.mesh,
+											 data.bio_agent_data.positions.data(),
+											 &me.m.substrate_densities[0],
+											 me.m.substrates_count,
+											 motility_data.chemotaxis_index.data(),
+											 motility_data.chemotaxis_direction.data(),
+											 motility_data.chemotactic_sensitivities.data(),
+											 chemotaxis_substrates_.data(),
+											 (index_t)chemotaxis_substrates_.size() };
+
+	update_motility_internal<dims>(motility_data.motile_agents.size(), motility_data.motile_agents.data(),
+								   turning_.data(), step_, motility_data.motility_vector.data(), data.velocity.data(),
+								   motility_data.migration_bias.data(), motility_data.migration_bias_direction.data(),
+								   motility_data.restrict_to_2d.data(), motility_data.migration_speed.data(),
+								   motility_data.update_migration_bias_direction.data(),
+								   motility_data.migration_bias_direction_rules.data(),
+								   data.agent_type_indices.data(), chemotaxis);
+
+#pragma omp single
+	step_++;
+}
+
+void base_motility_model::update_motility_velocities(mech_environment& me)
+{
 	if (me.m.mesh.dims == 1)
-		update_motility_internal<1>(data.agents_count(), me.timestep, motility_data.motility_vector.data(),
-									data.velocity.data(), motility_data.persistence_time.data(),
-									motility_data.migration_bias.data(), motility_data.migration_bias_direction.data(),
-									motility_data.restrict_to_2d.data(), motility_data.is_motile.data(),
-									motility_data.migration_speed.data(),
-									motility_data.update_migration_bias_direction.data());
+		update_motility_velocities<1>(me);
 	else if (me.m.mesh.dims == 2)
-		update_motility_internal<2>(data.agents_count(), me.timestep, motility_data.motility_vector.data(),
-									data.velocity.data(), motility_data.persistence_time.data(),
-									motility_data.migration_bias.data(), motility_data.migration_bias_direction.data(),
-									motility_data.restrict_to_2d.data(), motility_data.is_motile.data(),
-									motility_data.migration_speed.data(),
-									motility_data.update_migration_bias_direction.data());
+		update_motility_velocities<2>(me);
 	else if (me.m.mesh.dims == 3)
-		update_motility_internal<3>(data.agents_count(), me.timestep, motility_data.motility_vector.data(),
-									data.velocity.data(), motility_data.persistence_time.data(),
-									motility_data.migration_bias.data(), motility_data.migration_bias_direction.data(),
-									motility_data.restrict_to_2d.data(), motility_data.is_motile.data(),
-									motility_data.migration_speed.data(),
-									motility_data.update_migration_bias_direction.data());
+		update_motility_velocities<3>(me);
 }
+
+template void base_motility_model::update_motility_velocities<1>(mech_environment& me);
+template void base_motility_model::update_motility_velocities<2>(mech_environment& me);
+template void base_motility_model::update_motility_velocities<3>(mech_environment& me);
+
+void base_motility_model::list_checkpoint_fields(checkpoint_fields& fields) { fields.add("step", step_); }
@@ -1,25 +1,168 @@
 #include "base_potential_data.h"
 
+#include <algorithm>
+#include <stdexcept>
+
 #include <BioFVM/data_utils.h>
 
+#include "checkpoint.h"
 #include "mech_environment.h"
+#include "permutation_utils.h"
 
 using namespace biofvm;
 using namespace micromech;
 
-base_potential_data::base_potential_data(mech_environment& me) : agent_data(me) {}
+base_potential_data::base_potential_data(mech_environment& me)
+	: agent_data(me),
+	  type_parameters(false),
+	  type_cell_cell_adhesion_strength(me.agent_types_count),
+	  type_cell_cell_repulsion_strength(me.agent_types_count),
+	  type_cell_adhesion_affinities(me.agent_types_count * me.agent_types_count),
+	  type_attachment_elastic_constant(me.agent_types_count),
+	  reference_positions_valid(false),
+	  springs_capacity(0)
+{}
+
+void base_potential_data::reserve_springs(index_t capacity)
+{
+	if (capacity <= springs_capacity)
+		return;
+
+	std::vector<index_t> new_springs(agents_count() * capacity);
+
+	for (index_t i = 0; i < agents_count(); i++)
+	{
+		std::copy(springs.begin() + i * springs_capacity, springs.begin() + i * springs_capacity + springs_counts[i],
+				  new_springs.begin() + i * capacity);
+	}
+
+	springs.swap(new_springs);
+	springs_capacity = capacity;
+}
+
+void base_potential_data::set_type_parameters(bool enabled)
+{
+	if (enabled == type_parameters)
+		return;
+
+	const index_t types_count = me.agent_types_count;
+
+	if (!enabled)
+	{
+		cell_cell_adhesion_strength.resize(agents_count());
+		cell_cell_repulsion_strength.resize(agents_count());
+		cell_adhesion_affinities.resize(agents_count() * types_count);
+		attachment_elastic_constant.resize(agents_count());
+
+		for (index_t i = 0; i < agents_count(); i++)
+		{
+			const index_t type = me.agent_data.agent_type_indices[i];
+			const index_t slot = override_slots[i];
+
+			cell_cell_adhesion_strength[i] =
+				slot < 0 ? type_cell_cell_adhesion_strength[type] : override_cell_cell_adhesion_strength[slot];
+			cell_cell_repulsion_strength[i] =
+				slot < 0 ? type_cell_cell_repulsion_strength[type] : override_cell_cell_repulsion_strength[slot];
+			attachment_elastic_constant[i] =
+				slot < 0 ? type_attachment_elastic_constant[type] : override_attachment_elastic_constant[slot];
+
+			const mech_real_t* affinities = slot < 0 ? type_cell_adhesion_affinities.data() + type * types_count
+													 : override_cell_adhesion_affinities.data() + slot * types_count;
+			std::copy_n(affinities, types_count, cell_adhesion_affinities.data() + i * types_count);
+		}
+	}
+
+	// the values of the mode which is left are released
+	if (enabled)
+	{
+		std::vector<mech_real_t>().swap(cell_cell_adhesion_strength);
+		std::vector<mech_real_t>().swap(cell_cell_repulsion_strength);
+		std::vector<mech_real_t>().swap(cell_adhesion_affinities);
+		std::vector<mech_real_t>().swap(attachment_elastic_constant);
+	}
+	else
+	{
+		override_agents.clear();
+		override_cell_cell_adhesion_strength.clear();
+		override_cell_cell_repulsion_strength.clear();
+		override_cell_adhesion_affinities.clear();
+		override_attachment_elastic_constant.clear();
+	}
+
+	std::fill(override_slots.begin(), override_slots.end(), -1);
+
+	type_parameters = enabled;
+}
+
+index_t base_potential_data::override_parameters(index_t index)
+{
+	if (!type_parameters)
+		throw std::invalid_argument("override_parameters requires the type parameters mode");
+
+	if (override_slots[index] >= 0)
+		return override_slots[index];
+
+	const index_t types_count = me.agent_types_count;
+	const index_t type = me.agent_data.agent_type_indices[index];
+	const index_t slot = override_agents.size();
+
+	override_agents.push_back(index);
+	override_cell_cell_adhesion_strength.push_back(type_cell_cell_adhesion_strength[type]);
+	override_cell_cell_repulsion_strength.push_back(type_cell_cell_repulsion_strength[type]);
+	override_cell_adhesion_affinities.insert(override_cell_adhesion_affinities.end(),
+											 type_cell_adhesion_affinities.begin() + type * types_count,
+											 type_cell_adhesion_affinities.begin() + (type + 1) * types_count);
+	override_attachment_elastic_constant.push_back(type_attachment_elastic_constant[type]);
+
+	override_slots[index] = slot;
+
+	return slot;
+}
+
+void base_potential_data::clear_override(index_t index)
+{
+	const index_t slot = override_slots[index];
+
+	if (slot < 0)
+		return;
+
+	// the last slot moves to the freed one
+	const index_t last = override_agents.size() - 1;
+	const index_t types_count = me.agent_types_count;
+
+	override_agents[slot] = override_agents[last];
+	override_cell_cell_adhesion_strength[slot] = override_cell_cell_adhesion_strength[last];
+	override_cell_cell_repulsion_strength[slot] = override_cell_cell_repulsion_strength[last];
+	std::copy_n(override_cell_adhesion_affinities.data() + last * types_count, types_count,
+				override_cell_adhesion_affinities.data() + slot * types_count);
+	override_attachment_elastic_constant[slot] = override_attachment_elastic_constant[last];
+
+	override_slots[override_agents[slot]] = slot;
+	override_slots[index] = -1;
+
+	override_agents.pop_back();
+	override_cell_cell_adhesion_strength.pop_back();
+	override_cell_cell_repulsion_strength.pop_back();
+	override_cell_adhesion_affinities.resize(last * types_count);
+	override_attachment_elastic_constant.pop_back();
+}
 
 void base_potential_data::add()
 {
-	cell_cell_adhesion_strength.resize(agents_count());
-	cell_cell_repulsion_strength.resize(agents_count());
+	// in the type parameters mode agents use the tables of their types and the override slots
+	if (!type_parameters)
+	{
+		cell_cell_adhesion_strength.resize(agents_count());
+		cell_cell_repulsion_strength.resize(agents_count());
 
-	cell_adhesion_affinities.resize(agents_count() * me.agent_types_count);
+		cell_adhesion_affinities.resize(agents_count() * me.agent_types_count);
+
+		attachment_elastic_constant.resize(agents_count());
+	}
 
 	relative_maximum_adhesion_distance.resize(agents_count());
 
 	maximum_number_of_attachments.resize(agents_count());
-	attachment_elastic_constant.resize(agents_count());
 
 	attachment_rate.resize(agents_count());
 	detachment_rate.resize(agents_count());
@@ -28,32 +171,197 @@ void base_potential_data::add()
 
 	previous_velocity.resize(agents_count() * me.m.mesh.dims);
 
-	springs.resize(agents_count());
+	override_slots.resize(agents_count(), -1);
+
+	reference_positions.resize(agents_count() * me.m.mesh.dims);
+	reference_positions_valid = false;
+
+	springs.resize(agents_count() * springs_capacity);
+	springs_counts.resize(agents_count());
 }
 
 void base_potential_data::remove(index_t index)
 {
-	if (index == agents_count())
+	reference_positions_valid = false;
+
+	const index_t last = agents_count();
+
+	clear_override(index);
+
+	// the partners of the removed agent detach from it
+	for (index_t k = 0; k < springs_counts[index]; k++)
+	{
+		const index_t partner = springs[index * springs_capacity + k];
+		index_t* partner_springs = springs.data() + partner * springs_capacity;
+
+		springs_counts[partner] =
+			std::remove(partner_springs, partner_springs + springs_counts[partner], index) - partner_springs;
+	}
+
+	// the freed slot is reused by the next added agent, which starts without springs
+	if (index == last)
+	{
+		springs_counts[last] = 0;
 		return;
+	}
+
+	// and the partners of the last agent follow it to index
+	for (index_t k = 0; k < springs_counts[last]; k++)
+	{
+		const index_t partner = springs[last * springs_capacity + k];
+		index_t* partner_springs = springs.data() + partner * springs_capacity;
+
+		std::replace(partner_springs, partner_springs + springs_counts[partner], last, index);
+	}
+
+	if (!type_parameters)
+	{
+		cell_cell_adhesion_strength[index] = cell_cell_adhesion_strength[agents_count()];
+		cell_cell_repulsion_strength[index] = cell_cell_repulsion_strength[agents_count()];
 
-	cell_cell_adhesion_strength[index] = cell_cell_adhesion_strength[agents_count()];
-	cell_cell_repulsion_strength[index] = cell_cell_repulsion_strength[agents_count()];
+		std::copy_n(cell_adhesion_affinities.data() + agents_count() * me.agent_types_count, me.agent_types_count,
+					cell_adhesion_affinities.data() + index * me.agent_types_count);
 
-	move_vector(cell_adhesion_affinities.data() + index * me.agent_types_count,
-				cell_adhesion_affinities.data() + agents_count() * me.agent_types_count, me.agent_types_count);
+		attachment_elastic_constant[index] = attachment_elastic_constant[agents_count()];
+	}
 
 	relative_maximum_adhesion_distance[index] = relative_maximum_adhesion_distance[agents_count()];
 
 	maximum_number_of_attachments[index] = maximum_number_of_attachments[agents_count()];
-	attachment_elastic_constant[index] = attachment_elastic_constant[agents_count()];
 
 	attachment_rate[index] = attachment_rate[agents_count()];
 	detachment_rate[index] = detachment_rate[agents_count()];
 
 	simple_pressure[index] = simple_pressure[agents_count()];
 
-	move_vector(previous_velocity.data() + index * me.m.mesh.dims,
-				previous_velocity.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims);
+	std::copy_n(previous_velocity.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims,
+				previous_velocity.data() + index * me.m.mesh.dims);
+
+	// the slot of the last agent follows it to index
+	override_slots[index] = override_slots[last];
+	override_slots[last] = -1;
+	if (override_slots[index] >= 0)
+		override_agents[override_slots[index]] = index;
+
+	move_vector(reference_positions.data() + index * me.m.mesh.dims,
+				reference_positions.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims);
+
+	std::copy(springs.begin() + agents_count() * springs_capacity,
+			  springs.begin() + agents_count() * springs_capacity + springs_counts[agents_count()],
+			  springs.begin() + index * springs_capacity);
+	springs_counts[index] = springs_counts[agents_count()];
+	springs_counts[last] = 0;
+}
+
+void base_potential_data::copy(index_t from, index_t to)
+{
+	if (!type_parameters)
+	{
+		cell_cell_adhesion_strength[to] = cell_cell_adhesion_strength[from];
+		cell_cell_repulsion_strength[to] = cell_cell_repulsion_strength[from];
+
+		std::copy_n(cell_adhesion_affinities.data() + from * me.agent_types_count, me.agent_types_count,
+					cell_adhesion_affinities.data() + to * me.agent_types_count);
+
+		attachment_elastic_constant[to] = attachment_elastic_constant[from];
+	}
+	else if (override_slots[from] < 0)
+		clear_override(to);
+	else
+	{
+		// to gets its own slot with the values of from
+		const index_t slot = override_parameters(to);
+		const index_t from_slot = override_slots[from];
+
+		override_cell_cell_adhesion_strength[slot] = override_cell_cell_adhesion_strength[from_slot];
+		override_cell_cell_repulsion_strength[slot] = override_cell_cell_repulsion_strength[from_slot];
+		std::copy_n(override_cell_adhesion_affinities.data() + from_slot * me.agent_types_count,
+					me.agent_types_count, override_cell_adhesion_affinities.data() + slot * me.agent_types_count);
+		override_attachment_elastic_constant[slot] = override_attachment_elastic_constant[from_slot];
+	}
+
+	relative_maximum_adhesion_distance[to] = relative_maximum_adhesion_distance[from];
+
+	maximum_number_of_attachments[to] = maximum_number_of_attachments[from];
+
+	attachment_rate[to] = attachment_rate[from];
+	detachment_rate[to] = detachment_rate[from];
+
+	simple_pressure[to] = simple_pressure[from];
+
+	std::copy_n(previous_velocity.data() + from * me.m.mesh.dims, me.m.mesh.dims,
+				previous_velocity.data() + to * me.m.mesh.dims);
+
+
+	reference_positions_valid = false;
+
+	springs_counts[to] = 0;
+}
+
+void base_potential_data::permute(const index_t* permutation, const index_t* inverse_permutation)
+{
+	if (!type_parameters)
+	{
+		permute_vector(cell_cell_adhesion_strength, permutation, agents_count());
+		permute_vector(cell_cell_repulsion_strength, permutation, agents_count());
+
+		permute_vector(cell_adhesion_affinities, permutation, agents_count(), me.agent_types_count);
+
+		permute_vector(attachment_elastic_constant, permutation, agents_count());
+	}
+
+	permute_vector(relative_maximum_adhesion_distance, permutation, agents_count());
+
+	permute_vector(maximum_number_of_attachments, permutation, agents_count());
+
+	permute_vector(attachment_rate, permutation, agents_count());
+	permute_vector(detachment_rate, permutation, agents_count());
+
+	permute_vector(simple_pressure, permutation, agents_count());
+
+	permute_vector(previous_velocity, permutation, agents_count(), me.m.mesh.dims);
+
+	// the override tables stay, only the agents of their slots are renamed
+	permute_vector(override_slots, permutation, agents_count());
+	for (index_t& agent : override_agents)
+		agent = inverse_permutation[agent];
+
+	permute_vector(reference_positions, permutation, agents_count(), me.m.mesh.dims);
+	reference_positions_valid = false;
+
+	permute_vector(springs, permutation, agents_count(), springs_capacity);
+	permute_vector(springs_counts, permutation, agents_count());
+	remap_indices(springs, springs_capacity, springs_counts.data(), agents_count(), inverse_permutation);
+}
+
+void base_potential_data::list_checkpoint_fields(checkpoint_fields& fields)
+{
+	fields.add("cell_cell_adhesion_strength", cell_cell_adhesion_strength);
+	fields.add("cell_cell_repulsion_strength", cell_cell_repulsion_strength);
+	fields.add("cell_adhesion_affinities", cell_adhesion_affinities);
+	fields.add("relative_maximum_adhesion_distance", relative_maximum_adhesion_distance);
+	fields.add("maximum_number_of_attachments", maximum_number_of_attachments);
+	fields.add("attachment_elastic_constant", attachment_elastic_constant);
+	fields.add("attachment_rate", attachment_rate);
+	fields.add("detachment_rate", detachment_rate);
+	fields.add("simple_pressure", simple_pressure);
+	fields.add("previous_velocity", previous_velocity);
+
+	fields.add("type_parameters", type_parameters);
+	fields.add("type_cell_cell_adhesion_strength", type_cell_cell_adhesion_strength);
+	fields.add("type_cell_cell_repulsion_strength", type_cell_cell_repulsion_strength);
+	fields.add("type_cell_adhesion_affinities", type_cell_adhesion_affinities);
+	fields.add("type_attachment_elastic_constant", type_attachment_elastic_constant);
+	fields.add("override_slots", override_slots);
+	fields.add("override_agents", override_agents);
+	fields.add("override_cell_cell_adhesion_strength", override_cell_cell_adhesion_strength);
+	fields.add("override_cell_cell_repulsion_strength", override_cell_cell_repulsion_strength);
+	fields.add("override_cell_adhesion_affinities", override_cell_adhesion_affinities);
+	fields.add("override_attachment_elastic_constant", override_attachment_elastic_constant);
+
+	// the reference positions are not stored, neighbors are rebuilt after loading
 
-	springs[index] = springs[agents_count()];
+	fields.add("springs", springs);
+	fields.add("springs_counts", springs_counts);
+	fields.add("springs_capacity", springs_capacity);
 }
@@ -1,18 +1,37 @@
 #include "base_potential_model.h"
 
+#include <algorithm>
+
 #include <BioFVM/microenvironment.h>
 
 #include "base_potential_data.h"
+#include "checkpoint.h"
 #include "grid_space_partitioner.h"
 #include "mech_environment.h"
+#include "mech_trace.h"
+#include "pair_parameters.h"
 #include "potentials_helper.h"
 #include "random.h"
+#include "target_clones.h"
 
 using namespace micromech;
 using namespace biofvm;
 
-base_potential_model::base_potential_model(grid_space_partitioner& partitioner, mech_environment& me)
-	: partitioner_(partitioner)
+base_potential_model::base_potential_model(grid_space_partitioner& partitioner, mech_environment& me,
+										   real_t neighbors_skin, bool symmetric_forces)
+	: partitioner_(partitioner),
+	  static_partitioner_(partitioner.mesh().voxel_shape[0], partitioner.mesh()),
+	  static_version_(~0ULL),
+	  neighbors_skin_(neighbors_skin),
+	  max_squared_displacement_(0),
+	  neighbors_rebuilds_count_(0),
+	  symmetric_forces_(symmetric_forces),
+	  max_attachments_(0),
+	  springs_step_(0),
+	  metrics_count_(0),
+	  metrics_max_(0),
+	  neighbors_version_(~0ULL),
+	  neighbors_partitioning_(~0ULL)
 {
 	if (dynamic_cast<base_potential_data*>(me.agent_data.potential_data.get()) == nullptr)
 	{
@@ -20,295 +39,889 @@ base_potential_model::base_potential_model(grid_space_partitioner& partitioner,
 	}
 }
 
-template <index_t dims>
-void update_cell_neighbors_internal(index_t agents_count, const real_t* __restrict__ position,
-									const real_t* __restrict__ radius,
-									const real_t* __restrict__ relative_maximum_adhesion_distance,
-									const std::uint8_t* __restrict__ is_movable,
-									std::vector<index_t>* __restrict__ neighbors, grid_space_partitioner& partitioner)
+// Lists are built only for the movable agents - the partitioner holds the movable agents and the static partitioner
+// the immovable ones, which appear in the lists only as neighbors. Half lists therefore hold each pair of movable
+// agents once and each pair of a movable and an immovable agent in the list of the movable one.
+template <index_t dims, bool half>
+void update_cell_neighbors_internal(index_t agents_count, index_t movable_count,
+									const index_t* __restrict__ movable_agents, real_t skin,
+									const real_t* __restrict__ position, real_t* __restrict__ reference_position,
+									const mech_real_t* __restrict__ radius,
+									const mech_real_t* __restrict__ relative_maximum_adhesion_distance,
+									const std::uint8_t* __restrict__ is_movable, std::vector<index_t>& neighbors,
+									index_t* __restrict__ neighbors_offsets, index_t* __restrict__ neighbors_counts,
+									grid_space_partitioner& partitioner, grid_space_partitioner* static_partitioner)
 {
-#pragma omp for
-	for (index_t i = 0; i < agents_count; i++)
+	auto is_neighbor = [=](index_t i, index_t j) {
+		const real_t adhesion_distance =
+			relative_maximum_adhesion_distance[i] * radius[i] + relative_maximum_adhesion_distance[j] * radius[j];
+
+		const real_t distance = potentials_helper<dims>::distance(position + i * dims, position + j * dims);
+
+		return distance <= adhesion_distance + skin;
+	};
+
+	auto for_each_candidate = [&](index_t i, auto&& func) {
+		if constexpr (half)
+			partitioner.for_each_in_half_neighborhood<dims>(position + dims * i, i, func);
+		else
+			partitioner.for_each_in_neighborhood<dims>(position + dims * i, i, func);
+
+		if (static_partitioner != nullptr)
+			static_partitioner->for_each_in_neighborhood<dims>(position + dims * i, i, func);
+	};
+
+	// first we count the neighbors
+	mech_trace::instance().begin(trace_loop::neighbors_count);
+
+#pragma omp for nowait
+	for (index_t m = 0; m < movable_count; m++)
 	{
-		if (is_movable[i] == 0)
-			continue;
+		const index_t i = movable_agents[m];
 
-		partitioner.for_each_in_neighborhood<dims>(position + dims * i, i, [=](index_t j) {
-			const real_t adhesion_distance =
-				relative_maximum_adhesion_distance[i] * radius[i] + relative_maximum_adhesion_distance[j] * radius[j];
+		for (index_t d = 0; d < dims; d++)
+			reference_position[i * dims + d] = position[i * dims + d];
 
-			const real_t distance = potentials_helper<dims>::distance(position + i * dims, position + j * dims);
+		index_t count = 0;
 
-			if (distance <= adhesion_distance)
-			{
-				neighbors[i].push_back(j);
-			}
+		for_each_candidate(i, [&](index_t j) {
+			if (is_neighbor(i, j))
+				count++;
 		});
+
+		neighbors_counts[i] = count;
 	}
+
+	mech_trace::instance().barrier(trace_loop::neighbors_count);
+
+#pragma omp single
+	{
+		index_t offset = 0;
+		for (index_t i = 0; i < agents_count; i++)
+		{
+			if (is_movable[i] == 0)
+				neighbors_counts[i] = 0;
+
+			neighbors_offsets[i] = offset;
+			offset += neighbors_counts[i];
+		}
+
+		neighbors.resize(offset);
+	}
+
+	// second we fill them in
+	index_t* __restrict__ neighbors_data = neighbors.data();
+
+	mech_trace::instance().begin(trace_loop::neighbors_fill);
+
+#pragma omp for nowait
+	for (index_t m = 0; m < movable_count; m++)
+	{
+		const index_t i = movable_agents[m];
+
+		if (neighbors_counts[i] == 0)
+			continue;
+
+		index_t* __restrict__ agent_neighbors = neighbors_data + neighbors_offsets[i];
+
+		for_each_candidate(i, [&](index_t j) {
+			if (is_neighbor(i, j))
+				*agent_neighbors++ = j;
+		});
+	}
+
+	mech_trace::instance().barrier(trace_loop::neighbors_fill);
+}
+
+template <index_t dims>
+void update_cell_neighbors(bool half, index_t agents_count, index_t movable_count,
+						   const index_t* __restrict__ movable_agents, real_t skin, const real_t* __restrict__ position,
+						   real_t* __restrict__ reference_position, const mech_real_t* __restrict__ radius,
+						   const mech_real_t* __restrict__ relative_maximum_adhesion_distance,
+						   const std::uint8_t* __restrict__ is_movable, std::vector<index_t>& neighbors,
+						   index_t* __restrict__ neighbors_offsets, index_t* __restrict__ neighbors_counts,
+						   grid_space_partitioner& partitioner, grid_space_partitioner* static_partitioner)
+{
+	if (half)
+		update_cell_neighbors_internal<dims, true>(agents_count, movable_count, movable_agents, skin, position,
+												   reference_position, radius, relative_maximum_adhesion_distance,
+												   is_movable, neighbors, neighbors_offsets, neighbors_counts,
+												   partitioner, static_partitioner);
+	else
+		update_cell_neighbors_internal<dims, false>(agents_count, movable_count, movable_agents, skin, position,
+													reference_position, radius, relative_maximum_adhesion_distance,
+													is_movable, neighbors, neighbors_offsets, neighbors_counts,
+													partitioner, static_partitioner);
 }
 
+template <index_t dims>
 void base_potential_model::update_neighbors(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& potential_data = static_cast<base_potential_data&>(*data.potential_data.get());
 
-	// clear neighbors
-#pragma omp for
-	for (index_t i = 0; i < data.agents_count(); i++)
-		data.neighbors[i].clear();
+	const real_t half_skin = neighbors_skin_ / 2;
 
-	if (me.m.mesh.dims == 1)
-		update_cell_neighbors_internal<1>(data.agents_count(), data.bio_agent_data.positions.data(), data.radius.data(),
-										  potential_data.relative_maximum_adhesion_distance.data(),
-										  data.is_movable.data(), data.neighbors.data(), partitioner_);
-	else if (me.m.mesh.dims == 2)
-		update_cell_neighbors_internal<2>(data.agents_count(), data.bio_agent_data.positions.data(), data.radius.data(),
-										  potential_data.relative_maximum_adhesion_distance.data(),
-										  data.is_movable.data(), data.neighbors.data(), partitioner_);
-	else if (me.m.mesh.dims == 3)
-		update_cell_neighbors_internal<3>(data.agents_count(), data.bio_agent_data.positions.data(), data.radius.data(),
-										  potential_data.relative_maximum_adhesion_distance.data(),
-										  data.is_movable.data(), data.neighbors.data(), partitioner_);
+	// first, so that movable flags changed in place increment the version compared below
+	data.update_movable_agents();
+
+	// full lists are kept only for the movable agents, so they are rebuilt also when the movable agents change
+	if (neighbors_skin_ > 0 && potential_data.reference_positions_valid
+		&& max_squared_displacement_ <= half_skin * half_skin && neighbors_version_ == data.active_sets_version)
+		return;
+
+	// right after a sort the partitioner holds all current agents at their current positions, so both partitionings
+	// are selected from it instead of binning the agents again
+	const bool sorted = partitioner_.agents_version() == data.active_sets_version
+						&& partitioner_.partitionings_count() != neighbors_partitioning_
+						&& partitioner_.partitioned_agents_count() == data.agents_count();
+
+	// all threads compare the partitioner before any of them partitions again
+#pragma omp barrier
+
+	// immovable agents are partitioned again only when the agents are added, removed or reordered
+	if (static_version_ != data.active_sets_version || !potential_data.reference_positions_valid)
+	{
+#pragma omp single
+		{
+			static_agents_.clear();
+
+			for (index_t i = 0; i < data.agents_count(); i++)
+				if (data.is_movable[i] == 0)
+					static_agents_.push_back(i);
+		}
+
+		if (!static_agents_.empty() && sorted)
+			static_partitioner_.select_agents(partitioner_, data.is_movable.data(), 0);
+		else if (!static_agents_.empty())
+			static_partitioner_.update_partitioning(data.bio_agent_data.positions.data(), static_agents_.size(),
+													static_agents_.data());
+	}
+
+	if (sorted && !static_agents_.empty())
+		partitioner_.select_agents(partitioner_, data.is_movable.data(), 1);
+	else if (!sorted)
+		partitioner_.update_partitioning(data.bio_agent_data.positions.data(), data.movable_agents.size(),
+										 data.movable_agents.data(), data.active_sets_version);
+
+	update_cell_neighbors<dims>(symmetric_forces_, data.agents_count(), data.movable_agents.size(),
+								data.movable_agents.data(), neighbors_skin_, data.bio_agent_data.positions.data(),
+								potential_data.reference_positions.data(), data.radius.data(),
+								potential_data.relative_maximum_adhesion_distance.data(), data.is_movable.data(),
+								data.neighbors, data.neighbors_offsets.data(), data.neighbors_counts.data(),
+								partitioner_, static_agents_.empty() ? nullptr : &static_partitioner_);
+
+	update_reverse_pairs(data);
+
+#pragma omp single
+	{
+		potential_data.reference_positions_valid = true;
+		max_squared_displacement_ = 0;
+		neighbors_version_ = data.active_sets_version;
+		neighbors_partitioning_ = partitioner_.partitionings_count();
+		static_version_ = data.active_sets_version;
+		neighbors_rebuilds_count_++;
+
+		me.metrics.add(mech_counter::neighbors_rebuilds, 1);
+	}
+
+	if (me.metrics.enabled())
+		record_neighbors_metrics(me);
 }
 
-void clear_simple_pressure(real_t* __restrict__ simple_pressure, index_t count)
+void base_potential_model::record_neighbors_metrics(mech_environment& me)
 {
+	auto& data = me.agent_data;
+	const index_t agents_count = data.agents_count();
+	const index_t voxels_count = partitioner_.voxels_count();
+
+#pragma omp single
+	metrics_max_ = 0;
+
+	// with symmetric forces, the reverse pairs of an agent are the other part of its neighbors
+#pragma omp for reduction(max : metrics_max_)
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		index_t neighbors_count = data.neighbors_counts[i];
+		if (symmetric_forces_)
+			neighbors_count += reverse_pair_offsets_[i + 1] - reverse_pair_offsets_[i];
+
+		metrics_max_ = std::max(metrics_max_, neighbors_count);
+	}
+
+#pragma omp single
+	{
+		const real_t pairs_neighbors = symmetric_forces_ ? 2 : 1;
+
+		me.metrics.set(mech_gauge::neighbors_per_agent_mean,
+					   agents_count == 0 ? 0 : pairs_neighbors * data.neighbors.size() / agents_count);
+		me.metrics.set(mech_gauge::neighbors_per_agent_max, metrics_max_);
+
+		metrics_count_ = 0;
+		metrics_max_ = 0;
+	}
+
+	// the partitioner holds only the movable agents
+#pragma omp for reduction(+ : metrics_count_) reduction(max : metrics_max_)
+	for (index_t i = 0; i < voxels_count; i++)
+	{
+		const index_t voxel_agents = partitioner_.voxel_agents_count(i);
+
+		metrics_count_ += voxel_agents > 0;
+		metrics_max_ = std::max(metrics_max_, voxel_agents);
+	}
+
+#pragma omp single
+	{
+		me.metrics.set(mech_gauge::agents_per_voxel_mean,
+					   metrics_count_ == 0 ? 0 : (real_t)data.movable_agents.size() / metrics_count_);
+		me.metrics.set(mech_gauge::agents_per_voxel_max, metrics_max_);
+	}
+}
+
+void base_potential_model::update_reverse_pairs(mech_agent_data& data)
+{
+	const index_t agents_count = data.agents_count();
+	const index_t* __restrict__ neighbors = data.neighbors.data();
+	const index_t* __restrict__ neighbors_offsets = data.neighbors_offsets.data();
+	const index_t* __restrict__ neighbors_counts = data.neighbors_counts.data();
+	const std::uint8_t* __restrict__ is_movable = data.is_movable.data();
+
+	// full lists hold all pairs of the movable agents, only the immovable agents get their pressure from the others
+	const bool symmetric = symmetric_forces_;
+	auto is_reverse = [=](index_t j) { return symmetric || is_movable[j] == 0; };
+
+	// pairs are indexed by the position of the second agent in the neighbors of the first one
+#pragma omp single
+	{
+		reverse_pair_offsets_.assign(agents_count + 1, 0);
+		reverse_pair_cursors_.assign(agents_count, 0);
+
+		if (symmetric_forces_)
+			pair_forces_.resize(data.neighbors.size());
+		pair_pressures_.resize(data.neighbors.size());
+	}
+
+	// first we count the pairs in which each agent is the second one
+#pragma omp for
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		for (index_t p = neighbors_offsets[i]; p < neighbors_offsets[i] + neighbors_counts[i]; p++)
+		{
+			if (!is_reverse(neighbors[p]))
+				continue;
+
+#pragma omp atomic
+			reverse_pair_offsets_[neighbors[p] + 1]++;
+		}
+	}
+
+#pragma omp single
+	{
+		for (index_t i = 0; i < agents_count; i++)
+			reverse_pair_offsets_[i + 1] += reverse_pair_offsets_[i];
+
+		reverse_pairs_.resize(reverse_pair_offsets_[agents_count]);
+	}
+
+	// second we scatter the pairs to the second agents
 #pragma omp for
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		for (index_t p = neighbors_offsets[i]; p < neighbors_offsets[i] + neighbors_counts[i]; p++)
+		{
+			const index_t j = neighbors[p];
+
+			if (!is_reverse(j))
+				continue;
+
+			index_t slot;
+#pragma omp atomic capture
+			slot = reverse_pair_cursors_[j]++;
+
+			reverse_pairs_[reverse_pair_offsets_[j] + slot] = { p, i };
+		}
+	}
+
+	// finally we sort them so the order of accumulation does not depend on the thread scheduling
+#pragma omp for schedule(dynamic, 64)
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		std::sort(reverse_pairs_.begin() + reverse_pair_offsets_[i],
+				  reverse_pairs_.begin() + reverse_pair_offsets_[i + 1]);
+	}
+}
+
+void clear_simple_pressure(mech_real_t* __restrict__ simple_pressure, index_t count)
+{
+	mech_trace::instance().begin(trace_loop::pressure_clear);
+
+#pragma omp for nowait
 	for (index_t i = 0; i < count; i++)
 	{
 		simple_pressure[i] = 0;
 	}
+
+	mech_trace::instance().barrier(trace_loop::pressure_clear);
 }
 
+// number of pairs solved together, the neighbor data are gathered into lanes of this width so the solve vectorizes
+constexpr index_t pairs_batch_size = 16;
+
+// computes the forces of rhs agents acting on lhs in the direction of position_differences and the pressures of pairs
+// position_differences are stored dimension-major with pairs_batch_size stride
 template <index_t dims>
-void solve_pair(index_t lhs, index_t rhs, index_t cell_defs_count, real_t* __restrict__ velocity,
-				real_t* __restrict__ simple_pressure, const real_t* __restrict__ position,
-				const real_t* __restrict__ radius, const real_t* __restrict__ cell_cell_repulsion_strength,
-				const real_t* __restrict__ cell_cell_adhesion_strength,
-				const real_t* __restrict__ relative_maximum_adhesion_distance,
-				const real_t* __restrict__ cell_adhesion_affinity, const index_t* __restrict__ cell_definition_index)
+MICROMECH_FORCE_INLINE void solve_pairs(index_t lhs, const index_t* __restrict__ rhs, index_t count,
+										mech_real_t* __restrict__ position_differences,
+										mech_real_t* __restrict__ forces, mech_real_t* __restrict__ pressures,
+										const real_t* __restrict__ position, const mech_real_t* __restrict__ radius,
+										const mech_real_t* __restrict__ relative_maximum_adhesion_distance,
+										const pair_parameters& parameters)
 {
-	constexpr real_t simple_pressure_coefficient = 36.64504274775163; // 1 / (12 * (1 - sqrt(pi/(2*sqrt(3))))^2)
+	constexpr mech_real_t simple_pressure_coefficient = 36.64504274775163; // 1 / (12 * (1 - sqrt(pi/(2*sqrt(3))))^2)
 
-	real_t position_difference[dims];
+	mech_real_t rhs_radius[pairs_batch_size];
+	mech_real_t rhs_adhesion_distance[pairs_batch_size];
+	mech_real_t repulsion_coefficients[pairs_batch_size];
+	mech_real_t adhesion_coefficients[pairs_batch_size];
 
-	const real_t distance = std::max<real_t>(potentials_helper<dims>::difference_and_distance(
-												 position + lhs * dims, position + rhs * dims, position_difference),
-											 0.00001);
+	const index_t lhs_type = parameters.agent_types[lhs];
 
-	// compute repulsion
-	real_t repulsion;
+	// gather
+	for (index_t k = 0; k < count; k++)
 	{
-		const real_t repulsive_distance = radius[lhs] + radius[rhs];
+		const index_t j = rhs[k];
 
-		repulsion = 1 - distance / repulsive_distance;
+		for (index_t d = 0; d < dims; d++)
+			position_differences[d * pairs_batch_size + k] = position[lhs * dims + d] - position[j * dims + d];
 
-		repulsion = repulsion < 0 ? 0 : repulsion;
+		rhs_radius[k] = radius[j];
+		rhs_adhesion_distance[k] = relative_maximum_adhesion_distance[j] * radius[j];
+	}
 
-		repulsion *= repulsion;
+	if (parameters.from_types())
+	{
+		for (index_t k = 0; k < count; k++)
+		{
+			repulsion_coefficients[k] = parameters.repulsion_coefficient(lhs, rhs[k]);
+			adhesion_coefficients[k] = parameters.adhesion_coefficient(lhs, rhs[k]);
+		}
+	}
+	else
+	{
+		for (index_t k = 0; k < count; k++)
+		{
+			const index_t j = rhs[k];
 
-		// update simple pressure
-		simple_pressure[lhs] += repulsion * simple_pressure_coefficient;
-		simple_pressure[rhs] += repulsion * simple_pressure_coefficient;
+			repulsion_coefficients[k] = parameters.repulsion_strength[lhs] * parameters.repulsion_strength[j];
+			adhesion_coefficients[k] =
+				parameters.adhesion_strength[lhs] * parameters.adhesion_strength[j]
+				* parameters.adhesion_affinities[lhs * parameters.types_count + parameters.agent_types[j]]
+				* parameters.adhesion_affinities[j * parameters.types_count + lhs_type];
+		}
 
-		repulsion *= std::sqrt(cell_cell_repulsion_strength[lhs] * cell_cell_repulsion_strength[rhs]);
+		// per-agent parameters are gathered as products of the pair
+#pragma omp simd
+		for (index_t k = 0; k < count; k++)
+		{
+			repulsion_coefficients[k] = std::sqrt(repulsion_coefficients[k]);
+			adhesion_coefficients[k] = std::sqrt(adhesion_coefficients[k]);
+		}
 	}
 
-	// compute adhesion
-	real_t adhesion;
+	const mech_real_t lhs_radius = radius[lhs];
+	const mech_real_t lhs_adhesion_distance = relative_maximum_adhesion_distance[lhs] * radius[lhs];
+
+	// solve, without branches so that the lanes vectorize
+#pragma omp simd
+	for (index_t k = 0; k < count; k++)
 	{
-		const real_t adhesion_distance = relative_maximum_adhesion_distance[lhs] * radius[lhs]
-										 + relative_maximum_adhesion_distance[rhs] * radius[rhs];
+		// unrolled by hand, an inner loop is control flow for the vectorizer
+		mech_real_t distance = position_differences[k] * position_differences[k];
+		if constexpr (dims > 1)
+			distance += position_differences[pairs_batch_size + k] * position_differences[pairs_batch_size + k];
+		if constexpr (dims > 2)
+			distance +=
+				position_differences[2 * pairs_batch_size + k] * position_differences[2 * pairs_batch_size + k];
+
+		distance = std::max<mech_real_t>(std::sqrt(distance), 0.00001);
+
+		// compute repulsion
+		mech_real_t repulsion = 1 - distance / (lhs_radius + rhs_radius[k]);
+
+		repulsion = std::max<mech_real_t>(repulsion, 0);
+
+		repulsion *= repulsion;
+
+		pressures[k] = repulsion * simple_pressure_coefficient;
+
+		repulsion *= repulsion_coefficients[k];
 
-		adhesion = 1 - distance / adhesion_distance;
+		// compute adhesion
+		mech_real_t adhesion = 1 - distance / (lhs_adhesion_distance + rhs_adhesion_distance[k]);
+
+		adhesion = std::max<mech_real_t>(adhesion, 0);
 
 		adhesion *= adhesion;
 
-		const index_t lhs_cell_def_index = cell_definition_index[lhs];
-		const index_t rhs_cell_def_index = cell_definition_index[rhs];
+		adhesion *= adhesion_coefficients[k];
+
+		forces[k] = (repulsion - adhesion) / distance;
+	}
+}
+
+// only the movable agents have neighbors lists
+template <index_t dims>
+MICROMECH_TARGET_CLONES void update_cell_forces_internal(
+	index_t agents_count, index_t movable_count, const index_t* __restrict__ movable_agents,
+	mech_real_t* __restrict__ velocity, mech_real_t* __restrict__ simple_pressure,
+	const real_t* __restrict__ position, const mech_real_t* __restrict__ radius,
+	const mech_real_t* __restrict__ relative_maximum_adhesion_distance, const pair_parameters& parameters,
+	const std::uint8_t* __restrict__ is_movable,
+	const index_t* __restrict__ neighbors, const index_t* __restrict__ neighbors_offsets,
+	const index_t* __restrict__ neighbors_counts, mech_real_t* __restrict__ pair_pressures,
+	const index_t* __restrict__ reverse_pair_offsets, const std::pair<index_t, index_t>* __restrict__ reverse_pairs)
+{
+	clear_simple_pressure(simple_pressure, agents_count);
+
+	mech_trace::instance().begin(trace_loop::forces);
+
+#pragma omp for nowait
+	for (index_t m = 0; m < movable_count; m++)
+	{
+		const index_t i = movable_agents[m];
+
+		for (index_t begin = 0; begin < neighbors_counts[i]; begin += pairs_batch_size)
+		{
+			const index_t count = std::min(pairs_batch_size, neighbors_counts[i] - begin);
+			const index_t* batch = neighbors + neighbors_offsets[i] + begin;
+
+			mech_real_t position_differences[dims * pairs_batch_size];
+			mech_real_t forces[pairs_batch_size];
+			mech_real_t pressures[pairs_batch_size];
+
+			solve_pairs<dims>(i, batch, count, position_differences, forces, pressures, position, radius,
+							  relative_maximum_adhesion_distance, parameters);
+
+			for (index_t k = 0; k < count; k++)
+			{
+				for (index_t d = 0; d < dims; d++)
+					velocity[i * dims + d] += forces[k] * position_differences[d * pairs_batch_size + k];
 
-		adhesion *= std::sqrt(cell_cell_adhesion_strength[lhs] * cell_cell_adhesion_strength[rhs]
-							  * cell_adhesion_affinity[lhs * cell_defs_count + rhs_cell_def_index]
-							  * cell_adhesion_affinity[rhs * cell_defs_count + lhs_cell_def_index]);
+				simple_pressure[i] += pressures[k];
+
+				// immovable agents do not search for neighbors, so they get their pressure through the reverse pairs
+				if (is_movable[batch[k]] == 0)
+					pair_pressures[neighbors_offsets[i] + begin + k] = pressures[k];
+			}
+		}
 	}
 
-	real_t force = (repulsion - adhesion) / distance;
+	mech_trace::instance().barrier(trace_loop::forces);
 
-	potentials_helper<dims>::update_velocity(velocity + lhs * dims, position_difference, force);
+	// the reverse pairs are sorted, so the pressures are summed in the same order regardless of the threads
+	mech_trace::instance().begin(trace_loop::forces_reverse);
+
+#pragma omp for nowait
+	for (index_t j = 0; j < agents_count; j++)
+	{
+		for (index_t p = reverse_pair_offsets[j]; p < reverse_pair_offsets[j + 1]; p++)
+			simple_pressure[j] += pair_pressures[reverse_pairs[p].first];
+	}
+
+	mech_trace::instance().barrier(trace_loop::forces_reverse);
 }
 
 template <index_t dims>
-void update_cell_forces_internal(
-	index_t agents_count, index_t cell_def_count, real_t* __restrict__ velocity, real_t* __restrict__ simple_pressure,
-	const real_t* __restrict__ position, const real_t* __restrict__ radius,
-	const real_t* __restrict__ cell_cell_repulsion_strength, const real_t* __restrict__ cell_cell_adhesion_strength,
-	const real_t* __restrict__ relative_maximum_adhesion_distance, const index_t* __restrict__ cell_definition_index,
-	const real_t* __restrict__ cell_adhesion_affinities, const std::uint8_t* __restrict__ is_movable,
-	std::vector<index_t>* __restrict__ neighbors)
+MICROMECH_TARGET_CLONES void update_cell_forces_symmetric_internal(
+	index_t agents_count, mech_real_t* __restrict__ velocity, mech_real_t* __restrict__ simple_pressure,
+	const real_t* __restrict__ position, const mech_real_t* __restrict__ radius,
+	const mech_real_t* __restrict__ relative_maximum_adhesion_distance, const pair_parameters& parameters,
+	const std::uint8_t* __restrict__ is_movable,
+	const index_t* __restrict__ neighbors, const index_t* __restrict__ neighbors_offsets,
+	const index_t* __restrict__ neighbors_counts, mech_real_t* __restrict__ pair_forces,
+	mech_real_t* __restrict__ pair_pressures, const index_t* __restrict__ reverse_pair_offsets,
+	const std::pair<index_t, index_t>* __restrict__ reverse_pairs)
 {
-#pragma omp for
+	// first each pair is solved by its owner
+	mech_trace::instance().begin(trace_loop::forces);
+
+#pragma omp for nowait
 	for (index_t i = 0; i < agents_count; i++)
 	{
-		if (is_movable[i] == 0)
-			continue;
+		mech_real_t pressure_sum = 0;
 
-		for (const index_t j : neighbors[i])
+		for (index_t begin = 0; begin < neighbors_counts[i]; begin += pairs_batch_size)
 		{
-			solve_pair<dims>(i, j, cell_def_count, velocity, simple_pressure, position, radius,
-							 cell_cell_repulsion_strength, cell_cell_adhesion_strength,
-							 relative_maximum_adhesion_distance, cell_adhesion_affinities, cell_definition_index);
+			const index_t count = std::min(pairs_batch_size, neighbors_counts[i] - begin);
+
+			mech_real_t position_differences[dims * pairs_batch_size];
+			mech_real_t* forces = pair_forces + neighbors_offsets[i] + begin;
+			mech_real_t* pressures = pair_pressures + neighbors_offsets[i] + begin;
+
+			solve_pairs<dims>(i, neighbors + neighbors_offsets[i] + begin, count, position_differences, forces,
+							  pressures, position, radius, relative_maximum_adhesion_distance, parameters);
+
+			for (index_t k = 0; k < count; k++)
+			{
+				if (is_movable[i])
+					for (index_t d = 0; d < dims; d++)
+						velocity[i * dims + d] += forces[k] * position_differences[d * pairs_batch_size + k];
+
+				pressure_sum += pressures[k];
+			}
+		}
+
+		simple_pressure[i] = pressure_sum;
+	}
+
+	mech_trace::instance().barrier(trace_loop::forces);
+
+	// second the opposite force is applied to the other agent of the pair
+	mech_trace::instance().begin(trace_loop::forces_reverse);
+
+#pragma omp for nowait
+	for (index_t j = 0; j < agents_count; j++)
+	{
+		for (index_t p = reverse_pair_offsets[j]; p < reverse_pair_offsets[j + 1]; p++)
+		{
+			const auto [pair, i] = reverse_pairs[p];
+
+			simple_pressure[j] += pair_pressures[pair];
+
+			if (is_movable[j])
+			{
+				mech_real_t position_difference[dims];
+
+				potentials_helper<dims>::subtract(position_difference, position + j * dims, position + i * dims);
+
+				potentials_helper<dims>::update_velocity(velocity + j * dims, position_difference, pair_forces[pair]);
+			}
 		}
 	}
+
+	mech_trace::instance().barrier(trace_loop::forces_reverse);
 }
 
+template <index_t dims>
+void update_cell_forces(bool symmetric, index_t agents_count, index_t movable_count,
+						const index_t* __restrict__ movable_agents, mech_real_t* __restrict__ velocity,
+						mech_real_t* __restrict__ simple_pressure, const real_t* __restrict__ position,
+						const mech_real_t* __restrict__ radius,
+						const mech_real_t* __restrict__ relative_maximum_adhesion_distance,
+						const pair_parameters& parameters, const std::uint8_t* __restrict__ is_movable,
+						const index_t* __restrict__ neighbors,
+						const index_t* __restrict__ neighbors_offsets, const index_t* __restrict__ neighbors_counts,
+						mech_real_t* __restrict__ pair_forces, mech_real_t* __restrict__ pair_pressures,
+						const index_t* __restrict__ reverse_pair_offsets,
+						const std::pair<index_t, index_t>* __restrict__ reverse_pairs)
+{
+	if (symmetric)
+		update_cell_forces_symmetric_internal<dims>(
+			agents_count, velocity, simple_pressure, position, radius, relative_maximum_adhesion_distance, parameters,
+			is_movable, neighbors, neighbors_offsets, neighbors_counts, pair_forces, pair_pressures,
+			reverse_pair_offsets, reverse_pairs);
+	else
+		update_cell_forces_internal<dims>(agents_count, movable_count, movable_agents, velocity, simple_pressure,
+										  position, radius, relative_maximum_adhesion_distance, parameters,
+										  is_movable, neighbors, neighbors_offsets, neighbors_counts, pair_pressures,
+										  reverse_pair_offsets, reverse_pairs);
+}
+
+template <index_t dims>
 void base_potential_model::compute_agents_potentials(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& potential_data = static_cast<base_potential_data&>(*data.potential_data.get());
 
-	clear_simple_pressure(potential_data.simple_pressure.data(), data.agents_count());
+	const pair_parameters parameters(data, potential_data, repulsion_coefficients_, adhesion_coefficients_,
+									 spring_coefficients_);
 
-	if (me.m.mesh.dims == 1)
-		update_cell_forces_internal<1>(
-			data.agents_count(), me.agent_types_count, data.velocity.data(), potential_data.simple_pressure.data(),
-			data.bio_agent_data.positions.data(), data.radius.data(),
-			potential_data.cell_cell_repulsion_strength.data(), potential_data.cell_cell_adhesion_strength.data(),
-			potential_data.relative_maximum_adhesion_distance.data(), data.agent_type_indices.data(),
-			potential_data.cell_adhesion_affinities.data(), data.is_movable.data(), data.neighbors.data());
-	else if (me.m.mesh.dims == 2)
-		update_cell_forces_internal<2>(
-			data.agents_count(), me.agent_types_count, data.velocity.data(), potential_data.simple_pressure.data(),
-			data.bio_agent_data.positions.data(), data.radius.data(),
-			potential_data.cell_cell_repulsion_strength.data(), potential_data.cell_cell_adhesion_strength.data(),
-			potential_data.relative_maximum_adhesion_distance.data(), data.agent_type_indices.data(),
-			potential_data.cell_adhesion_affinities.data(), data.is_movable.data(), data.neighbors.data());
-	else if (me.m.mesh.dims == 3)
-		update_cell_forces_internal<3>(
-			data.agents_count(), me.agent_types_count, data.velocity.data(), potential_data.simple_pressure.data(),
-			data.bio_agent_data.positions.data(), data.radius.data(),
-			potential_data.cell_cell_repulsion_strength.data(), potential_data.cell_cell_adhesion_strength.data(),
-			potential_data.relative_maximum_adhesion_distance.data(), data.agent_type_indices.data(),
-			potential_data.cell_adhesion_affinities.data(), data.is_movable.data(), data.neighbors.data());
+	data.update_movable_agents();
+
+	update_cell_forces<dims>(symmetric_forces_, data.agents_count(), data.movable_agents.size(),
+							 data.movable_agents.data(), data.velocity.data(),
+							 potential_data.simple_pressure.data(), data.bio_agent_data.positions.data(),
+							 data.radius.data(), potential_data.relative_maximum_adhesion_distance.data(), parameters,
+							 data.is_movable.data(), data.neighbors.data(), data.neighbors_offsets.data(),
+							 data.neighbors_counts.data(), pair_forces_.data(), pair_pressures_.data(),
+							 reverse_pair_offsets_.data(), reverse_pairs_.data());
+
+#pragma omp master
+	me.metrics.add(mech_counter::pairs_evaluated, data.neighbors.size());
 }
 
-void update_spring_attachments_internal(
-	index_t agents_count, real_t time_step, index_t cell_defs_count, const real_t* __restrict__ detachment_rate,
-	const real_t* __restrict__ attachment_rate, const real_t* __restrict__ cell_adhesion_affinities,
-	const index_t* __restrict__ maximum_number_of_attachments, const index_t* __restrict__ cell_definition_index,
-	const std::vector<index_t>* __restrict__ neighbors, std::vector<index_t>* __restrict__ springs)
+// returns the number of springs detached by the calling thread
+index_t detach_springs_internal(index_t agents_count, real_t time_step, std::uint64_t step,
+								const mech_real_t* __restrict__ detachment_rate, index_t springs_capacity,
+								index_t* __restrict__ springs, index_t* __restrict__ springs_counts)
 {
-	constexpr index_t erased_spring = -1;
+	index_t detached = 0;
 
-// mark springs for detachment
-#pragma omp for
+	// both agents of a spring make the same decision from the same draws, so each one detaches only its own end
+	mech_trace::instance().begin(trace_loop::springs_detach);
+
+#pragma omp for nowait
 	for (index_t this_cell_index = 0; this_cell_index < agents_count; this_cell_index++)
 	{
-		for (index_t j = 0; j < (index_t)springs[this_cell_index].size(); j++)
+		index_t* this_springs = springs + this_cell_index * springs_capacity;
+
+		index_t kept = 0;
+		for (index_t j = 0; j < springs_counts[this_cell_index]; j++)
 		{
-			if (random::instance().uniform() <= detachment_rate[this_cell_index] * time_step)
-			{
-#pragma omp critical
-				{
-					const index_t other_cell_index = springs[this_cell_index][j];
-
-					if (other_cell_index != erased_spring)
-					{
-						springs[this_cell_index][j] = erased_spring;
-
-						*std::find(springs[other_cell_index].begin(), springs[other_cell_index].end(),
-								   this_cell_index) = erased_spring;
-					}
-				}
-			}
+			const index_t other_cell_index = this_springs[j];
+
+			const real_t this_rand =
+				random::instance().keyed_uniform(step, this_cell_index, spring_detachment_stream, other_cell_index);
+			const real_t other_rand =
+				random::instance().keyed_uniform(step, other_cell_index, spring_detachment_stream, this_cell_index);
+
+			if (this_rand > detachment_rate[this_cell_index] * time_step
+				&& other_rand > detachment_rate[other_cell_index] * time_step)
+				this_springs[kept++] = other_cell_index;
+			else if (this_cell_index < other_cell_index)
+				detached++;
 		}
+
+		springs_counts[this_cell_index] = kept;
 	}
 
-// remove marked springs
-#pragma omp for
-	for (index_t this_cell_index = 0; this_cell_index < agents_count; this_cell_index++)
-	{
-		auto it = std::remove(springs[this_cell_index].begin(), springs[this_cell_index].end(), erased_spring);
+	mech_trace::instance().barrier(trace_loop::springs_detach);
 
-		springs[this_cell_index].erase(it, springs[this_cell_index].end());
-	}
+	return detached;
+}
 
-	// attach cells to springs
+template <index_t dims>
+void propose_springs_internal(index_t agents_count, real_t time_step, std::uint64_t step,
+							  const mech_real_t* __restrict__ attachment_rate, const pair_parameters& parameters,
+							  const index_t* __restrict__ maximum_number_of_attachments,
+							  const real_t* __restrict__ position, const mech_real_t* __restrict__ radius,
+							  const mech_real_t* __restrict__ relative_maximum_adhesion_distance, bool half_neighbors,
+							  const index_t* __restrict__ neighbors, const index_t* __restrict__ neighbors_offsets,
+							  const index_t* __restrict__ neighbors_counts, index_t springs_capacity,
+							  const index_t* __restrict__ springs, const index_t* __restrict__ springs_counts,
+							  std::uint8_t* __restrict__ proposed, index_t* __restrict__ proposals_counts)
+{
+	mech_trace::instance().begin(trace_loop::springs_propose);
 
-#pragma omp for
+#pragma omp for nowait
 	for (index_t this_cell_index = 0; this_cell_index < agents_count; this_cell_index++)
 	{
-		for (std::size_t j = 0; j < neighbors[this_cell_index].size(); j++)
+		const index_t* this_springs = springs + this_cell_index * springs_capacity;
+
+		for (index_t p = neighbors_offsets[this_cell_index];
+			 p < neighbors_offsets[this_cell_index] + neighbors_counts[this_cell_index]; p++)
 		{
-			const index_t other_cell_index = neighbors[this_cell_index][j];
+			const index_t other_cell_index = neighbors[p];
 
-			if (other_cell_index < this_cell_index)
+			proposed[p] = 0;
+
+			// full lists contain each pair twice
+			if (!half_neighbors && other_cell_index < this_cell_index)
 				continue;
 
-			const real_t affinity_l =
-				cell_adhesion_affinities[this_cell_index * cell_defs_count + cell_definition_index[other_cell_index]];
+			if (springs_counts[this_cell_index] >= maximum_number_of_attachments[this_cell_index]
+				|| springs_counts[other_cell_index] >= maximum_number_of_attachments[other_cell_index])
+				continue;
+
+			if (std::find(this_springs, this_springs + springs_counts[this_cell_index], other_cell_index)
+				!= this_springs + springs_counts[this_cell_index])
+				continue;
+
+			// neighbors may contain agents within the Verlet skin
+			const real_t adhesion_distance =
+				relative_maximum_adhesion_distance[this_cell_index] * radius[this_cell_index]
+				+ relative_maximum_adhesion_distance[other_cell_index] * radius[other_cell_index];
+
+			if (potentials_helper<dims>::distance(position + this_cell_index * dims, position + other_cell_index * dims)
+				> adhesion_distance)
+				continue;
+
+			const real_t affinity_l = parameters.affinity(this_cell_index, parameters.agent_types[other_cell_index]);
 
 			const real_t attachment_prob_l = attachment_rate[this_cell_index] * time_step * affinity_l;
 
-			const real_t affinity_r =
-				cell_adhesion_affinities[other_cell_index * cell_defs_count + cell_definition_index[this_cell_index]];
+			const real_t affinity_r = parameters.affinity(other_cell_index, parameters.agent_types[this_cell_index]);
 
 			const real_t attachment_prob_r = attachment_rate[other_cell_index] * time_step * affinity_r;
 
-			if (random::instance().uniform() <= attachment_prob_l || random::instance().uniform() <= attachment_prob_r)
+			if (random::instance().keyed_uniform(step, this_cell_index, spring_attachment_stream, other_cell_index)
+					<= attachment_prob_l
+				|| random::instance().keyed_uniform(step, other_cell_index, spring_attachment_stream, this_cell_index)
+					   <= attachment_prob_r)
 			{
-#pragma omp critical
-				{
-					if ((index_t)springs[this_cell_index].size() < maximum_number_of_attachments[this_cell_index]
-						&& (index_t)springs[other_cell_index].size() < maximum_number_of_attachments[other_cell_index])
-					{
-						springs[this_cell_index].push_back(other_cell_index);
-						springs[other_cell_index].push_back(this_cell_index);
-					}
-				}
+				proposed[p] = 1;
+
+#pragma omp atomic
+				proposals_counts[this_cell_index + 1]++;
+#pragma omp atomic
+				proposals_counts[other_cell_index + 1]++;
 			}
 		}
 	}
+
+	mech_trace::instance().barrier(trace_loop::springs_propose);
 }
 
+index_t base_potential_model::resolve_spring_proposals(mech_agent_data& data, base_potential_data& potential_data)
+{
+	const index_t agents_count = data.agents_count();
+	const index_t* __restrict__ neighbors = data.neighbors.data();
+	const index_t* __restrict__ neighbors_offsets = data.neighbors_offsets.data();
+	const index_t* __restrict__ neighbors_counts = data.neighbors_counts.data();
+	const index_t* __restrict__ maximum_number_of_attachments = potential_data.maximum_number_of_attachments.data();
+	const index_t springs_capacity = potential_data.springs_capacity;
+	index_t* __restrict__ springs = potential_data.springs.data();
+	index_t* __restrict__ springs_counts = potential_data.springs_counts.data();
+
+#pragma omp single
+	{
+		for (index_t i = 0; i < agents_count; i++)
+			spring_proposals_offsets_[i + 1] += spring_proposals_offsets_[i];
+
+		spring_proposals_.resize(spring_proposals_offsets_[agents_count]);
+		spring_proposals_cursors_.assign(agents_count, 0);
+		accepted_springs_.assign(2 * data.neighbors.size(), 0);
+	}
+
+	// each proposal is listed by both of its agents, ordered by the random priority of the pair
+#pragma omp for
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		for (index_t p = neighbors_offsets[i]; p < neighbors_offsets[i] + neighbors_counts[i]; p++)
+		{
+			if (!proposed_springs_[p])
+				continue;
+
+			const index_t j = neighbors[p];
+
+			const real_t priority =
+				random::instance().keyed_uniform(springs_step_, std::min(i, j), spring_priority_stream, std::max(i, j));
+
+			index_t slot;
+#pragma omp atomic capture
+			slot = spring_proposals_cursors_[i]++;
+
+			spring_proposals_[spring_proposals_offsets_[i] + slot] = { priority, p, j };
+
+#pragma omp atomic capture
+			slot = spring_proposals_cursors_[j]++;
+
+			spring_proposals_[spring_proposals_offsets_[j] + slot] = { priority, p, i };
+		}
+	}
+
+	// each agent accepts as many of its best proposals as it has free attachments
+	mech_trace::instance().begin(trace_loop::springs_accept);
+
+#pragma omp for schedule(dynamic, 64) nowait
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		auto begin = spring_proposals_.begin() + spring_proposals_offsets_[i];
+		auto end = spring_proposals_.begin() + spring_proposals_offsets_[i + 1];
+
+		std::sort(begin, end);
+
+		index_t free_attachments = maximum_number_of_attachments[i] - springs_counts[i];
+
+		for (auto it = begin; it != end && free_attachments > 0; ++it, --free_attachments)
+		{
+			const auto [priority, p, other] = *it;
+
+			// the owner of the pair accepts into the first flag, the other agent into the second one
+			accepted_springs_[2 * p + (neighbors[p] == other ? 0 : 1)] = 1;
+		}
+	}
+
+	mech_trace::instance().barrier(trace_loop::springs_accept);
+
+	index_t attached = 0;
+
+	// a spring is attached when both agents accept it
+#pragma omp for
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		for (index_t k = spring_proposals_offsets_[i]; k < spring_proposals_offsets_[i + 1]; k++)
+		{
+			const auto [priority, p, other] = spring_proposals_[k];
+
+			if (accepted_springs_[2 * p] && accepted_springs_[2 * p + 1])
+			{
+				springs[i * springs_capacity + springs_counts[i]++] = other;
+				attached += i < other;
+			}
+		}
+	}
 
+	return attached;
+}
+
+template <index_t dims>
 void base_potential_model::attach_detach_springs(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& potential_data = static_cast<base_potential_data&>(*data.potential_data.get());
 
-	update_spring_attachments_internal(
-		data.agents_count(), me.timestep, me.agent_types_count, potential_data.detachment_rate.data(),
-		potential_data.attachment_rate.data(), potential_data.cell_adhesion_affinities.data(),
-		potential_data.maximum_number_of_attachments.data(), data.agent_type_indices.data(), data.neighbors.data(),
-		potential_data.springs.data());
+	// the inline springs arrays must fit the largest maximum_number_of_attachments
+#pragma omp single
+	max_attachments_ = 0;
+
+#pragma omp for reduction(max : max_attachments_)
+	for (index_t i = 0; i < data.agents_count(); i++)
+		max_attachments_ = std::max(max_attachments_, potential_data.maximum_number_of_attachments[i]);
+
+#pragma omp single
+	{
+		potential_data.reserve_springs(max_attachments_);
+
+		proposed_springs_.resize(data.neighbors.size());
+		spring_proposals_offsets_.assign(data.agents_count() + 1, 0);
+	}
+
+	const pair_parameters parameters(data, potential_data, repulsion_coefficients_, adhesion_coefficients_,
+									 spring_coefficients_);
+
+	const index_t detached = detach_springs_internal(
+		data.agents_count(), me.timestep, springs_step_, potential_data.detachment_rate.data(),
+		potential_data.springs_capacity, potential_data.springs.data(), potential_data.springs_counts.data());
+
+	propose_springs_internal<dims>(
+		data.agents_count(), me.timestep, springs_step_, potential_data.attachment_rate.data(), parameters,
+		potential_data.maximum_number_of_attachments.data(), data.bio_agent_data.positions.data(), data.radius.data(),
+		potential_data.relative_maximum_adhesion_distance.data(), symmetric_forces_, data.neighbors.data(),
+		data.neighbors_offsets.data(), data.neighbors_counts.data(), potential_data.springs_capacity,
+		potential_data.springs.data(), potential_data.springs_counts.data(), proposed_springs_.data(),
+		spring_proposals_offsets_.data());
+
+	const index_t attached = resolve_spring_proposals(data, potential_data);
+
+	me.metrics.add(mech_counter::springs_detached, detached);
+	me.metrics.add(mech_counter::springs_attached, attached);
+
+#pragma omp single
+	springs_step_++;
 }
 
 template <index_t dims>
-void spring_contract_function(index_t agents_count, index_t cell_defs_count, real_t* __restrict__ velocity,
-							  const index_t* __restrict__ cell_definition_index,
-							  const real_t* __restrict__ attachment_elastic_constant,
-							  const real_t* __restrict__ cell_adhesion_affinity, const real_t* __restrict__ position,
-							  const std::uint8_t* __restrict__ is_movable, std::vector<index_t>* __restrict__ springs)
+void spring_contract_function(index_t movable_count, const index_t* __restrict__ movable_agents,
+							  mech_real_t* __restrict__ velocity, const pair_parameters& parameters,
+							  const real_t* __restrict__ position, index_t springs_capacity,
+							  const index_t* __restrict__ springs, const index_t* __restrict__ springs_counts)
 {
-#pragma omp for
-	for (index_t this_cell_index = 0; this_cell_index < agents_count; this_cell_index++)
+	mech_trace::instance().begin(trace_loop::springs_contract);
+
+#pragma omp for nowait
+	for (index_t m = 0; m < movable_count; m++)
 	{
-		if (is_movable[this_cell_index] == 0)
-			continue;
+		const index_t this_cell_index = movable_agents[m];
 
-		for (std::size_t j = 0; j < springs[this_cell_index].size(); j++)
+		for (index_t j = 0; j < springs_counts[this_cell_index]; j++)
 		{
-			const index_t other_cell_index = springs[this_cell_index][j];
-
-			const index_t this_cell_def_index = cell_definition_index[this_cell_index];
-			const index_t other_cell_def_index = cell_definition_index[other_cell_index];
+			const index_t other_cell_index = springs[this_cell_index * springs_capacity + j];
 
-			const real_t adhesion =
-				sqrt(attachment_elastic_constant[this_cell_index] * attachment_elastic_constant[other_cell_index]
-					 * cell_adhesion_affinity[this_cell_index * cell_defs_count + other_cell_def_index]
-					 * cell_adhesion_affinity[other_cell_index * cell_defs_count + this_cell_def_index]);
+			const mech_real_t adhesion = parameters.spring_coefficient(this_cell_index, other_cell_index);
 
-			real_t difference[dims];
+			mech_real_t difference[dims];
 
 			potentials_helper<dims>::subtract(difference, position + other_cell_index * dims,
 											  position + this_cell_index * dims);
@@ -316,51 +929,87 @@ void spring_contract_function(index_t agents_count, index_t cell_defs_count, rea
 			potentials_helper<dims>::update_velocity(velocity + this_cell_index * dims, difference, adhesion);
 		}
 	}
+
+	mech_trace::instance().barrier(trace_loop::springs_contract);
 }
 
+template <index_t dims>
 void base_potential_model::compute_springs_potentials(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& potential_data = static_cast<base_potential_data&>(*data.potential_data.get());
 
-	if (me.m.mesh.dims == 1)
-		spring_contract_function<1>(
-			data.agents_count(), me.agent_types_count, data.velocity.data(), data.agent_type_indices.data(),
-			potential_data.attachment_elastic_constant.data(), potential_data.cell_adhesion_affinities.data(),
-			data.bio_agent_data.positions.data(), data.is_movable.data(), potential_data.springs.data());
-	else if (me.m.mesh.dims == 2)
-		spring_contract_function<2>(
-			data.agents_count(), me.agent_types_count, data.velocity.data(), data.agent_type_indices.data(),
-			potential_data.attachment_elastic_constant.data(), potential_data.cell_adhesion_affinities.data(),
-			data.bio_agent_data.positions.data(), data.is_movable.data(), potential_data.springs.data());
-	else if (me.m.mesh.dims == 3)
-		spring_contract_function<3>(
-			data.agents_count(), me.agent_types_count, data.velocity.data(), data.agent_type_indices.data(),
-			potential_data.attachment_elastic_constant.data(), potential_data.cell_adhesion_affinities.data(),
-			data.bio_agent_data.positions.data(), data.is_movable.data(), potential_data.springs.data());
+	const pair_parameters parameters(data, potential_data, repulsion_coefficients_, adhesion_coefficients_,
+									 spring_coefficients_);
+
+	data.update_movable_agents();
+
+	spring_contract_function<dims>(data.movable_agents.size(), data.movable_agents.data(), data.velocity.data(),
+								   parameters, data.bio_agent_data.positions.data(), potential_data.springs_capacity,
+								   potential_data.springs.data(), potential_data.springs_counts.data());
 }
 
+void base_potential_model::update_pair_coefficients(mech_environment& me)
+{
+	auto& potential_data = static_cast<base_potential_data&>(*me.agent_data.potential_data.get());
+
+	if (!potential_data.type_parameters)
+		return;
+
+#pragma omp single
+	{
+		const index_t types_count = me.agent_types_count;
+
+		repulsion_coefficients_.resize(types_count * types_count);
+		adhesion_coefficients_.resize(types_count * types_count);
+		spring_coefficients_.resize(types_count * types_count);
+
+		for (index_t a = 0; a < types_count; a++)
+			for (index_t b = 0; b < types_count; b++)
+			{
+				const mech_real_t affinity_ab = potential_data.type_cell_adhesion_affinities[a * types_count + b];
+				const mech_real_t affinity_ba = potential_data.type_cell_adhesion_affinities[b * types_count + a];
+
+				repulsion_coefficients_[a * types_count + b] =
+					std::sqrt(potential_data.type_cell_cell_repulsion_strength[a]
+							  * potential_data.type_cell_cell_repulsion_strength[b]);
+				adhesion_coefficients_[a * types_count + b] =
+					std::sqrt(potential_data.type_cell_cell_adhesion_strength[a]
+							  * potential_data.type_cell_cell_adhesion_strength[b] * affinity_ab * affinity_ba);
+				spring_coefficients_[a * types_count + b] =
+					std::sqrt(potential_data.type_attachment_elastic_constant[a]
+							  * potential_data.type_attachment_elastic_constant[b] * affinity_ab * affinity_ba);
+			}
+	}
+}
+
+template <index_t dims>
 void base_potential_model::update_velocities(mech_environment& me)
 {
-	compute_agents_potentials(me);
-	attach_detach_springs(me);
-	compute_springs_potentials(me);
+	update_pair_coefficients(me);
+	compute_agents_potentials<dims>(me);
+	attach_detach_springs<dims>(me);
+	compute_springs_potentials<dims>(me);
 }
 
 template <index_t dims>
-void update_positions_internal(index_t agents_count, real_t time_step, real_t* __restrict__ position,
-							   real_t* __restrict__ velocity, real_t* __restrict__ previous_velocity,
-							   const std::uint8_t* __restrict__ is_movable)
+void update_positions_internal(index_t movable_count, const index_t* __restrict__ movable_agents, real_t time_step,
+							   real_t* __restrict__ position, mech_real_t* __restrict__ velocity,
+							   mech_real_t* __restrict__ previous_velocity,
+							   const real_t* __restrict__ reference_position, real_t& max_squared_displacement)
 {
-#pragma omp for
-	for (index_t i = 0; i < agents_count; i++)
+	mech_trace::instance().begin(trace_loop::positions);
+
+#pragma omp for reduction(max : max_squared_displacement) nowait
+	for (index_t m = 0; m < movable_count; m++)
 	{
-		if (!is_movable[i])
-			continue;
+		const index_t i = movable_agents[m];
 
 		const real_t factor = time_step * 1.5;
 		const real_t previous_factor = time_step * -0.5;
 
+		real_t squared_displacement = 0;
+
 		for (index_t d = 0; d < dims; d++)
 		{
 			position[i * dims + d] +=
@@ -368,25 +1017,88 @@ void update_positions_internal(index_t agents_count, real_t time_step, real_t* _
 
 			previous_velocity[i * dims + d] = velocity[i * dims + d];
 			velocity[i * dims + d] = 0;
+
+			const real_t displacement = position[i * dims + d] - reference_position[i * dims + d];
+			squared_displacement += displacement * displacement;
 		}
+
+		max_squared_displacement = std::max(max_squared_displacement, squared_displacement);
 	}
+
+	mech_trace::instance().barrier(trace_loop::positions);
 }
 
+template <index_t dims>
 void base_potential_model::update_positions(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& potential_data = static_cast<base_potential_data&>(*data.potential_data.get());
 
+	data.update_movable_agents();
+
+	update_positions_internal<dims>(data.movable_agents.size(), data.movable_agents.data(), me.timestep,
+									data.bio_agent_data.positions.data(), data.velocity.data(),
+									potential_data.previous_velocity.data(), potential_data.reference_positions.data(),
+									max_squared_displacement_);
+}
+
+void base_potential_model::update_neighbors(mech_environment& me)
+{
+	if (me.m.mesh.dims == 1)
+		update_neighbors<1>(me);
+	else if (me.m.mesh.dims == 2)
+		update_neighbors<2>(me);
+	else if (me.m.mesh.dims == 3)
+		update_neighbors<3>(me);
+}
+
+void base_potential_model::update_velocities(mech_environment& me)
+{
+	if (me.m.mesh.dims == 1)
+		update_velocities<1>(me);
+	else if (me.m.mesh.dims == 2)
+		update_velocities<2>(me);
+	else if (me.m.mesh.dims == 3)
+		update_velocities<3>(me);
+}
+
+void base_potential_model::update_positions(mech_environment& me)
+{
 	if (me.m.mesh.dims == 1)
-		update_positions_internal<1>(data.agents_count(), me.timestep, data.bio_agent_data.positions.data(),
-									 data.velocity.data(), potential_data.previous_velocity.data(),
-									 data.is_movable.data());
+		update_positions<1>(me);
 	else if (me.m.mesh.dims == 2)
-		update_positions_internal<2>(data.agents_count(), me.timestep, data.bio_agent_data.positions.data(),
-									 data.velocity.data(), potential_data.previous_velocity.data(),
-									 data.is_movable.data());
+		update_positions<2>(me);
 	else if (me.m.mesh.dims == 3)
-		update_positions_internal<3>(data.agents_count(), me.timestep, data.bio_agent_data.positions.data(),
-									 data.velocity.data(), potential_data.previous_velocity.data(),
-									 data.is_movable.data());
+		update_positions<3>(me);
+}
+
+template void base_potential_model::update_neighbors<1>(mech_environment& me);
+template void base_potential_model::update_neighbors<2>(mech_environment& me);
+template void base_potential_model::update_neighbors<3>(mech_environment& me);
+
+template void base_potential_model::update_velocities<1>(mech_environment& me);
+template void base_potential_model::update_velocities<2>(mech_environment& me);
+template void base_potential_model::update_velocities<3>(mech_environment& me);
+
+template void base_potential_model::update_positions<1>(mech_environment& me);
+template void base_potential_model::update_positions<2>(mech_environment& me);
+template void base_potential_model::update_positions<3>(mech_environment& me);
+
+template void base_potential_model::compute_agents_potentials<1>(mech_environment& me);
+template void base_potential_model::compute_agents_potentials<2>(mech_environment& me);
+template void base_potential_model::compute_agents_potentials<3>(mech_environment& me);
+
+template void base_potential_model::attach_detach_springs<1>(mech_environment& me);
+template void base_potential_model::attach_detach_springs<2>(mech_environment& me);
+template void base_potential_model::attach_detach_springs<3>(mech_environment& me);
+
+template void base_potential_model::compute_springs_potentials<1>(mech_environment& me);
+template void base_potential_model::compute_springs_potentials<2>(mech_environment& me);
+template void base_potential_model::compute_springs_potentials<3>(mech_environment& me);
+
+std::size_t base_potential_model::neighbors_rebuilds_count() const { return neighbors_rebuilds_count_; }
+
+void base_potential_model::list_checkpoint_fields(checkpoint_fields& fields)
+{
+	fields.add("springs_step", springs_step_);
 }
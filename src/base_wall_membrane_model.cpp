@@ -1,20 +1,23 @@
 #include "base_wall_membrane_model.h"
 
+#include <algorithm>
+
 #include <base_membrane_data.h>
 
 #include "mech_environment.h"
+#include "mech_trace.h"
 
 using namespace micromech;
 using namespace biofvm;
 
-constexpr void update_membrane_velocity(real_t position, real_t bounding_box, real_t sign, real_t radius,
-										real_t repulsion_strength, real_t& velocity)
+constexpr void update_membrane_velocity(real_t position, real_t bounding_box, mech_real_t sign, mech_real_t radius,
+										mech_real_t repulsion_strength, mech_real_t& velocity)
 {
-	biofvm::real_t distance = std::abs(bounding_box - position);
+	mech_real_t distance = std::abs(bounding_box - position);
 
-	distance = std::max<biofvm::real_t>(distance, 0.00001);
+	distance = std::max<mech_real_t>(distance, 0.00001);
 
-	biofvm::real_t repulsion = 1 - distance / radius;
+	mech_real_t repulsion = 1 - distance / radius;
 	repulsion = repulsion < 0 ? 0 : repulsion;
 
 	repulsion *= repulsion * repulsion_strength * sign;
@@ -23,24 +26,24 @@ constexpr void update_membrane_velocity(real_t position, real_t bounding_box, re
 }
 
 template <index_t dims>
-constexpr void update_membrane_velocities(biofvm::real_t* __restrict__ velocity,
+constexpr void update_membrane_velocities(mech_real_t* __restrict__ velocity,
 										  const biofvm::real_t* __restrict__ position,
-										  const biofvm::cartesian_mesh& mesh, const biofvm::real_t radius,
-										  const biofvm::real_t repulsion_strength)
+										  const biofvm::cartesian_mesh& mesh, const mech_real_t radius,
+										  const mech_real_t repulsion_strength)
 {
 	if constexpr (dims == 1)
 	{
 		update_membrane_velocity(position[0], mesh.bounding_box_mins[0], 1, radius, repulsion_strength, velocity[0]);
-		update_membrane_velocity(position[0], mesh.bounding_box_maxs[1], -1, radius, repulsion_strength, velocity[0]);
+		update_membrane_velocity(position[0], mesh.bounding_box_maxs[0], -1, radius, repulsion_strength, velocity[0]);
 	}
-	if constexpr (dims == 2)
+	else if constexpr (dims == 2)
 	{
 		update_membrane_velocity(position[0], mesh.bounding_box_mins[0], 1, radius, repulsion_strength, velocity[0]);
 		update_membrane_velocity(position[0], mesh.bounding_box_maxs[0], -1, radius, repulsion_strength, velocity[0]);
 		update_membrane_velocity(position[1], mesh.bounding_box_mins[1], 1, radius, repulsion_strength, velocity[1]);
 		update_membrane_velocity(position[1], mesh.bounding_box_maxs[1], -1, radius, repulsion_strength, velocity[1]);
 	}
-	if constexpr (dims <= 3)
+	else
 	{
 		update_membrane_velocity(position[0], mesh.bounding_box_mins[0], 1, radius, repulsion_strength, velocity[0]);
 		update_membrane_velocity(position[0], mesh.bounding_box_maxs[0], -1, radius, repulsion_strength, velocity[0]);
@@ -51,44 +54,56 @@ constexpr void update_membrane_velocities(biofvm::real_t* __restrict__ velocity,
 	}
 }
 
+// iterates the listed agents, the movable ones or those in the boundary band
 template <index_t dims>
-void update_basement_membrane_interactions_internal(index_t agents_count, real_t* __restrict__ velocity,
+void update_basement_membrane_interactions_internal(index_t agents_count, const index_t* __restrict__ agents,
+													mech_real_t* __restrict__ velocity,
 													const real_t* __restrict__ position,
-													const real_t* __restrict__ radius,
-													const real_t* __restrict__ cell_BM_repulsion_strength,
-													const std::uint8_t* __restrict__ is_movable,
+													const mech_real_t* __restrict__ radius,
+													const mech_real_t* __restrict__ cell_BM_repulsion_strength,
 													const cartesian_mesh& mesh)
 {
-#pragma omp for
-	for (index_t i = 0; i < agents_count; i++)
+	mech_trace::instance().begin(trace_loop::membrane);
+
+#pragma omp for nowait
+	for (index_t k = 0; k < agents_count; k++)
 	{
-		if (is_movable[i] == 0)
-			continue;
+		const index_t i = agents[k];
 
 		update_membrane_velocities<dims>(velocity + i * dims, position + i * dims, mesh, radius[i],
 										 cell_BM_repulsion_strength[i]);
 	}
+
+	mech_trace::instance().barrier(trace_loop::membrane);
 }
 
+template <index_t dims>
 void base_wall_membrane_model::compute_basement_membrane_interactions(mech_environment& me)
 {
 	auto& data = me.agent_data;
 	auto& membrane_data = static_cast<base_membrane_data&>(*data.membrane_data.get());
 
+	const auto agents = band_.agents(data);
+
+	update_basement_membrane_interactions_internal<dims>(
+		agents.size(), agents.data(), data.velocity.data(), data.bio_agent_data.positions.data(), data.radius.data(),
+		membrane_data.cell_BM_repulsion_strength.data(), me.m.mesh);
+}
+
+void base_wall_membrane_model::compute_basement_membrane_interactions(mech_environment& me)
+{
 	if (me.m.mesh.dims == 1)
-		update_basement_membrane_interactions_internal<1>(
-			data.bio_agent_data.agents_count, data.velocity.data(), data.bio_agent_data.positions.data(),
-			data.radius.data(), membrane_data.cell_BM_repulsion_strength.data(), data.is_movable.data(), me.m.mesh);
+		compute_basement_membrane_interactions<1>(me);
 	else if (me.m.mesh.dims == 2)
-		update_basement_membrane_interactions_internal<2>(
-			data.bio_agent_data.agents_count, data.velocity.data(), data.bio_agent_data.positions.data(),
-			data.radius.data(), membrane_data.cell_BM_repulsion_strength.data(), data.is_movable.data(), me.m.mesh);
+		compute_basement_membrane_interactions<2>(me);
 	else if (me.m.mesh.dims == 3)
-		update_basement_membrane_interactions_internal<3>(
-			data.bio_agent_data.agents_count, data.velocity.data(), data.bio_agent_data.positions.data(),
-			data.radius.data(), membrane_data.cell_BM_repulsion_strength.data(), data.is_movable.data(), me.m.mesh);
+		compute_basement_membrane_interactions<3>(me);
 }
 
+template void base_wall_membrane_model::compute_basement_membrane_interactions<1>(mech_environment& me);
+template void base_wall_membrane_model::compute_basement_membrane_interactions<2>(mech_environment& me);
+template void base_wall_membrane_model::compute_basement_membrane_interactions<3>(mech_environment& me);
+
 base_wall_membrane_model::base_wall_membrane_model(mech_environment& me)
 {
 	if (dynamic_cast<base_membrane_data*>(me.agent_data.membrane_data.get()) == nullptr)
@@ -96,3 +111,26 @@ base_wall_membrane_model::base_wall_membrane_model(mech_environment& me)
 		me.agent_data.membrane_data = std::make_unique<base_membrane_data>(me);
 	}
 }
+
+base_wall_membrane_model::base_wall_membrane_model(mech_environment& me, grid_space_partitioner& partitioner)
+	: base_wall_membrane_model(me)
+{
+	const auto& mesh = partitioner.mesh();
+
+	// the agents of a voxel are at least position * voxel size from the lower wall, the last voxel may be partial
+	auto in_band = [&](index_t position, index_t d) {
+		const index_t upper_distance =
+			mesh.bounding_box_maxs[d] - mesh.bounding_box_mins[d] - (position + 1) * mesh.voxel_shape[d];
+
+		return d < mesh.dims && (position < 2 || upper_distance < 2 * mesh.voxel_shape[d]);
+	};
+
+	std::vector<index_t> slots;
+	for (index_t z = 0; z < mesh.grid_shape[2]; z++)
+		for (index_t y = 0; y < mesh.grid_shape[1]; y++)
+			for (index_t x = 0; x < mesh.grid_shape[0]; x++)
+				if (in_band(x, 0) || in_band(y, 1) || in_band(z, 2))
+					slots.push_back(partitioner.voxel_slot({ x, y, z }));
+
+	band_ = boundary_band(partitioner, std::move(slots));
+}
@@ -0,0 +1,50 @@
+#include "boundary_band.h"
+
+#include <algorithm>
+
+using namespace micromech;
+using namespace biofvm;
+
+boundary_band::boundary_band() : partitioner_(nullptr), partitioning_(~0ULL) {}
+
+boundary_band::boundary_band(grid_space_partitioner& partitioner, std::vector<index_t> slots)
+	: partitioner_(&partitioner), slots_(std::move(slots)), partitioning_(~0ULL)
+{
+	// slots in the order of the partitioning, so the band lists the agents along its space filling curve
+	std::sort(slots_.begin(), slots_.end());
+}
+
+std::span<const index_t> boundary_band::agents(mech_agent_data& data)
+{
+	data.update_movable_agents();
+
+	if (partitioner_ == nullptr || partitioner_->agents_version() != data.active_sets_version)
+		return { data.movable_agents.data(), (std::size_t)data.movable_agents.size() };
+
+	if (partitioning_ != partitioner_->partitionings_count())
+		update_agents(data);
+
+	return agents_;
+}
+
+void boundary_band::update_agents(const mech_agent_data& data)
+{
+	// the partitioning may hold also immovable agents if it was made for sorting
+#pragma omp single
+	{
+		agents_.clear();
+
+		for (index_t slot : slots_)
+		{
+			const index_t* voxel_agents = partitioner_->voxel_agents(slot);
+
+			for (index_t k = 0; k < partitioner_->voxel_agents_count(slot); k++)
+				if (data.is_movable[voxel_agents[k]])
+					agents_.push_back(voxel_agents[k]);
+		}
+	}
+
+	// stored only after all threads compared it
+#pragma omp single
+	partitioning_ = partitioner_->partitionings_count();
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+#include "grid_space_partitioner.h"
+#include "mech_agent_data.h"
+
+namespace micromech {
+
+// Boundary band of a membrane model - the voxel slots of a partitioner whose agents may be closer to a membrane than
+// their radius. Only the movable agents in the band are evaluated, which assumes agents smaller than a voxel which
+// move less than a voxel between partitionings. The agents of the band are collected again after each partitioning,
+// and all movable agents are evaluated while the partitioning does not refer to the current agents.
+class boundary_band
+{
+	grid_space_partitioner* partitioner_;
+	std::vector<biofvm::index_t> slots_;
+	std::vector<biofvm::index_t> agents_;
+	std::uint64_t partitioning_;
+
+	void update_agents(const mech_agent_data& data);
+
+public:
+	// without a partitioner all movable agents are evaluated
+	boundary_band();
+	boundary_band(grid_space_partitioner& partitioner, std::vector<biofvm::index_t> slots);
+
+	// Must be called by all threads of the parallel region, returns the movable agents in the band or all movable
+	// agents if it can not be used
+	std::span<const biofvm::index_t> agents(mech_agent_data& data);
+};
+
+} // namespace micromech
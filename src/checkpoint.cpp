@@ -0,0 +1,444 @@
+#include "checkpoint.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <stdexcept>
+
+#ifdef _WIN32
+	#include <fstream>
+#else
+	#include <fcntl.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+	#include <unistd.h>
+#endif
+
+#include "base_potential_data.h"
+#include "mech_environment.h"
+#include "membrane_model.h"
+#include "motility_model.h"
+#include "potential_model.h"
+#include "random.h"
+
+using namespace biofvm;
+using namespace micromech;
+
+constexpr char checkpoint_magic[8] = { 'M', 'M', 'C', 'H', 'K', 'P', 'T', 0 };
+constexpr std::uint32_t checkpoint_version = 1;
+
+// chunks start at page boundaries, so each of them can be mapped and compressed on its own
+constexpr std::uint64_t chunk_alignment = 4096;
+
+// file formats local to this translation unit
+namespace {
+
+enum chunk_compression : std::uint32_t
+{
+	no_compression = 0
+};
+
+struct file_header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t dims;
+	std::uint64_t agents_count;
+	std::uint32_t agent_types_count;
+	std::uint32_t substrates_count;
+	std::uint32_t fields_count;
+	std::uint32_t reserved;
+	std::uint64_t chunks_count;
+	std::uint64_t chunk_bytes;
+};
+
+struct field_entry
+{
+	char name[64];
+	std::uint64_t element_size;
+	std::uint64_t count;
+	std::uint64_t first_chunk;
+	std::uint64_t chunks_count;
+};
+
+struct chunk_entry
+{
+	std::uint64_t offset;
+	std::uint64_t stored_bytes;
+	std::uint64_t raw_bytes;
+	std::uint32_t compression;
+	std::uint32_t reserved;
+};
+
+} // namespace
+
+static std::uint64_t align_up(std::uint64_t value, std::uint64_t alignment)
+{
+	return (value + alignment - 1) / alignment * alignment;
+}
+
+static checkpoint_fields list_fields(mech_environment& me, potential_model* potential, membrane_model* membrane,
+									 motility_model* motility)
+{
+	checkpoint_fields fields;
+
+	auto& data = me.agent_data;
+	auto& bio_data = data.bio_agent_data;
+
+	fields.begin_group("agents");
+	fields.add("secretion_rates", bio_data.secretion_rates);
+	fields.add("saturation_densities", bio_data.saturation_densities);
+	fields.add("uptake_rates", bio_data.uptake_rates);
+	fields.add("net_export_rates", bio_data.net_export_rates);
+	fields.add("internalized_substrates", bio_data.internalized_substrates);
+	fields.add("fraction_released_at_death", bio_data.fraction_released_at_death);
+	fields.add("fraction_transferred_when_ingested", bio_data.fraction_transferred_when_ingested);
+	fields.add("volumes", bio_data.volumes);
+	fields.add("positions", bio_data.positions);
+	fields.add("velocity", data.velocity);
+	fields.add("radius", data.radius);
+	fields.add("is_movable", data.is_movable);
+	fields.add("agent_type_indices", data.agent_type_indices);
+
+	fields.begin_group("potential_data");
+	data.potential_data->list_checkpoint_fields(fields);
+	fields.begin_group("membrane_data");
+	data.membrane_data->list_checkpoint_fields(fields);
+	fields.begin_group("motility_data");
+	data.motility_data->list_checkpoint_fields(fields);
+
+	if (potential != nullptr)
+	{
+		fields.begin_group("potential_model");
+		potential->list_checkpoint_fields(fields);
+	}
+	if (membrane != nullptr)
+	{
+		fields.begin_group("membrane_model");
+		membrane->list_checkpoint_fields(fields);
+	}
+	if (motility != nullptr)
+	{
+		fields.begin_group("motility_model");
+		motility->list_checkpoint_fields(fields);
+	}
+
+	return fields;
+}
+
+void micromech::save_checkpoint(const std::string& path, mech_environment& me, potential_model* potential,
+								membrane_model* membrane, motility_model* motility, std::size_t chunk_bytes)
+{
+	if (chunk_bytes == 0)
+		throw std::invalid_argument("save_checkpoint requires a positive chunk_bytes");
+
+	potential = potential != nullptr ? potential : me.potential_m.get();
+	membrane = membrane != nullptr ? membrane : me.membrane_m.get();
+	motility = motility != nullptr ? motility : me.motility_m.get();
+
+	std::uint64_t seed = random::instance().seed();
+
+	auto fields = list_fields(me, potential, membrane, motility);
+	fields.begin_group("random");
+	fields.add("seed", seed);
+
+	const auto& list = fields.fields();
+
+	// the layout is computed first, so that the chunks can be written independently
+	std::vector<field_entry> field_entries(list.size());
+	std::vector<chunk_entry> chunk_entries;
+	std::vector<const char*> chunk_sources;
+
+	for (std::size_t f = 0; f < list.size(); f++)
+	{
+		if (list[f].name.size() >= sizeof(field_entry::name))
+			throw std::runtime_error("checkpoint field name is too long: " + list[f].name);
+
+		const std::uint64_t bytes = list[f].count * list[f].element_size;
+
+		auto& entry = field_entries[f];
+		std::memset(entry.name, 0, sizeof(entry.name));
+		std::memcpy(entry.name, list[f].name.data(), list[f].name.size());
+		entry.element_size = list[f].element_size;
+		entry.count = list[f].count;
+		entry.first_chunk = chunk_entries.size();
+		entry.chunks_count = (bytes + chunk_bytes - 1) / chunk_bytes;
+
+		for (std::uint64_t begin = 0; begin < bytes; begin += chunk_bytes)
+		{
+			const std::uint64_t raw_bytes = std::min<std::uint64_t>(chunk_bytes, bytes - begin);
+
+			chunk_entries.push_back({ 0, raw_bytes, raw_bytes, no_compression, 0 });
+			chunk_sources.push_back((const char*)list[f].data + begin);
+		}
+	}
+
+	file_header header {};
+	std::memcpy(header.magic, checkpoint_magic, sizeof(checkpoint_magic));
+	header.version = checkpoint_version;
+	header.dims = me.m.mesh.dims;
+	header.agents_count = me.agent_data.agents_count();
+	header.agent_types_count = me.agent_types_count;
+	header.substrates_count = me.m.substrates_count;
+	header.fields_count = field_entries.size();
+	header.chunks_count = chunk_entries.size();
+	header.chunk_bytes = chunk_bytes;
+
+	std::uint64_t offset = align_up(sizeof(file_header) + field_entries.size() * sizeof(field_entry)
+										+ chunk_entries.size() * sizeof(chunk_entry),
+									chunk_alignment);
+
+	for (auto& chunk : chunk_entries)
+	{
+		chunk.offset = offset;
+		offset = align_up(offset + chunk.stored_bytes, chunk_alignment);
+	}
+
+	const std::uint64_t file_size = offset;
+	const std::int64_t chunks_count = chunk_entries.size();
+
+	std::vector<char> tables(sizeof(file_header) + field_entries.size() * sizeof(field_entry)
+							 + chunk_entries.size() * sizeof(chunk_entry));
+	std::memcpy(tables.data(), &header, sizeof(file_header));
+	std::memcpy(tables.data() + sizeof(file_header), field_entries.data(), field_entries.size() * sizeof(field_entry));
+	std::memcpy(tables.data() + sizeof(file_header) + field_entries.size() * sizeof(field_entry), chunk_entries.data(),
+				chunk_entries.size() * sizeof(chunk_entry));
+
+#ifdef _WIN32
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("checkpoint can not be written to " + path);
+
+	file.write(tables.data(), tables.size());
+
+	for (std::int64_t c = 0; c < chunks_count; c++)
+	{
+		file.seekp(chunk_entries[c].offset);
+		file.write(chunk_sources[c], chunk_entries[c].stored_bytes);
+	}
+
+	file.seekp(file_size - 1);
+	file.put(0);
+
+	if (!file)
+		throw std::runtime_error("checkpoint can not be written to " + path);
+#else
+	const int fd = ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (fd < 0)
+		throw std::runtime_error("checkpoint can not be written to " + path);
+
+	auto write_at = [fd](const char* data, std::uint64_t bytes, std::uint64_t offset) {
+		while (bytes > 0)
+		{
+			const ssize_t written = ::pwrite(fd, data, bytes, offset);
+			if (written <= 0)
+				return false;
+
+			data += written;
+			bytes -= written;
+			offset += written;
+		}
+		return true;
+	};
+
+	bool ok = ::ftruncate(fd, file_size) == 0 && write_at(tables.data(), tables.size(), 0);
+
+#pragma omp parallel for schedule(dynamic) reduction(&& : ok)
+	for (std::int64_t c = 0; c < chunks_count; c++)
+		ok = write_at(chunk_sources[c], chunk_entries[c].stored_bytes, chunk_entries[c].offset) && ok;
+
+	ok = ::close(fd) == 0 && ok;
+
+	if (!ok)
+		throw std::runtime_error("checkpoint can not be written to " + path);
+#endif
+}
+
+// read-only view of the whole file
+class mapped_file
+{
+	const char* data_ = nullptr;
+	std::size_t size_ = 0;
+
+#ifdef _WIN32
+	std::vector<char> buffer_;
+#endif
+
+public:
+	mapped_file(const std::string& path)
+	{
+#ifdef _WIN32
+		std::ifstream file(path, std::ios::binary | std::ios::ate);
+		if (!file)
+			throw std::runtime_error("checkpoint can not be read from " + path);
+
+		buffer_.resize(file.tellg());
+		file.seekg(0);
+		file.read(buffer_.data(), buffer_.size());
+
+		data_ = buffer_.data();
+		size_ = buffer_.size();
+#else
+		const int fd = ::open(path.c_str(), O_RDONLY);
+		if (fd < 0)
+			throw std::runtime_error("checkpoint can not be read from " + path);
+
+		struct stat st;
+		if (::fstat(fd, &st) != 0 || st.st_size == 0)
+		{
+			::close(fd);
+			throw std::runtime_error("checkpoint can not be read from " + path);
+		}
+
+		void* mapping = ::mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		::close(fd);
+
+		if (mapping == MAP_FAILED)
+			throw std::runtime_error("checkpoint can not be mapped from " + path);
+
+		data_ = (const char*)mapping;
+		size_ = st.st_size;
+#endif
+	}
+
+	mapped_file(const mapped_file&) = delete;
+	mapped_file& operator=(const mapped_file&) = delete;
+
+	~mapped_file()
+	{
+#ifndef _WIN32
+		::munmap((void*)data_, size_);
+#endif
+	}
+
+	const char* data() const { return data_; }
+	std::size_t size() const { return size_; }
+};
+
+void micromech::load_checkpoint(const std::string& path, mech_environment& me, potential_model* potential,
+								membrane_model* membrane, motility_model* motility)
+{
+	potential = potential != nullptr ? potential : me.potential_m.get();
+	membrane = membrane != nullptr ? membrane : me.membrane_m.get();
+	motility = motility != nullptr ? motility : me.motility_m.get();
+
+	mapped_file file(path);
+
+	auto invalid = [&path](const std::string& reason) {
+		return std::runtime_error("checkpoint " + path + " can not be loaded: " + reason);
+	};
+
+	if (file.size() < sizeof(file_header))
+		throw invalid("truncated header");
+
+	file_header header;
+	std::memcpy(&header, file.data(), sizeof(file_header));
+
+	if (std::memcmp(header.magic, checkpoint_magic, sizeof(checkpoint_magic)) != 0)
+		throw invalid("not a checkpoint");
+	if (header.version != checkpoint_version)
+		throw invalid("unsupported version " + std::to_string(header.version));
+	if (header.dims != (std::uint32_t)me.m.mesh.dims || header.agent_types_count != (std::uint32_t)me.agent_types_count
+		|| header.substrates_count != (std::uint32_t)me.m.substrates_count)
+		throw invalid("dims, agent types or substrates differ");
+	if (header.chunk_bytes == 0)
+		throw invalid("zero chunk size");
+
+	// the counts are checked against the file before their tables are sized by them
+	if (header.fields_count > file.size() / sizeof(field_entry)
+		|| header.chunks_count > file.size() / sizeof(chunk_entry))
+		throw invalid("truncated tables");
+
+	const std::size_t tables_size =
+		sizeof(file_header) + header.fields_count * sizeof(field_entry) + header.chunks_count * sizeof(chunk_entry);
+	if (file.size() < tables_size)
+		throw invalid("truncated tables");
+
+	std::vector<field_entry> field_entries(header.fields_count);
+	std::vector<chunk_entry> chunk_entries(header.chunks_count);
+	std::memcpy(field_entries.data(), file.data() + sizeof(file_header), field_entries.size() * sizeof(field_entry));
+	std::memcpy(chunk_entries.data(), file.data() + sizeof(file_header) + field_entries.size() * sizeof(field_entry),
+				chunk_entries.size() * sizeof(chunk_entry));
+
+	// the per-agent arrays get the agents count of the snapshot before they are overwritten
+	auto& data = me.agent_data;
+	if (data.agents_count() < (index_t)header.agents_count)
+		data.add(header.agents_count - data.agents_count());
+
+	std::vector<index_t> excess_agents;
+	for (index_t i = header.agents_count; i < data.agents_count(); i++)
+		excess_agents.push_back(i);
+	data.remove(excess_agents);
+
+	std::uint64_t seed = 0;
+
+	auto fields = list_fields(me, potential, membrane, motility);
+	fields.begin_group("random");
+	fields.add("seed", seed);
+
+	std::map<std::string, const field_entry*> entries;
+	for (const auto& entry : field_entries)
+		entries[std::string(entry.name, strnlen(entry.name, sizeof(entry.name)))] = &entry;
+
+	std::vector<char*> chunk_destinations(chunk_entries.size(), nullptr);
+
+	for (const auto& f : fields.fields())
+	{
+		auto it = entries.find(f.name);
+		if (it == entries.end())
+			throw invalid("missing field " + f.name);
+
+		const field_entry& entry = *it->second;
+
+		if (entry.element_size != f.element_size)
+			throw invalid("field " + f.name + " has a different precision");
+		if (f.scalar && entry.count != 1)
+			throw invalid("field " + f.name + " is not a single value");
+
+		// the chunks must fill exactly the resized field, each of them but the last one has chunk_bytes
+		if (entry.count > file.size() / entry.element_size)
+			throw invalid("field " + f.name + " is larger than the file");
+
+		const std::uint64_t bytes = entry.count * entry.element_size;
+
+		if (entry.first_chunk > chunk_entries.size() || entry.chunks_count > chunk_entries.size() - entry.first_chunk
+			|| entry.chunks_count != bytes / header.chunk_bytes + (bytes % header.chunk_bytes != 0))
+			throw invalid("corrupted chunks of field " + f.name);
+
+		for (std::uint64_t c = 0; c < entry.chunks_count; c++)
+		{
+			const auto& chunk = chunk_entries[entry.first_chunk + c];
+
+			if (chunk.compression != no_compression || chunk.stored_bytes != chunk.raw_bytes
+				|| chunk.raw_bytes != std::min<std::uint64_t>(header.chunk_bytes, bytes - c * header.chunk_bytes)
+				|| chunk.offset > file.size() || chunk.stored_bytes > file.size() - chunk.offset)
+				throw invalid("unsupported or corrupted chunk of field " + f.name);
+		}
+
+		char* destination = (char*)f.resize(entry.count);
+
+		for (std::uint64_t c = 0; c < entry.chunks_count; c++)
+			chunk_destinations[entry.first_chunk + c] = destination + c * header.chunk_bytes;
+	}
+
+	const std::int64_t chunks_count = chunk_entries.size();
+
+#pragma omp parallel for schedule(dynamic)
+	for (std::int64_t c = 0; c < chunks_count; c++)
+	{
+		if (chunk_destinations[c] != nullptr)
+			std::memcpy(chunk_destinations[c], file.data() + chunk_entries[c].offset, chunk_entries[c].raw_bytes);
+	}
+
+	random::instance().set_seed((unsigned int)seed);
+
+	data.invalidate_active_sets();
+
+	// neighbors are not a part of the snapshot, the next update_neighbors rebuilds them
+	data.neighbors.clear();
+	std::fill(data.neighbors_offsets.begin(), data.neighbors_offsets.end(), 0);
+	std::fill(data.neighbors_counts.begin(), data.neighbors_counts.end(), 0);
+
+	if (auto potential_data = dynamic_cast<base_potential_data*>(data.potential_data.get()))
+		potential_data->reference_positions_valid = false;
+}
@@ -1,17 +1,27 @@
 #include "grid_space_partitioner.h"
 
+#include <algorithm>
+#include <cstdint>
+
 #include <noarr/structures/extra/shortcuts.hpp>
 
 using namespace micromech;
 using namespace biofvm;
 
-grid_space_partitioner::grid_space_partitioner(index_t voxel_size, const cartesian_mesh& microenv_mesh)
-	: partitioning_mesh_(microenv_mesh.dims, microenv_mesh.bounding_box_mins, microenv_mesh.bounding_box_maxs,
-						 { voxel_size, voxel_size, voxel_size })
+static std::uint64_t spread_bits(std::uint64_t x)
 {
-	index_t voxels_count = partitioning_mesh_.voxel_count();
-	agents_in_voxels_sizes_ = std::make_unique<std::atomic<index_t>[]>(voxels_count);
-	agents_in_voxels_ = std::make_unique<std::vector<index_t>[]>(voxels_count);
+	x &= 0x1fffff;
+	x = (x | x << 32) & 0x1f00000000ffff;
+	x = (x | x << 16) & 0x1f0000ff0000ff;
+	x = (x | x << 8) & 0x100f00f00f00f00f;
+	x = (x | x << 4) & 0x10c30c30c30c30c3;
+	x = (x | x << 2) & 0x1249249249249249;
+	return x;
+}
+
+static std::uint64_t morton_code(point_t<index_t, 3> position)
+{
+	return spread_bits(position[0]) | spread_bits(position[1]) << 1 | spread_bits(position[2]) << 2;
 }
 
 template <>
@@ -38,6 +48,34 @@ index_t grid_space_partitioner::get_mesh_index<3>(biofvm::point_t<biofvm::index_
 	return mesh_l | noarr::offset<'x', 'y', 'z'>(point[0], point[1], point[2]);
 }
 
+grid_space_partitioner::grid_space_partitioner(index_t voxel_size, const cartesian_mesh& microenv_mesh)
+	: partitioning_mesh_(microenv_mesh.dims, microenv_mesh.bounding_box_mins, microenv_mesh.bounding_box_maxs,
+						 { voxel_size, voxel_size, voxel_size }),
+	  partitionings_count_(0),
+	  agents_version_(~0ULL)
+{
+	index_t voxels_count = partitioning_mesh_.voxel_count();
+	agents_in_voxels_sizes_ = std::make_unique<std::atomic<index_t>[]>(voxels_count);
+	voxel_offsets_.resize(voxels_count + 1, 0);
+
+	// voxel slots are assigned in the Morton order of voxel positions
+	std::vector<std::pair<std::uint64_t, index_t>> voxel_codes(voxels_count);
+
+	for (index_t z = 0; z < partitioning_mesh_.grid_shape[2]; z++)
+		for (index_t y = 0; y < partitioning_mesh_.grid_shape[1]; y++)
+			for (index_t x = 0; x < partitioning_mesh_.grid_shape[0]; x++)
+			{
+				const index_t voxel_index = get_mesh_index<3>({ x, y, z });
+				voxel_codes[voxel_index] = { morton_code({ x, y, z }), voxel_index };
+			}
+
+	std::sort(voxel_codes.begin(), voxel_codes.end());
+
+	voxel_slots_.resize(voxels_count);
+	for (index_t i = 0; i < voxels_count; i++)
+		voxel_slots_[voxel_codes[i].second] = i;
+}
+
 index_t grid_space_partitioner::get_mesh_index(const real_t* position) const
 {
 	if (partitioning_mesh_.dims == 1)
@@ -60,38 +98,132 @@ index_t grid_space_partitioner::get_mesh_index(const real_t* position) const
 	}
 }
 
-void grid_space_partitioner::update_partitioning(const real_t* positions, index_t agents_count)
+index_t grid_space_partitioner::voxel_slot(point_t<index_t, 3> voxel) const
 {
+	return voxel_slots_[get_mesh_index<3>(voxel)];
+}
+
+void grid_space_partitioner::update_partitioning(const real_t* positions, index_t agents_count, const index_t* agents,
+												 std::uint64_t agents_version)
+{
+	const index_t voxels_count = partitioning_mesh_.voxel_count();
+
+#pragma omp single
+	{
+		agents_.resize(agents_count);
+		agent_voxels_.resize(agents_count);
+		agent_voxel_ranks_.resize(agents_count);
+
+		partitionings_count_++;
+		agents_version_ = agents_version;
+	}
+
 #pragma omp for
-	for (std::size_t i = 0; i < partitioning_mesh_.voxel_count(); i++)
+	for (index_t i = 0; i < voxels_count; i++)
 	{
-		agents_in_voxels_[i].clear();
 		agents_in_voxels_sizes_[i].store(0, std::memory_order_relaxed);
 	}
 
-	// first we count how many cells are in each voxel
+	// first we count how many cells are in each voxel, remembering the rank of each cell in its voxel
 #pragma omp for
 	for (index_t i = 0; i < agents_count; i++)
 	{
-		agents_in_voxels_sizes_[get_mesh_index(positions + i * partitioning_mesh_.dims)].fetch_add(
-			1, std::memory_order_relaxed);
+		const index_t agent = agents != nullptr ? agents[i] : i;
+		const index_t voxel_slot = voxel_slots_[get_mesh_index(positions + agent * partitioning_mesh_.dims)];
+
+		agent_voxels_[i] = voxel_slot;
+		agent_voxel_ranks_[i] = agents_in_voxels_sizes_[voxel_slot].fetch_add(1, std::memory_order_relaxed);
 	}
 
-	// second we allocate memory for each voxel
-#pragma omp for
-	for (std::size_t i = 0; i < partitioning_mesh_.voxel_count(); i++)
+	// second we compute voxel offsets using the prefix sum of the counts
+#pragma omp single
 	{
-		agents_in_voxels_[i].resize(agents_in_voxels_sizes_[i].load(std::memory_order_relaxed));
+		voxel_offsets_[0] = 0;
+		for (index_t i = 0; i < voxels_count; i++)
+			voxel_offsets_[i + 1] = voxel_offsets_[i] + agents_in_voxels_sizes_[i].load(std::memory_order_relaxed);
 	}
 
-	// third we assign cells to voxels
+	// third we scatter cells to their slots
 #pragma omp for
 	for (index_t i = 0; i < agents_count; i++)
 	{
-		auto mech_idx = get_mesh_index(positions + i * partitioning_mesh_.dims);
+		agents_[voxel_offsets_[agent_voxels_[i]] + agent_voxel_ranks_[i]] = agents != nullptr ? agents[i] : i;
+	}
+
+	// finally we sort each (small) voxel so the order does not depend on the thread scheduling
+#pragma omp for schedule(dynamic, 64)
+	for (index_t i = 0; i < voxels_count; i++)
+	{
+		std::sort(agents_.begin() + voxel_offsets_[i], agents_.begin() + voxel_offsets_[i + 1]);
+	}
+}
+
+void grid_space_partitioner::apply_partitioned_order(std::uint64_t agents_version)
+{
+	const index_t voxels_count = partitioning_mesh_.voxel_count();
+
+#pragma omp single
+	{
+		partitionings_count_++;
+		agents_version_ = agents_version;
+	}
+
+#pragma omp for
+	for (index_t i = 0; i < voxels_count; i++)
+	{
+		for (index_t k = voxel_offsets_[i]; k < voxel_offsets_[i + 1]; k++)
+		{
+			agents_[k] = k;
+			agent_voxels_[k] = i;
+			agent_voxel_ranks_[k] = k - voxel_offsets_[i];
+		}
+	}
+}
+
+void grid_space_partitioner::select_agents(const grid_space_partitioner& source, const std::uint8_t* flags,
+										   std::uint8_t value)
+{
+	const index_t voxels_count = partitioning_mesh_.voxel_count();
+
+	// first we count the selected agents of each voxel
+#pragma omp for
+	for (index_t i = 0; i < voxels_count; i++)
+	{
+		index_t count = 0;
+		for (index_t k = source.voxel_offsets_[i]; k < source.voxel_offsets_[i + 1]; k++)
+			count += flags[source.agents_[k]] == value;
+
+		agents_in_voxels_sizes_[i].store(count, std::memory_order_relaxed);
+	}
+
+	// the source may be this partitioner, so the selected agents are gathered into the scratch buffers first
+#pragma omp single
+	{
+		selected_offsets_.resize(voxels_count + 1);
+		selected_offsets_[0] = 0;
+		for (index_t i = 0; i < voxels_count; i++)
+			selected_offsets_[i + 1] =
+				selected_offsets_[i] + agents_in_voxels_sizes_[i].load(std::memory_order_relaxed);
 
-		auto in_voxel_index = agents_in_voxels_sizes_[mech_idx].fetch_sub(1, std::memory_order_relaxed) - 1;
+		agent_voxel_ranks_.resize(selected_offsets_[voxels_count]);
+	}
+
+	// agents of the source voxels are sorted, so are the selected ones
+#pragma omp for
+	for (index_t i = 0; i < voxels_count; i++)
+	{
+		index_t slot = selected_offsets_[i];
+		for (index_t k = source.voxel_offsets_[i]; k < source.voxel_offsets_[i + 1]; k++)
+			if (flags[source.agents_[k]] == value)
+				agent_voxel_ranks_[slot++] = source.agents_[k];
+	}
+
+#pragma omp single
+	{
+		agents_.swap(agent_voxel_ranks_);
+		voxel_offsets_.swap(selected_offsets_);
 
-		agents_in_voxels_[mech_idx][in_voxel_index] = i;
+		partitionings_count_++;
+		agents_version_ = source.agents_version_;
 	}
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <cstdint>
 #include <memory>
 #include <vector>
 
@@ -10,25 +11,32 @@
 
 namespace micromech {
 
+// Cell list in the compressed sparse row format - agents of voxel slot s are stored contiguously in
+// agents_[voxel_offsets_[s] .. voxel_offsets_[s + 1]). Buffers are reused and grow only with the agents count.
+// Voxel slots follow the Morton order of voxels, so agents_ lists the agents along a space filling curve.
 class grid_space_partitioner
 {
 	biofvm::cartesian_mesh partitioning_mesh_;
 
 	std::unique_ptr<std::atomic<biofvm::index_t>[]> agents_in_voxels_sizes_;
-	std::unique_ptr<std::vector<biofvm::index_t>[]> agents_in_voxels_;
+	std::vector<biofvm::index_t> voxel_offsets_;
+	std::vector<biofvm::index_t> voxel_slots_;
+
+	std::vector<biofvm::index_t> agents_;
+	std::vector<biofvm::index_t> agent_voxels_;
+	std::vector<biofvm::index_t> agent_voxel_ranks_;
+	std::vector<biofvm::index_t> selected_offsets_;
+
+	std::uint64_t partitionings_count_;
+	std::uint64_t agents_version_;
 
 	template <biofvm::index_t dims>
 	biofvm::index_t get_mesh_index(biofvm::point_t<biofvm::index_t, 3> point) const;
 
 	biofvm::index_t get_mesh_index(const biofvm::real_t* position) const;
 
-public:
-	grid_space_partitioner(biofvm::index_t voxel_size, const biofvm::cartesian_mesh& microenv_mesh);
-
-	void update_partitioning(const biofvm::real_t* positions, biofvm::index_t agents_count);
-
-	template <biofvm::index_t dims, typename func_t>
-	void for_each_in_neighborhood(const biofvm::real_t* agent_position, biofvm::index_t i, func_t f)
+	template <biofvm::index_t dims, bool half, typename func_t>
+	void for_each_in_stencil(const biofvm::real_t* agent_position, biofvm::index_t i, func_t f)
 	{
 		auto position = partitioning_mesh_.voxel_position<dims>(agent_position);
 		for (biofvm::index_t z = -1; z <= 1; z++)
@@ -46,6 +54,12 @@ public:
 					if (position[0] + x >= partitioning_mesh_.grid_shape[0] || position[0] + x < 0)
 						continue;
 
+					// half shell contains only voxels with lexicographically positive (z, y, x) offset
+					if (half && (z < 0 || (z == 0 && (y < 0 || (y == 0 && x < 0)))))
+						continue;
+
+					const bool same_voxel = x == 0 && y == 0 && z == 0;
+
 					biofvm::index_t voxel_index;
 
 					if constexpr (dims == 1)
@@ -61,15 +75,78 @@ public:
 						voxel_index = get_mesh_index<3>({ position[0] + x, position[1] + y, position[2] + z });
 					}
 
-					for (auto& cell_idx : agents_in_voxels_[voxel_index])
+					const biofvm::index_t voxel_slot = voxel_slots_[voxel_index];
+					const biofvm::index_t voxel_end = voxel_offsets_[voxel_slot + 1];
+
+					for (biofvm::index_t k = voxel_offsets_[voxel_slot]; k < voxel_end; k++)
 					{
-						if (i != cell_idx)
+						const biofvm::index_t cell_idx = agents_[k];
+
+						if ((half && same_voxel) ? cell_idx > i : cell_idx != i)
 							f(cell_idx);
 					}
 				}
 			}
 		}
 	}
+
+public:
+	grid_space_partitioner(biofvm::index_t voxel_size, const biofvm::cartesian_mesh& microenv_mesh);
+
+	// Partitions the agents 0 .. agents_count, or only the agents listed in agents when it is given. agents_version
+	// is the version of the agent data being partitioned, other users of the partitioning compare it with the current
+	// one to tell whether the partitioning still refers to the same agents; ~0 marks it unknown.
+	void update_partitioning(const biofvm::real_t* positions, biofvm::index_t agents_count,
+							 const biofvm::index_t* agents = nullptr, std::uint64_t agents_version = ~0ULL);
+
+	// Partitions the agents of the source partitioning whose flag equals value, without binning them again. The source
+	// must have the same mesh and may be this partitioner; the agents version is taken from it.
+	void select_agents(const grid_space_partitioner& source, const std::uint8_t* flags, std::uint8_t value);
+
+	// agents ordered by the space filling curve of their voxels as of the last partitioning
+	const biofvm::index_t* partitioned_agents() const { return agents_.data(); }
+
+	// updates the partitioning after agents were permuted by partitioned_agents()
+	void apply_partitioned_order(std::uint64_t agents_version = ~0ULL);
+
+	// incremented by each partitioning and each applied order
+	std::uint64_t partitionings_count() const { return partitionings_count_; }
+	std::uint64_t agents_version() const { return agents_version_; }
+
+	const biofvm::cartesian_mesh& mesh() const { return partitioning_mesh_; }
+
+	biofvm::index_t voxels_count() const { return partitioning_mesh_.voxel_count(); }
+
+	// agents in all voxels as of the last partitioning
+	biofvm::index_t partitioned_agents_count() const { return voxel_offsets_.back(); }
+
+	// slot of the voxel at the grid position
+	biofvm::index_t voxel_slot(biofvm::point_t<biofvm::index_t, 3> voxel) const;
+
+	// agents in the voxel slot as of the last partitioning
+	biofvm::index_t voxel_agents_count(biofvm::index_t voxel_slot) const
+	{
+		return voxel_offsets_[voxel_slot + 1] - voxel_offsets_[voxel_slot];
+	}
+
+	const biofvm::index_t* voxel_agents(biofvm::index_t voxel_slot) const
+	{
+		return agents_.data() + voxel_offsets_[voxel_slot];
+	}
+
+	template <biofvm::index_t dims, typename func_t>
+	void for_each_in_neighborhood(const biofvm::real_t* agent_position, biofvm::index_t i, func_t f)
+	{
+		for_each_in_stencil<dims, false>(agent_position, i, f);
+	}
+
+	// visits each pair of neighboring agents only once - from the agent with the lower index if both share a voxel,
+	// otherwise from the agent whose voxel precedes the other one's
+	template <biofvm::index_t dims, typename func_t>
+	void for_each_in_half_neighborhood(const biofvm::real_t* agent_position, biofvm::index_t i, func_t f)
+	{
+		for_each_in_stencil<dims, true>(agent_position, i, f);
+	}
 };
 
 } // namespace micromech
@@ -1,10 +1,10 @@
-#include <chrono>
 #include <iostream>
 #include <random>
 
 #include <BioFVM/microenvironment.h>
 
 #include "BioFVM/types.h"
+#include "agents_sorter.h"
 #include "base_membrane_data.h"
 #include "base_motility_data.h"
 #include "base_motility_model.h"
@@ -13,6 +13,7 @@
 #include "base_wall_membrane_model.h"
 #include "grid_space_partitioner.h"
 #include "mech_environment.h"
+#include "mech_simulation.h"
 
 using namespace biofvm;
 using namespace micromech;
@@ -59,10 +60,10 @@ void make_agents(std::size_t count, mech_environment& me, data_setup_func_t&& se
 
 	std::mt19937 gen;
 
+	me.agent_data.add(count);
+
 	for (std::size_t i = 0; i < count; ++i)
 	{
-		me.agent_data.add();
-
 		me.agent_data.radius[i] = 10;
 		me.agent_data.is_movable[i] = true;
 		me.agent_data.agent_type_indices[i] = 0;
@@ -94,88 +95,43 @@ int main()
 
 	mech_environment me(m, mech_time_step, agent_types_count);
 
-	me.membrane_m = std::make_unique<base_wall_membrane_model>(me);
+	// voxels must cover the maximal adhesion distance plus the neighbors skin
+	real_t neighbors_skin = 2;
+	grid_space_partitioner partitioner(20 + neighbors_skin, mesh);
 
-	grid_space_partitioner partitioner(20, mesh);
-	me.potential_m = std::make_unique<base_potential_model>(partitioner, me);
+	mech_simulation<2, base_potential_model, base_wall_membrane_model, base_motility_model> simulation(
+		me, base_potential_model(partitioner, me, neighbors_skin, true), base_wall_membrane_model(me, partitioner),
+		base_motility_model(me));
 
-	me.motility_m = std::make_unique<base_motility_model>(me);
+	agents_sorter sorter(partitioner, 10);
 
 	size_t agents_count = 20000;
 	make_agents(agents_count, me, setup_base_membrane_data, setup_base_motility_data, setup_base_potential_data);
 
+	me.metrics.enable();
+
 #pragma omp parallel
 	for (index_t i = 0; i < 100; i++)
 	{
-		std::size_t partition_duration, membrane_duration, motility_duration, neighbors_duration, velocities_duration,
-			positions_duration;
-
-		{
-			auto start = std::chrono::high_resolution_clock::now();
-
-			partitioner.update_partitioning(me.agent_data.bio_agent_data.positions.data(), agents_count);
-
-			auto end = std::chrono::high_resolution_clock::now();
-
-			partition_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-		}
-
-		{
-			auto start = std::chrono::high_resolution_clock::now();
-
-			me.membrane_m->compute_basement_membrane_interactions(me);
-
-			auto end = std::chrono::high_resolution_clock::now();
-
-			membrane_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-		}
-
-		{
-			auto start = std::chrono::high_resolution_clock::now();
-
-			me.motility_m->update_motility_velocities(me);
+		sorter.sort(me);
 
-			auto end = std::chrono::high_resolution_clock::now();
+		simulation.simulate_step();
 
-			motility_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-		}
-
-		{
-			auto start = std::chrono::high_resolution_clock::now();
-
-			me.potential_m->update_neighbors(me);
-
-			auto end = std::chrono::high_resolution_clock::now();
-
-			neighbors_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-		}
-
-		{
-			auto start = std::chrono::high_resolution_clock::now();
-
-			me.potential_m->update_velocities(me);
-
-			auto end = std::chrono::high_resolution_clock::now();
-
-			velocities_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
-		}
+		me.metrics.end_step();
 
+#pragma omp master
 		{
-			auto start = std::chrono::high_resolution_clock::now();
+			// the slowest thread determines the time of a phase
+			const auto& step = me.metrics.last_step();
 
-			me.potential_m->update_positions(me);
-
-			auto end = std::chrono::high_resolution_clock::now();
-
-			positions_duration = std::chrono::duration_cast<std::chrono::milliseconds>(end - start).count();
+			for (std::size_t p = 0; p < mech_phases_count; p++)
+				std::cout << (p == 0 ? "" : ",\t ") << mech_metrics::name((mech_phase)p)
+						  << " time: " << step.phases[p].max_thread_ns / 1e6 << " ms";
+			std::cout << std::endl;
 		}
-        
-#pragma omp master
-		std::cout << "Partition time: " << partition_duration << " ms,\t Membrane time: " << membrane_duration
-				  << " ms,\t Motility time: " << motility_duration << " ms,\t Neighbors time: " << neighbors_duration
-				  << " ms,\t Velocities time: " << velocities_duration
-				  << " ms,\t Positions time: " << positions_duration << " ms" << std::endl;
 	}
 
+	me.metrics.write_json(std::cout);
+
 	return 0;
 }
@@ -1,26 +1,47 @@
 #include "mech_agent_data.h"
 
+#include <algorithm>
 #include <memory>
 
 #include <BioFVM/data_utils.h>
 
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
 #include "empty_data.h"
 #include "mech_environment.h"
+#include "permutation_utils.h"
 
 using namespace biofvm;
 using namespace micromech;
 
+#ifdef _OPENMP
+static std::size_t thread_number() { return omp_get_thread_num(); }
+static std::size_t max_threads_count() { return omp_get_max_threads(); }
+#else
+static std::size_t thread_number() { return 0; }
+static std::size_t max_threads_count() { return 1; }
+#endif
+
 mech_agent_data::mech_agent_data(mech_environment& me)
-	: bio_agent_data(me.m),
+	: requests_(max_threads_count() + 1),
+	  bio_agent_data(me.m),
 	  me(me),
 	  potential_data(std::make_unique<empty_data>(me)),
 	  membrane_data(std::make_unique<empty_data>(me)),
-	  motility_data(std::make_unique<empty_data>(me))
+	  motility_data(std::make_unique<empty_data>(me)),
+	  active_sets_version(0)
 {}
 
-void mech_agent_data::add()
+void mech_agent_data::add() { add(1); }
+
+void mech_agent_data::add(index_t count)
 {
-	bio_agent_data.add();
+	// BioFVM appends its agents one by one, the vectors grow geometrically
+	for (index_t i = 0; i < count; i++)
+		bio_agent_data.add();
+
 	potential_data->add();
 	membrane_data->add();
 	motility_data->add();
@@ -29,7 +50,10 @@ void mech_agent_data::add()
 	radius.resize(agents_count());
 	is_movable.resize(agents_count());
 	agent_type_indices.resize(agents_count());
-	neighbors.resize(agents_count());
+	neighbors_offsets.resize(agents_count());
+	neighbors_counts.resize(agents_count());
+
+	active_sets_version++;
 }
 
 void mech_agent_data::remove(index_t index)
@@ -39,16 +63,211 @@ void mech_agent_data::remove(index_t index)
 	membrane_data->remove(index);
 	motility_data->remove(index);
 
-	if (index == agents_count())
+	active_sets_version++;
+
+	const index_t last = agents_count();
+
+	// neighbors of the removed agent are dropped and those of the last agent follow it to index
+	filter_indices(neighbors, neighbors_offsets.data(), neighbors_counts.data(), last + 1, [index, last](index_t j) {
+		return j == index ? -1 : (j == last ? index : j);
+	});
+
+	// the freed slot is reused by the next added agent, which starts without neighbors
+	const index_t last_neighbors_count = neighbors_counts[last];
+	neighbors_counts[last] = 0;
+
+	if (index == last)
 		return;
 
-	move_vector(velocity.data() + index * me.m.mesh.dims, velocity.data() + agents_count() * me.m.mesh.dims,
-				me.m.mesh.dims);
+	std::copy_n(velocity.data() + agents_count() * me.m.mesh.dims, me.m.mesh.dims,
+				velocity.data() + index * me.m.mesh.dims);
 
 	radius[index] = radius[agents_count()];
 	is_movable[index] = is_movable[agents_count()];
 	agent_type_indices[index] = agent_type_indices[agents_count()];
-	neighbors[index] = neighbors[agents_count()];
+	neighbors_offsets[index] = neighbors_offsets[agents_count()];
+	neighbors_counts[index] = last_neighbors_count;
+}
+
+void mech_agent_data::remove(std::span<const index_t> indices)
+{
+	const index_t count = agents_count();
+
+	std::vector<std::uint8_t> removed(count, 0);
+	for (index_t index : indices)
+		removed[index] = 1;
+
+	// the removed agents are moved to the end, so they are removed without moving any other agent
+	std::vector<index_t> permutation(count);
+	index_t remaining_count = 0;
+
+	for (index_t i = 0; i < count; i++)
+		if (!removed[i])
+			permutation[remaining_count++] = i;
+
+	if (remaining_count == count)
+		return;
+
+	for (index_t i = 0, r = remaining_count; i < count; i++)
+		if (removed[i])
+			permutation[r++] = i;
+
+	permute(permutation.data());
+
+	while (agents_count() > remaining_count)
+	{
+		const index_t last = agents_count() - 1;
+
+		bio_agent_data.remove(last);
+		potential_data->remove(last);
+		membrane_data->remove(last);
+		motility_data->remove(last);
+	}
+
+	filter_indices(neighbors, neighbors_offsets.data(), neighbors_counts.data(), remaining_count,
+				   [remaining_count](index_t j) { return j < remaining_count ? j : -1; });
+
+	// the freed slots are reused by the next added agents, which start without neighbors
+	std::fill(neighbors_counts.begin() + remaining_count, neighbors_counts.begin() + count, 0);
+}
+
+void mech_agent_data::copy(index_t from, index_t to)
+{
+	const index_t substrates_count = me.m.substrates_count;
+	const index_t dims = me.m.mesh.dims;
+
+	for (auto* values : { &bio_agent_data.secretion_rates, &bio_agent_data.saturation_densities,
+						  &bio_agent_data.uptake_rates, &bio_agent_data.net_export_rates,
+						  &bio_agent_data.internalized_substrates, &bio_agent_data.fraction_released_at_death,
+						  &bio_agent_data.fraction_transferred_when_ingested })
+		std::copy_n(values->data() + from * substrates_count, substrates_count, values->data() + to * substrates_count);
+
+	bio_agent_data.volumes[to] = bio_agent_data.volumes[from];
+	std::copy_n(bio_agent_data.positions.data() + from * dims, dims, bio_agent_data.positions.data() + to * dims);
+
+	potential_data->copy(from, to);
+	membrane_data->copy(from, to);
+	motility_data->copy(from, to);
+
+	std::copy_n(velocity.data() + from * dims, dims, velocity.data() + to * dims);
+	radius[to] = radius[from];
+	is_movable[to] = is_movable[from];
+	agent_type_indices[to] = agent_type_indices[from];
+
+	neighbors_offsets[to] = 0;
+	neighbors_counts[to] = 0;
+
+	active_sets_version++;
+}
+
+mech_agent_data::thread_requests& mech_agent_data::thread_queue()
+{
+	return requests_[std::min(thread_number(), requests_.size() - 1)];
+}
+
+void mech_agent_data::request_division(index_t parent)
+{
+	if (thread_number() < requests_.size() - 1)
+	{
+		thread_queue().divisions.push_back(parent);
+		return;
+	}
+
+#pragma omp critical(micromech_agent_requests)
+	thread_queue().divisions.push_back(parent);
+}
+
+void mech_agent_data::request_death(index_t index)
+{
+	if (thread_number() < requests_.size() - 1)
+	{
+		thread_queue().deaths.push_back(index);
+		return;
+	}
+
+#pragma omp critical(micromech_agent_requests)
+	thread_queue().deaths.push_back(index);
+}
+
+void mech_agent_data::apply_requests(const std::function<void(index_t, index_t)>& on_division)
+{
+	std::vector<index_t> divisions, deaths;
+
+	for (auto& requests : requests_)
+	{
+		divisions.insert(divisions.end(), requests.divisions.begin(), requests.divisions.end());
+		deaths.insert(deaths.end(), requests.deaths.begin(), requests.deaths.end());
+
+		requests.divisions.clear();
+		requests.deaths.clear();
+	}
+
+	// sorted, so the result does not depend on the threads which queued the requests
+	std::sort(divisions.begin(), divisions.end());
+	std::sort(deaths.begin(), deaths.end());
+	deaths.erase(std::unique(deaths.begin(), deaths.end()), deaths.end());
+
+	std::erase_if(divisions,
+				  [&deaths](index_t parent) { return std::binary_search(deaths.begin(), deaths.end(), parent); });
+
+	const index_t first_child = agents_count();
+
+	if (!divisions.empty())
+		add(divisions.size());
+
+	for (std::size_t k = 0; k < divisions.size(); k++)
+		copy(divisions[k], first_child + k);
+
+	if (on_division)
+		for (std::size_t k = 0; k < divisions.size(); k++)
+			on_division(divisions[k], first_child + k);
+
+	remove(deaths);
+}
+
+void mech_agent_data::permute(const index_t* permutation)
+{
+	const index_t count = agents_count();
+	const index_t substrates_count = me.m.substrates_count;
+
+	std::vector<index_t> inverse_permutation(count);
+	index_t* __restrict__ inverse_permutation_data = inverse_permutation.data();
+
+#pragma omp taskloop
+	for (index_t i = 0; i < count; i++)
+		inverse_permutation_data[permutation[i]] = i;
+
+	permute_vector(bio_agent_data.secretion_rates, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.saturation_densities, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.uptake_rates, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.net_export_rates, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.internalized_substrates, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.fraction_released_at_death, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.fraction_transferred_when_ingested, permutation, count, substrates_count);
+	permute_vector(bio_agent_data.volumes, permutation, count);
+	permute_vector(bio_agent_data.positions, permutation, count, me.m.mesh.dims);
+
+	potential_data->permute(permutation, inverse_permutation.data());
+	membrane_data->permute(permutation, inverse_permutation.data());
+	motility_data->permute(permutation, inverse_permutation.data());
+
+	permute_vector(velocity, permutation, count, me.m.mesh.dims);
+	permute_vector(radius, permutation, count);
+	permute_vector(is_movable, permutation, count);
+	permute_vector(agent_type_indices, permutation, count);
+
+	permute_vector(neighbors_offsets, permutation, count);
+	permute_vector(neighbors_counts, permutation, count);
+	remap_indices(neighbors, neighbors_offsets.data(), neighbors_counts.data(), count, inverse_permutation.data());
+
+	active_sets_version++;
 }
 
 index_t mech_agent_data::agents_count() const { return bio_agent_data.agents_count; }
+
+void mech_agent_data::update_movable_agents()
+{
+	movable_agents.update(is_movable.data(), agents_count(), active_sets_version);
+}
+
+void mech_agent_data::invalidate_active_sets() { active_sets_version++; }
@@ -0,0 +1,292 @@
+#include "mech_metrics.h"
+
+#include <algorithm>
+#include <chrono>
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+using namespace biofvm;
+using namespace micromech;
+
+#ifdef _OPENMP
+static std::size_t thread_number() { return omp_get_thread_num(); }
+static std::size_t team_size() { return omp_get_num_threads(); }
+static std::size_t max_threads_count() { return omp_get_max_threads(); }
+#else
+static std::size_t thread_number() { return 0; }
+static std::size_t team_size() { return 1; }
+static std::size_t max_threads_count() { return 1; }
+#endif
+
+static std::int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+static void accumulate(metrics_summary& into, const metrics_summary& step)
+{
+	into.steps += step.steps;
+
+	for (std::size_t p = 0; p < mech_phases_count; p++)
+	{
+		into.phases[p].min_thread_ns += step.phases[p].min_thread_ns;
+		into.phases[p].max_thread_ns += step.phases[p].max_thread_ns;
+		into.phases[p].mean_thread_ns += step.phases[p].mean_thread_ns;
+	}
+
+	for (std::size_t c = 0; c < mech_counters_count; c++)
+		into.counters[c] += step.counters[c];
+}
+
+void mech_metrics::enable(const std::string& output_path, metrics_format format, std::uint64_t dump_interval)
+{
+	threads_.assign(max_threads_count(), thread_slot {});
+
+	output_ = std::ofstream();
+	if (!output_path.empty() && dump_interval > 0)
+		output_.open(output_path);
+
+	format_ = format;
+	dump_interval_ = dump_interval;
+
+	if (output_.is_open() && format_ == metrics_format::csv)
+		write_csv_header(output_);
+
+	reset();
+
+	enabled_ = true;
+}
+
+void mech_metrics::disable()
+{
+	enabled_ = false;
+	output_.close();
+}
+
+void mech_metrics::reset()
+{
+	last_step_ = interval_ = total_ = metrics_summary {};
+	gauges_.fill(0);
+}
+
+void mech_metrics::begin_phase_internal(mech_phase phase)
+{
+	const std::size_t thread = thread_number();
+
+	if (thread < threads_.size())
+		threads_[thread].starts[(std::size_t)phase] = now_ns();
+}
+
+void mech_metrics::end_phase_internal(mech_phase phase)
+{
+	const std::size_t thread = thread_number();
+
+	if (thread < threads_.size())
+		threads_[thread].elapsed[(std::size_t)phase] += now_ns() - threads_[thread].starts[(std::size_t)phase];
+}
+
+void mech_metrics::add_internal(mech_counter counter, std::uint64_t value)
+{
+	const std::size_t thread = thread_number();
+
+	if (thread < threads_.size())
+		threads_[thread].counters[(std::size_t)counter] += value;
+}
+
+void mech_metrics::end_step_internal()
+{
+	// the slots are read by the master thread only when all threads finished the phases of the step
+#pragma omp barrier
+
+#pragma omp master
+	{
+		const std::size_t threads_count = std::min(team_size(), threads_.size());
+
+		last_step_ = metrics_summary {};
+		last_step_.steps = 1;
+
+		for (std::size_t p = 0; p < mech_phases_count; p++)
+		{
+			auto& phase = last_step_.phases[p];
+
+			phase.min_thread_ns = threads_[0].elapsed[p];
+
+			for (std::size_t t = 0; t < threads_count; t++)
+			{
+				phase.min_thread_ns = std::min(phase.min_thread_ns, threads_[t].elapsed[p]);
+				phase.max_thread_ns = std::max(phase.max_thread_ns, threads_[t].elapsed[p]);
+				phase.mean_thread_ns += threads_[t].elapsed[p];
+			}
+
+			phase.mean_thread_ns /= threads_count;
+		}
+
+		for (std::size_t t = 0; t < threads_.size(); t++)
+		{
+			for (std::size_t c = 0; c < mech_counters_count; c++)
+				last_step_.counters[c] += threads_[t].counters[c];
+
+			threads_[t].elapsed.fill(0);
+			threads_[t].counters.fill(0);
+		}
+
+		accumulate(interval_, last_step_);
+		accumulate(total_, last_step_);
+
+		if (output_.is_open() && total_.steps % dump_interval_ == 0)
+		{
+			if (format_ == metrics_format::json)
+				write_json(output_, interval_);
+			else
+				write_csv_row(output_, interval_);
+
+			output_.flush();
+			interval_ = metrics_summary {};
+		}
+	}
+
+	// the next step may not start timing before the slots are cleared
+#pragma omp barrier
+}
+
+void mech_metrics::write_json(std::ostream& os, const metrics_summary& summary) const
+{
+	os << "{\"step\":" << total_.steps << ",\"steps\":" << summary.steps << ",\"phases\":{";
+
+	for (std::size_t p = 0; p < mech_phases_count; p++)
+	{
+		const auto& phase = summary.phases[p];
+
+		os << (p == 0 ? "" : ",") << "\"" << name((mech_phase)p) << "\":{\"min_thread_ns\":" << phase.min_thread_ns
+		   << ",\"max_thread_ns\":" << phase.max_thread_ns << ",\"mean_thread_ns\":" << phase.mean_thread_ns
+		   << ",\"imbalance\":" << phase.imbalance() << "}";
+	}
+
+	os << "},\"counters\":{";
+
+	for (std::size_t c = 0; c < mech_counters_count; c++)
+		os << (c == 0 ? "" : ",") << "\"" << name((mech_counter)c) << "\":" << summary.counters[c];
+
+	os << "},\"gauges\":{";
+
+	for (std::size_t g = 0; g < mech_gauges_count; g++)
+		os << (g == 0 ? "" : ",") << "\"" << name((mech_gauge)g) << "\":" << gauges_[g];
+
+	os << "}}\n";
+}
+
+void mech_metrics::write_csv_header(std::ostream& os) const
+{
+	os << "step,steps";
+
+	for (std::size_t p = 0; p < mech_phases_count; p++)
+	{
+		const char* phase = name((mech_phase)p);
+		os << "," << phase << "_min_thread_ns," << phase << "_max_thread_ns," << phase << "_mean_thread_ns,"
+		   << phase << "_imbalance";
+	}
+
+	for (std::size_t c = 0; c < mech_counters_count; c++)
+		os << "," << name((mech_counter)c);
+
+	for (std::size_t g = 0; g < mech_gauges_count; g++)
+		os << "," << name((mech_gauge)g);
+
+	os << "\n";
+}
+
+void mech_metrics::write_csv_row(std::ostream& os, const metrics_summary& summary) const
+{
+	os << total_.steps << "," << summary.steps;
+
+	for (const auto& phase : summary.phases)
+		os << "," << phase.min_thread_ns << "," << phase.max_thread_ns << "," << phase.mean_thread_ns << ","
+		   << phase.imbalance();
+
+	for (auto counter : summary.counters)
+		os << "," << counter;
+
+	for (auto gauge : gauges_)
+		os << "," << gauge;
+
+	os << "\n";
+}
+
+void mech_metrics::write_csv(std::ostream& os) const
+{
+	write_csv_header(os);
+	write_csv_row(os, total_);
+}
+
+const char* mech_metrics::name(mech_phase phase)
+{
+	switch (phase)
+	{
+	case mech_phase::sort:
+		return "sort";
+	case mech_phase::membrane:
+		return "membrane";
+	case mech_phase::motility:
+		return "motility";
+	case mech_phase::neighbors:
+		return "neighbors";
+	case mech_phase::velocities:
+		return "velocities";
+	case mech_phase::positions:
+		return "positions";
+	case mech_phase::output:
+		return "output";
+	default:
+		return "unknown";
+	}
+}
+
+const char* mech_metrics::name(mech_counter counter)
+{
+	switch (counter)
+	{
+	case mech_counter::pairs_evaluated:
+		return "pairs_evaluated";
+	case mech_counter::springs_attached:
+		return "springs_attached";
+	case mech_counter::springs_detached:
+		return "springs_detached";
+	case mech_counter::neighbors_rebuilds:
+		return "neighbors_rebuilds";
+	case mech_counter::output_frames:
+		return "output_frames";
+	case mech_counter::output_bytes:
+		return "output_bytes";
+	case mech_counter::output_write_ns:
+		return "output_write_ns";
+	case mech_counter::output_stall_ns:
+		return "output_stall_ns";
+	case mech_counter::steps_before_sort_ns:
+		return "steps_before_sort_ns";
+	case mech_counter::steps_after_sort_ns:
+		return "steps_after_sort_ns";
+	default:
+		return "unknown";
+	}
+}
+
+const char* mech_metrics::name(mech_gauge gauge)
+{
+	switch (gauge)
+	{
+	case mech_gauge::neighbors_per_agent_mean:
+		return "neighbors_per_agent_mean";
+	case mech_gauge::neighbors_per_agent_max:
+		return "neighbors_per_agent_max";
+	case mech_gauge::agents_per_voxel_mean:
+		return "agents_per_voxel_mean";
+	case mech_gauge::agents_per_voxel_max:
+		return "agents_per_voxel_max";
+	default:
+		return "unknown";
+	}
+}
@@ -0,0 +1,159 @@
+#include "mech_trace.h"
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <stdexcept>
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+using namespace biofvm;
+using namespace micromech;
+
+#ifdef _OPENMP
+static std::size_t thread_number() { return omp_get_thread_num(); }
+static std::size_t max_threads_count() { return omp_get_max_threads(); }
+#else
+static std::size_t thread_number() { return 0; }
+static std::size_t max_threads_count() { return 1; }
+#endif
+
+static std::int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+mech_trace& mech_trace::instance()
+{
+	static mech_trace instance;
+	return instance;
+}
+
+void mech_trace::enable(std::size_t max_records_per_thread)
+{
+	max_records_ = max_records_per_thread;
+	origin_ = now_ns();
+
+	threads_.assign(max_threads_count(), thread_buffer {});
+	for (auto& thread : threads_)
+		thread.records.reserve(std::min<std::size_t>(max_records_, 1 << 16));
+
+	enabled_ = true;
+}
+
+void mech_trace::disable() { enabled_ = false; }
+
+void mech_trace::begin_internal()
+{
+	const std::size_t thread = thread_number();
+
+	if (thread < threads_.size())
+		threads_[thread].begin = now_ns();
+}
+
+void mech_trace::wait_internal()
+{
+	const std::size_t thread = thread_number();
+
+	if (thread < threads_.size())
+		threads_[thread].wait = now_ns();
+}
+
+void mech_trace::end_internal(trace_loop loop)
+{
+	const std::size_t thread = thread_number();
+
+	if (thread >= threads_.size())
+		return;
+
+	auto& buffer = threads_[thread];
+
+	if (buffer.records.size() < max_records_)
+		buffer.records.push_back({ loop, buffer.begin, buffer.wait, now_ns() });
+	else
+		buffer.dropped++;
+}
+
+std::size_t mech_trace::records_count() const
+{
+	std::size_t count = 0;
+	for (const auto& thread : threads_)
+		count += thread.records.size();
+	return count;
+}
+
+void mech_trace::write(const std::string& path) const
+{
+	std::ofstream file(path);
+
+	if (!file)
+		throw std::runtime_error("mech_trace can not write " + path);
+
+	// timestamps of the format are in microseconds
+	auto us = [this](std::int64_t ns) { return (ns - origin_) / 1e3; };
+
+	std::uint64_t dropped = 0;
+	bool first = true;
+
+	file.precision(15);
+	file << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+
+	for (std::size_t t = 0; t < threads_.size(); t++)
+	{
+		if (threads_[t].records.empty())
+			continue;
+
+		file << (first ? "" : ",") << "\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":" << t
+			 << ",\"args\":{\"name\":\"thread " << t << "\"}}";
+		first = false;
+
+		for (const auto& r : threads_[t].records)
+		{
+			file << ",\n{\"name\":\"" << name(r.loop) << "\",\"cat\":\"loop\",\"ph\":\"X\",\"pid\":0,\"tid\":" << t
+				 << ",\"ts\":" << us(r.begin) << ",\"dur\":" << (r.wait - r.begin) / 1e3 << "}";
+			file << ",\n{\"name\":\"" << name(r.loop) << " barrier\",\"cat\":\"barrier\",\"ph\":\"X\",\"pid\":0,"
+				 << "\"tid\":" << t << ",\"ts\":" << us(r.wait) << ",\"dur\":" << (r.end - r.wait) / 1e3 << "}";
+		}
+
+		dropped += threads_[t].dropped;
+	}
+
+	file << "\n],\"otherData\":{\"dropped_records\":" << dropped << "}}\n";
+}
+
+const char* mech_trace::name(trace_loop loop)
+{
+	switch (loop)
+	{
+	case trace_loop::neighbors_count:
+		return "neighbors_count";
+	case trace_loop::neighbors_fill:
+		return "neighbors_fill";
+	case trace_loop::pressure_clear:
+		return "pressure_clear";
+	case trace_loop::forces:
+		return "forces";
+	case trace_loop::forces_reverse:
+		return "forces_reverse";
+	case trace_loop::springs_detach:
+		return "springs_detach";
+	case trace_loop::springs_propose:
+		return "springs_propose";
+	case trace_loop::springs_accept:
+		return "springs_accept";
+	case trace_loop::springs_contract:
+		return "springs_contract";
+	case trace_loop::motility:
+		return "motility";
+	case trace_loop::membrane:
+		return "membrane";
+	case trace_loop::positions:
+		return "positions";
+	default:
+		return "unknown";
+	}
+}
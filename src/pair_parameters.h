@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cmath>
+#include <vector>
+
+#include <BioFVM/types.h>
+
+#include "base_potential_data.h"
+#include "mech_environment.h"
+#include "types.h"
+
+namespace micromech {
+
+// Interaction parameters of agents. They are read from the per-agent arrays, or in the type parameters mode from the
+// tables of the agent type unless the agent has an override slot. Pairs of agents using their type tables take the
+// precomputed types x types coefficients.
+struct pair_parameters
+{
+	biofvm::index_t types_count;
+	const biofvm::index_t* __restrict__ agent_types;
+
+	const mech_real_t* __restrict__ repulsion_strength;
+	const mech_real_t* __restrict__ adhesion_strength;
+	const mech_real_t* __restrict__ adhesion_affinities;
+	const mech_real_t* __restrict__ elastic_constant;
+
+	// nullptr when the type parameters are not used
+	const biofvm::index_t* __restrict__ override_slots;
+
+	const mech_real_t* __restrict__ type_repulsion_strength;
+	const mech_real_t* __restrict__ type_adhesion_strength;
+	const mech_real_t* __restrict__ type_adhesion_affinities;
+	const mech_real_t* __restrict__ type_elastic_constant;
+
+	const mech_real_t* __restrict__ override_repulsion_strength;
+	const mech_real_t* __restrict__ override_adhesion_strength;
+	const mech_real_t* __restrict__ override_adhesion_affinities;
+	const mech_real_t* __restrict__ override_elastic_constant;
+
+	const mech_real_t* __restrict__ repulsion_coefficients;
+	const mech_real_t* __restrict__ adhesion_coefficients;
+	const mech_real_t* __restrict__ spring_coefficients;
+
+	pair_parameters(const mech_agent_data& data, const base_potential_data& potential_data,
+					const std::vector<mech_real_t>& repulsion_coefficients,
+					const std::vector<mech_real_t>& adhesion_coefficients,
+					const std::vector<mech_real_t>& spring_coefficients)
+		: types_count(data.me.agent_types_count),
+		  agent_types(data.agent_type_indices.data()),
+		  repulsion_strength(potential_data.cell_cell_repulsion_strength.data()),
+		  adhesion_strength(potential_data.cell_cell_adhesion_strength.data()),
+		  adhesion_affinities(potential_data.cell_adhesion_affinities.data()),
+		  elastic_constant(potential_data.attachment_elastic_constant.data()),
+		  override_slots(potential_data.type_parameters ? potential_data.override_slots.data() : nullptr),
+		  type_repulsion_strength(potential_data.type_cell_cell_repulsion_strength.data()),
+		  type_adhesion_strength(potential_data.type_cell_cell_adhesion_strength.data()),
+		  type_adhesion_affinities(potential_data.type_cell_adhesion_affinities.data()),
+		  type_elastic_constant(potential_data.type_attachment_elastic_constant.data()),
+		  override_repulsion_strength(potential_data.override_cell_cell_repulsion_strength.data()),
+		  override_adhesion_strength(potential_data.override_cell_cell_adhesion_strength.data()),
+		  override_adhesion_affinities(potential_data.override_cell_adhesion_affinities.data()),
+		  override_elastic_constant(potential_data.override_attachment_elastic_constant.data()),
+		  repulsion_coefficients(repulsion_coefficients.data()),
+		  adhesion_coefficients(adhesion_coefficients.data()),
+		  spring_coefficients(spring_coefficients.data())
+	{}
+
+	bool from_types() const { return override_slots != nullptr; }
+
+	bool from_type(biofvm::index_t i) const { return override_slots != nullptr && override_slots[i] < 0; }
+
+	mech_real_t repulsion(biofvm::index_t i) const
+	{
+		if (!from_types())
+			return repulsion_strength[i];
+
+		return from_type(i) ? type_repulsion_strength[agent_types[i]] : override_repulsion_strength[override_slots[i]];
+	}
+
+	mech_real_t adhesion(biofvm::index_t i) const
+	{
+		if (!from_types())
+			return adhesion_strength[i];
+
+		return from_type(i) ? type_adhesion_strength[agent_types[i]] : override_adhesion_strength[override_slots[i]];
+	}
+
+	mech_real_t elastic(biofvm::index_t i) const
+	{
+		if (!from_types())
+			return elastic_constant[i];
+
+		return from_type(i) ? type_elastic_constant[agent_types[i]] : override_elastic_constant[override_slots[i]];
+	}
+
+	// affinity of the agent i to agents of other_type
+	mech_real_t affinity(biofvm::index_t i, biofvm::index_t other_type) const
+	{
+		if (!from_types())
+			return adhesion_affinities[i * types_count + other_type];
+
+		return from_type(i) ? type_adhesion_affinities[agent_types[i] * types_count + other_type]
+							: override_adhesion_affinities[override_slots[i] * types_count + other_type];
+	}
+
+	// the coefficients multiply the normalized potentials of the pair (i, j)
+
+	mech_real_t repulsion_coefficient(biofvm::index_t i, biofvm::index_t j) const
+	{
+		if (from_type(i) && from_type(j))
+			return repulsion_coefficients[agent_types[i] * types_count + agent_types[j]];
+
+		return std::sqrt(repulsion(i) * repulsion(j));
+	}
+
+	mech_real_t adhesion_coefficient(biofvm::index_t i, biofvm::index_t j) const
+	{
+		if (from_type(i) && from_type(j))
+			return adhesion_coefficients[agent_types[i] * types_count + agent_types[j]];
+
+		return std::sqrt(adhesion(i) * adhesion(j) * affinity(i, agent_types[j]) * affinity(j, agent_types[i]));
+	}
+
+	mech_real_t spring_coefficient(biofvm::index_t i, biofvm::index_t j) const
+	{
+		if (from_type(i) && from_type(j))
+			return spring_coefficients[agent_types[i] * types_count + agent_types[j]];
+
+		return std::sqrt(elastic(i) * elastic(j) * affinity(i, agent_types[j]) * affinity(j, agent_types[i]));
+	}
+};
+
+} // namespace micromech
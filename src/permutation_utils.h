@@ -0,0 +1,119 @@
+#pragma once
+
+#include <vector>
+
+#include <BioFVM/types.h>
+
+namespace micromech {
+
+// Gathered agents of the last permuted vector of each element type - the permuted values are copied back, so that
+// sorting allocates only when the agent data outgrow the buffer. The buffer belongs to the thread which encounters
+// the permutation, the taskloop tasks only access it through pointers.
+template <typename T>
+std::vector<T>& permutation_buffer()
+{
+	thread_local std::vector<T> buffer;
+	return buffer;
+}
+
+// new_data[i] = data[permutation[i]] for each agent i, where each agent owns stride consecutive elements
+template <typename T>
+void permute_vector(std::vector<T>& data, const biofvm::index_t* __restrict__ permutation,
+					biofvm::index_t agents_count, biofvm::index_t stride = 1)
+{
+	auto& buffer = permutation_buffer<T>();
+	if (buffer.size() < (std::size_t)agents_count * stride)
+		buffer.resize((std::size_t)agents_count * stride);
+
+	T* __restrict__ permuted = buffer.data();
+	T* __restrict__ values = data.data();
+
+#pragma omp taskloop
+	for (biofvm::index_t i = 0; i < agents_count; i++)
+		for (biofvm::index_t k = 0; k < stride; k++)
+			permuted[i * stride + k] = std::move(values[permutation[i] * stride + k]);
+
+#pragma omp taskloop
+	for (biofvm::index_t i = 0; i < agents_count; i++)
+		for (biofvm::index_t k = 0; k < stride; k++)
+			values[i * stride + k] = std::move(permuted[i * stride + k]);
+}
+
+// rewrites agent indices stored in per-agent ranges of a flat array (neighbors, springs, ...) to their permuted values,
+// the range of the agent i starts at offsets[i] and has counts[i] elements
+template <typename T>
+void remap_indices(std::vector<T>& indices, const biofvm::index_t* __restrict__ offsets,
+				   const biofvm::index_t* __restrict__ counts, biofvm::index_t agents_count,
+				   const biofvm::index_t* __restrict__ inverse_permutation)
+{
+	T* __restrict__ indices_data = indices.data();
+
+#pragma omp taskloop
+	for (biofvm::index_t i = 0; i < agents_count; i++)
+		for (biofvm::index_t k = offsets[i]; k < offsets[i] + counts[i]; k++)
+			indices_data[k] = inverse_permutation[indices_data[k]];
+}
+
+// the same for ranges of a fixed capacity, the range of the agent i starts at i * capacity
+template <typename T>
+void remap_indices(std::vector<T>& indices, biofvm::index_t capacity, const biofvm::index_t* __restrict__ counts,
+				   biofvm::index_t agents_count, const biofvm::index_t* __restrict__ inverse_permutation)
+{
+	T* __restrict__ indices_data = indices.data();
+
+#pragma omp taskloop
+	for (biofvm::index_t i = 0; i < agents_count; i++)
+		for (biofvm::index_t k = i * capacity; k < i * capacity + counts[i]; k++)
+			indices_data[k] = inverse_permutation[indices_data[k]];
+}
+
+// rewrites agent indices stored in per-agent ranges of a flat array to map(index), dropping those mapped to -1; the
+// kept indices stay at the beginning of their ranges in their order and counts are updated
+template <typename T, typename map_t>
+void filter_indices(std::vector<T>& indices, const biofvm::index_t* __restrict__ offsets,
+					biofvm::index_t* __restrict__ counts, biofvm::index_t agents_count, map_t map)
+{
+	T* __restrict__ indices_data = indices.data();
+
+#pragma omp taskloop
+	for (biofvm::index_t i = 0; i < agents_count; i++)
+	{
+		biofvm::index_t kept = 0;
+
+		for (biofvm::index_t k = offsets[i]; k < offsets[i] + counts[i]; k++)
+		{
+			const biofvm::index_t mapped = map(indices_data[k]);
+
+			if (mapped != -1)
+				indices_data[offsets[i] + kept++] = mapped;
+		}
+
+		counts[i] = kept;
+	}
+}
+
+// the same for ranges of a fixed capacity, the range of the agent i starts at i * capacity
+template <typename T, typename map_t>
+void filter_indices(std::vector<T>& indices, biofvm::index_t capacity, biofvm::index_t* __restrict__ counts,
+					biofvm::index_t agents_count, map_t map)
+{
+	T* __restrict__ indices_data = indices.data();
+
+#pragma omp taskloop
+	for (biofvm::index_t i = 0; i < agents_count; i++)
+	{
+		biofvm::index_t kept = 0;
+
+		for (biofvm::index_t k = i * capacity; k < i * capacity + counts[i]; k++)
+		{
+			const biofvm::index_t mapped = map(indices_data[k]);
+
+			if (mapped != -1)
+				indices_data[i * capacity + kept++] = mapped;
+		}
+
+		counts[i] = kept;
+	}
+}
+
+} // namespace micromech
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+
+namespace micromech {
+
+// Philox4x32-10 counter-based generator (Salmon et al., Parallel random numbers: as easy as 1, 2, 3)
+struct philox
+{
+	using counter_t = std::array<std::uint32_t, 4>;
+	using key_t = std::array<std::uint32_t, 2>;
+
+	static constexpr std::uint32_t multiplier_0 = 0xD2511F53;
+	static constexpr std::uint32_t multiplier_1 = 0xCD9E8D57;
+	static constexpr std::uint32_t weyl_0 = 0x9E3779B9;
+	static constexpr std::uint32_t weyl_1 = 0xBB67AE85;
+
+	static constexpr counter_t generate(counter_t counter, key_t key)
+	{
+		for (int round = 0; round < 10; round++)
+		{
+			const std::uint64_t product_0 = (std::uint64_t)multiplier_0 * counter[0];
+			const std::uint64_t product_1 = (std::uint64_t)multiplier_1 * counter[2];
+
+			counter = { (std::uint32_t)(product_1 >> 32) ^ counter[1] ^ key[0], (std::uint32_t)product_1,
+						(std::uint32_t)(product_0 >> 32) ^ counter[3] ^ key[1], (std::uint32_t)product_0 };
+
+			key[0] += weyl_0;
+			key[1] += weyl_1;
+		}
+
+		return counter;
+	}
+
+	// the same for count counters stored by words, the rounds are applied to all of them at once so they vectorize
+	static void generate(std::uint32_t* __restrict__ c0, std::uint32_t* __restrict__ c1,
+						 std::uint32_t* __restrict__ c2, std::uint32_t* __restrict__ c3, int count, key_t key)
+	{
+		for (int round = 0; round < 10; round++)
+		{
+#pragma omp simd
+			for (int l = 0; l < count; l++)
+			{
+				const std::uint64_t product_0 = (std::uint64_t)multiplier_0 * c0[l];
+				const std::uint64_t product_1 = (std::uint64_t)multiplier_1 * c2[l];
+
+				const std::uint32_t new_c0 = (std::uint32_t)(product_1 >> 32) ^ c1[l] ^ key[0];
+				const std::uint32_t new_c2 = (std::uint32_t)(product_0 >> 32) ^ c3[l] ^ key[1];
+
+				c0[l] = new_c0;
+				c1[l] = (std::uint32_t)product_1;
+				c2[l] = new_c2;
+				c3[l] = (std::uint32_t)product_0;
+			}
+
+			key[0] += weyl_0;
+			key[1] += weyl_1;
+		}
+	}
+
+	// uniform numbers from [0, 1) made of the generated bits
+	static constexpr double to_double(std::uint32_t hi, std::uint32_t lo)
+	{
+		return ((((std::uint64_t)hi << 32) | lo) >> 11) * 0x1.0p-53;
+	}
+
+	static constexpr float to_float(std::uint32_t bits) { return (bits >> 8) * 0x1.0p-24f; }
+};
+
+} // namespace micromech
@@ -13,34 +13,38 @@ struct potentials_helper
 template <>
 struct potentials_helper<1>
 {
-	static constexpr biofvm::real_t distance(const biofvm::real_t* __restrict__ lhs,
-											 const biofvm::real_t* __restrict__ rhs)
+	template <typename real_t>
+	static constexpr real_t distance(const real_t* __restrict__ lhs, const real_t* __restrict__ rhs)
 	{
 		return std::abs(lhs[0] - rhs[0]);
 	}
 
-	static constexpr biofvm::real_t difference_and_distance(const biofvm::real_t* __restrict__ lhs,
-															const biofvm::real_t* __restrict__ rhs,
-															biofvm::real_t* __restrict__ difference)
+	template <typename real_t>
+	static constexpr real_t difference_and_distance(const real_t* __restrict__ lhs, const real_t* __restrict__ rhs,
+													real_t* __restrict__ difference)
 	{
 		difference[0] = lhs[0] - rhs[0];
 
 		return std::abs(difference[0]);
 	}
 
-	static constexpr void update_velocity(biofvm::real_t* __restrict__ velocity,
-										  const biofvm::real_t* __restrict__ difference, const biofvm::real_t force)
+	template <typename real_t>
+	static constexpr void update_velocity(real_t* __restrict__ velocity, const real_t* __restrict__ difference,
+										  const real_t force)
 	{
 		velocity[0] += force * difference[0];
 	}
 
-	static constexpr void subtract(biofvm::real_t* __restrict__ dst, const biofvm::real_t* __restrict__ lhs,
-								   const biofvm::real_t* __restrict__ rhs)
+	// the difference is formed in the precision of the operands and narrowed to the precision of dst
+	template <typename dst_real_t, typename real_t>
+	static constexpr void subtract(dst_real_t* __restrict__ dst, const real_t* __restrict__ lhs,
+								   const real_t* __restrict__ rhs)
 	{
 		dst[0] = lhs[0] - rhs[0];
 	}
 
-	static constexpr void add(biofvm::real_t* __restrict__ lhs, const biofvm::real_t* __restrict__ rhs)
+	template <typename real_t>
+	static constexpr void add(real_t* __restrict__ lhs, const real_t* __restrict__ rhs)
 	{
 		lhs[0] += rhs[0];
 	}
@@ -49,15 +53,15 @@ struct potentials_helper<1>
 template <>
 struct potentials_helper<2>
 {
-	static constexpr biofvm::real_t distance(const biofvm::real_t* __restrict__ lhs,
-											 const biofvm::real_t* __restrict__ rhs)
+	template <typename real_t>
+	static constexpr real_t distance(const real_t* __restrict__ lhs, const real_t* __restrict__ rhs)
 	{
 		return std::sqrt((lhs[0] - rhs[0]) * (lhs[0] - rhs[0]) + (lhs[1] - rhs[1]) * (lhs[1] - rhs[1]));
 	}
 
-	static constexpr biofvm::real_t difference_and_distance(const biofvm::real_t* __restrict__ lhs,
-															const biofvm::real_t* __restrict__ rhs,
-															biofvm::real_t* __restrict__ difference)
+	template <typename real_t>
+	static constexpr real_t difference_and_distance(const real_t* __restrict__ lhs, const real_t* __restrict__ rhs,
+													real_t* __restrict__ difference)
 	{
 		difference[0] = lhs[0] - rhs[0];
 		difference[1] = lhs[1] - rhs[1];
@@ -65,21 +69,24 @@ struct potentials_helper<2>
 		return std::sqrt(difference[0] * difference[0] + difference[1] * difference[1]);
 	}
 
-	static constexpr void update_velocity(biofvm::real_t* __restrict__ velocity,
-										  const biofvm::real_t* __restrict__ difference, const biofvm::real_t force)
+	template <typename real_t>
+	static constexpr void update_velocity(real_t* __restrict__ velocity, const real_t* __restrict__ difference,
+										  const real_t force)
 	{
 		velocity[0] += force * difference[0];
 		velocity[1] += force * difference[1];
 	}
 
-	static constexpr void subtract(biofvm::real_t* __restrict__ dst, const biofvm::real_t* __restrict__ lhs,
-								   const biofvm::real_t* __restrict__ rhs)
+	template <typename dst_real_t, typename real_t>
+	static constexpr void subtract(dst_real_t* __restrict__ dst, const real_t* __restrict__ lhs,
+								   const real_t* __restrict__ rhs)
 	{
 		dst[0] = lhs[0] - rhs[0];
 		dst[1] = lhs[1] - rhs[1];
 	}
 
-	static constexpr void add(biofvm::real_t* __restrict__ lhs, const biofvm::real_t* __restrict__ rhs)
+	template <typename real_t>
+	static constexpr void add(real_t* __restrict__ lhs, const real_t* __restrict__ rhs)
 	{
 		lhs[0] += rhs[0];
 		lhs[1] += rhs[1];
@@ -89,16 +96,16 @@ struct potentials_helper<2>
 template <>
 struct potentials_helper<3>
 {
-	static constexpr biofvm::real_t distance(const biofvm::real_t* __restrict__ lhs,
-											 const biofvm::real_t* __restrict__ rhs)
+	template <typename real_t>
+	static constexpr real_t distance(const real_t* __restrict__ lhs, const real_t* __restrict__ rhs)
 	{
 		return std::sqrt((lhs[0] - rhs[0]) * (lhs[0] - rhs[0]) + (lhs[1] - rhs[1]) * (lhs[1] - rhs[1])
 						 + (lhs[2] - rhs[2]) * (lhs[2] - rhs[2]));
 	}
 
-	static constexpr biofvm::real_t difference_and_distance(const biofvm::real_t* __restrict__ lhs,
-															const biofvm::real_t* __restrict__ rhs,
-															biofvm::real_t* __restrict__ difference)
+	template <typename real_t>
+	static constexpr real_t difference_and_distance(const real_t* __restrict__ lhs, const real_t* __restrict__ rhs,
+													real_t* __restrict__ difference)
 	{
 		difference[0] = lhs[0] - rhs[0];
 		difference[1] = lhs[1] - rhs[1];
@@ -107,23 +114,26 @@ struct potentials_helper<3>
 		return std::sqrt(difference[0] * difference[0] + difference[1] * difference[1] + difference[2] * difference[2]);
 	}
 
-	static constexpr void update_velocity(biofvm::real_t* __restrict__ velocity,
-										  const biofvm::real_t* __restrict__ difference, const biofvm::real_t force)
+	template <typename real_t>
+	static constexpr void update_velocity(real_t* __restrict__ velocity, const real_t* __restrict__ difference,
+										  const real_t force)
 	{
 		velocity[0] += force * difference[0];
 		velocity[1] += force * difference[1];
 		velocity[2] += force * difference[2];
 	}
 
-	static constexpr void subtract(biofvm::real_t* __restrict__ dst, const biofvm::real_t* __restrict__ lhs,
-								   const biofvm::real_t* __restrict__ rhs)
+	template <typename dst_real_t, typename real_t>
+	static constexpr void subtract(dst_real_t* __restrict__ dst, const real_t* __restrict__ lhs,
+								   const real_t* __restrict__ rhs)
 	{
 		dst[0] = lhs[0] - rhs[0];
 		dst[1] = lhs[1] - rhs[1];
 		dst[2] = lhs[2] - rhs[2];
 	}
 
-	static constexpr void add(biofvm::real_t* __restrict__ lhs, const biofvm::real_t* __restrict__ rhs)
+	template <typename real_t>
+	static constexpr void add(real_t* __restrict__ lhs, const real_t* __restrict__ rhs)
 	{
 		lhs[0] += rhs[0];
 		lhs[1] += rhs[1];
@@ -1,11 +1,64 @@
 #include "random.h"
 
-#include <omp.h>
-#include <random>
+#include <algorithm>
+#include <cmath>
+#include <numbers>
+
+#ifdef _OPENMP
+	#include <omp.h>
+#endif
+
+#include "philox.h"
+#include "target_clones.h"
 
 using namespace biofvm;
+using micromech::philox;
+
+// a block of the generator yields 2 doubles or 4 floats
+constexpr index_t numbers_per_block = sizeof(real_t) == sizeof(float) ? 4 : 2;
+
+static constexpr real_t block_number(const philox::counter_t& bits, index_t k)
+{
+	if constexpr (sizeof(real_t) == sizeof(float))
+		return philox::to_float(bits[k]);
+	else
+		return philox::to_double(bits[2 * k], bits[2 * k + 1]);
+}
+
+static constexpr philox::counter_t make_counter(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+												std::uint64_t block)
+{
+	return { (std::uint32_t)block, stream, (std::uint32_t)agent, (std::uint32_t)step };
+}
+
+static constexpr philox::key_t make_key(std::uint64_t seed)
+{
+	return { (std::uint32_t)seed, (std::uint32_t)(seed >> 32) };
+}
+
+namespace {
+
+// the stateful numbers use the thread number as the agent key and the last stream
+struct thread_state
+{
+	std::uint64_t epoch = ~0ULL;
+	std::uint64_t block = 0;
+	index_t used = numbers_per_block;
+	philox::counter_t bits;
+};
 
-thread_local std::mt19937 generator;
+} // namespace
+
+static thread_local thread_state state;
+
+static std::uint64_t thread_number()
+{
+#ifdef _OPENMP
+	return omp_get_thread_num();
+#else
+	return 0;
+#endif
+}
 
 micromech::random& micromech::random::instance()
 {
@@ -15,35 +68,122 @@ micromech::random& micromech::random::instance()
 
 real_t micromech::random::uniform(const real_t min, const real_t max)
 {
-	std::uniform_real_distribution<real_t> distribution(min, max);
-	return distribution(generator);
+	if (state.epoch != epoch_)
+	{
+		state = thread_state();
+		state.epoch = epoch_;
+	}
+
+	if (state.used == numbers_per_block)
+	{
+		state.bits = philox::generate(make_counter(0, thread_number(), ~0U, state.block++), make_key(seed_));
+		state.used = 0;
+	}
+
+	return min + (max - min) * block_number(state.bits, state.used++);
 }
 
 real_t micromech::random::normal(const real_t mean, const real_t std)
 {
-	std::normal_distribution<real_t> distribution(mean, std);
-	return distribution(generator);
+	const real_t u1 = 1 - uniform();
+	const real_t u2 = uniform();
+
+	return mean + std * std::sqrt(-2 * std::log(u1)) * std::cos(2 * std::numbers::pi_v<real_t> * u2);
 }
 
-void micromech::random::set_seed(unsigned int seed)
+real_t micromech::random::keyed_uniform(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+										std::uint64_t counter)
 {
-#ifdef _OPENMP
-	std::vector<unsigned int> initial_sequence(omp_get_num_threads());
+	return block_number(philox::generate(make_counter(step, agent, stream, counter), make_key(seed_)), 0);
+}
 
-	for (int i = 0; i < omp_get_num_threads(); i++)
-		initial_sequence[i] = seed + i;
+void micromech::random::keyed_uniform(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+									  real_t* __restrict__ numbers, index_t count)
+{
+	const philox::key_t key = make_key(seed_);
 
-	std::seed_seq seq(initial_sequence.begin(), initial_sequence.end());
+	for (index_t block = 0; block * numbers_per_block < count; block++)
+	{
+		const auto bits = philox::generate(make_counter(step, agent, stream, block), key);
 
-	std::vector<unsigned int> seeds(omp_get_num_threads());
-	seq.generate(seeds.begin(), seeds.end());
+		for (index_t k = 0; k < numbers_per_block && block * numbers_per_block + k < count; k++)
+			numbers[block * numbers_per_block + k] = block_number(bits, k);
+	}
+}
 
-	#pragma omp parallel
+void micromech::random::keyed_normal(std::uint64_t step, std::uint64_t agent, std::uint32_t stream,
+									 real_t* __restrict__ numbers, index_t count)
+{
+	keyed_uniform(step, agent, stream, numbers, count);
+
+	// Box-Muller transform of consecutive pairs, an odd last number gets a fresh pair
+	for (index_t k = 0; k + 1 < count; k += 2)
 	{
-		int id = omp_get_thread_num();
-		generator.seed(seeds[id]);
+		const real_t radius = std::sqrt(-2 * std::log(1 - numbers[k]));
+		const real_t angle = 2 * std::numbers::pi_v<real_t> * numbers[k + 1];
+
+		numbers[k] = radius * std::cos(angle);
+		numbers[k + 1] = radius * std::sin(angle);
 	}
-#else
-	generator.seed(seed);
-#endif
+
+	if (count % 2 == 1)
+	{
+		const real_t u1 = keyed_uniform(step, agent, stream, (count + numbers_per_block - 1) / numbers_per_block);
+		const real_t u2 = numbers[count - 1];
+
+		numbers[count - 1] = std::sqrt(-2 * std::log(1 - u1)) * std::cos(2 * std::numbers::pi_v<real_t> * u2);
+	}
+}
+
+// agents are first_agent + i, or agents[i] when agents are given; per_agent numbers of the first block are stored
+MICROMECH_TARGET_CLONES static void generate_per_agent(std::uint64_t step, std::uint64_t first_agent,
+													   const index_t* __restrict__ agents, std::uint32_t stream,
+													   philox::key_t key, real_t* __restrict__ numbers, index_t count,
+													   index_t per_agent)
+{
+	constexpr index_t lanes = 64;
+
+	for (index_t begin = 0; begin < count; begin += lanes)
+	{
+		const index_t lanes_count = std::min(lanes, count - begin);
+
+		std::uint32_t c0[lanes], c1[lanes], c2[lanes], c3[lanes];
+
+		for (index_t l = 0; l < lanes_count; l++)
+		{
+			const std::uint64_t agent = agents != nullptr ? agents[begin + l] : first_agent + begin + l;
+			const auto counter = make_counter(step, agent, stream, 0);
+			c0[l] = counter[0];
+			c1[l] = counter[1];
+			c2[l] = counter[2];
+			c3[l] = counter[3];
+		}
+
+		philox::generate(c0, c1, c2, c3, lanes_count, key);
+
+		for (index_t l = 0; l < lanes_count; l++)
+			for (index_t k = 0; k < per_agent; k++)
+				numbers[(begin + l) * per_agent + k] = block_number({ c0[l], c1[l], c2[l], c3[l] }, k);
+	}
+}
+
+void micromech::random::keyed_uniform_per_agent(std::uint64_t step, std::uint64_t first_agent,
+												std::uint32_t stream, real_t* __restrict__ numbers, index_t count)
+{
+	generate_per_agent(step, first_agent, nullptr, stream, make_key(seed_), numbers, count, 1);
 }
+
+void micromech::random::keyed_uniform_for_agents(std::uint64_t step, const index_t* __restrict__ agents,
+												 std::uint32_t stream, real_t* __restrict__ numbers, index_t count,
+												 index_t per_agent)
+{
+	generate_per_agent(step, 0, agents, stream, make_key(seed_), numbers, count, per_agent);
+}
+
+void micromech::random::set_seed(unsigned int seed)
+{
+	seed_ = seed;
+	epoch_++;
+}
+
+std::uint64_t micromech::random::seed() const { return seed_; }
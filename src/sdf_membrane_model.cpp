@@ -0,0 +1,142 @@
+#include "sdf_membrane_model.h"
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include <base_membrane_data.h>
+
+#include "mech_environment.h"
+#include "mech_trace.h"
+
+using namespace micromech;
+using namespace biofvm;
+
+// iterates the listed agents, the movable ones or those in the boundary band
+template <index_t dims>
+void update_sdf_membrane_interactions_internal(index_t agents_count, const index_t* __restrict__ agents,
+											   mech_real_t* __restrict__ velocity, const real_t* __restrict__ position,
+											   const mech_real_t* __restrict__ radius,
+											   const mech_real_t* __restrict__ cell_BM_repulsion_strength,
+											   const signed_distance_field& field)
+{
+	mech_trace::instance().begin(trace_loop::membrane);
+
+#pragma omp for nowait
+	for (index_t k = 0; k < agents_count; k++)
+	{
+		const index_t i = agents[k];
+
+		real_t gradient[dims];
+		const real_t signed_distance = field.lookup<dims>(position + i * dims, gradient);
+
+		// as from a wall, an agent behind the membrane is pushed back into the field
+		const mech_real_t distance = std::max<mech_real_t>(std::abs(signed_distance), 0.00001);
+
+		if (distance >= radius[i])
+			continue;
+
+		real_t length = 0;
+		for (index_t d = 0; d < dims; d++)
+			length += gradient[d] * gradient[d];
+
+		if (length == 0)
+			continue;
+
+		length = std::sqrt(length);
+
+		mech_real_t repulsion = 1 - distance / radius[i];
+		repulsion *= repulsion * cell_BM_repulsion_strength[i];
+
+		for (index_t d = 0; d < dims; d++)
+			velocity[i * dims + d] += repulsion * distance * (mech_real_t)(gradient[d] / length);
+	}
+
+	mech_trace::instance().barrier(trace_loop::membrane);
+}
+
+// Voxels whose agents may be closer to a membrane than a voxel size, also after they moved by a voxel - those with
+// the distance of the center less than two voxel sizes and a half of the diagonal
+template <index_t dims>
+static std::vector<index_t> collect_band_slots(const signed_distance_field& field,
+											   const grid_space_partitioner& partitioner)
+{
+	const auto& mesh = partitioner.mesh();
+
+	real_t voxel_size = 0, diagonal = 0;
+	for (index_t d = 0; d < dims; d++)
+	{
+		voxel_size = std::max<real_t>(voxel_size, mesh.voxel_shape[d]);
+		diagonal += (real_t)mesh.voxel_shape[d] * mesh.voxel_shape[d];
+	}
+
+	const real_t band_width = 2 * voxel_size + std::sqrt(diagonal) / 2;
+
+	std::vector<index_t> slots;
+	for (index_t z = 0; z < mesh.grid_shape[2]; z++)
+		for (index_t y = 0; y < mesh.grid_shape[1]; y++)
+			for (index_t x = 0; x < mesh.grid_shape[0]; x++)
+			{
+				const point_t<index_t, 3> voxel = { x, y, z };
+
+				real_t center[dims], gradient[dims];
+				for (index_t d = 0; d < dims; d++)
+					center[d] = mesh.bounding_box_mins[d] + (voxel[d] + (real_t)0.5) * mesh.voxel_shape[d];
+
+				if (std::abs(field.lookup<dims>(center, gradient)) < band_width)
+					slots.push_back(partitioner.voxel_slot(voxel));
+			}
+
+	return slots;
+}
+
+template <index_t dims>
+void sdf_membrane_model::compute_basement_membrane_interactions(mech_environment& me)
+{
+	auto& data = me.agent_data;
+	auto& membrane_data = static_cast<base_membrane_data&>(*data.membrane_data.get());
+
+	const auto agents = band_.agents(data);
+
+	update_sdf_membrane_interactions_internal<dims>(agents.size(), agents.data(), data.velocity.data(),
+													data.bio_agent_data.positions.data(), data.radius.data(),
+													membrane_data.cell_BM_repulsion_strength.data(), field_);
+}
+
+void sdf_membrane_model::compute_basement_membrane_interactions(mech_environment& me)
+{
+	if (me.m.mesh.dims == 1)
+		compute_basement_membrane_interactions<1>(me);
+	else if (me.m.mesh.dims == 2)
+		compute_basement_membrane_interactions<2>(me);
+	else if (me.m.mesh.dims == 3)
+		compute_basement_membrane_interactions<3>(me);
+}
+
+template void sdf_membrane_model::compute_basement_membrane_interactions<1>(mech_environment& me);
+template void sdf_membrane_model::compute_basement_membrane_interactions<2>(mech_environment& me);
+template void sdf_membrane_model::compute_basement_membrane_interactions<3>(mech_environment& me);
+
+sdf_membrane_model::sdf_membrane_model(mech_environment& me, signed_distance_field field)
+	: field_(std::move(field))
+{
+	if (field_.dims() != me.m.mesh.dims)
+		throw std::invalid_argument("sdf_membrane_model requires a field of the dims of the environment");
+
+	if (dynamic_cast<base_membrane_data*>(me.agent_data.membrane_data.get()) == nullptr)
+	{
+		me.agent_data.membrane_data = std::make_unique<base_membrane_data>(me);
+	}
+}
+
+sdf_membrane_model::sdf_membrane_model(mech_environment& me, signed_distance_field field,
+									   grid_space_partitioner& partitioner)
+	: sdf_membrane_model(me, std::move(field))
+{
+	if (field_.dims() == 1)
+		band_ = boundary_band(partitioner, collect_band_slots<1>(field_, partitioner));
+	else if (field_.dims() == 2)
+		band_ = boundary_band(partitioner, collect_band_slots<2>(field_, partitioner));
+	else
+		band_ = boundary_band(partitioner, collect_band_slots<3>(field_, partitioner));
+}
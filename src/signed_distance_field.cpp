@@ -0,0 +1,256 @@
+#include "signed_distance_field.h"
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <stdexcept>
+
+using namespace biofvm;
+using namespace micromech;
+
+constexpr char sdf_magic[8] = { 'M', 'M', 'S', 'D', 'F', 0, 0, 0 };
+constexpr std::uint32_t sdf_version = 1;
+
+// file format local to this translation unit
+namespace {
+
+// followed by the distances and, if has_gradients, by dims gradient components per node
+struct file_header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t dims;
+	std::uint64_t shape[3];
+	double origin[3];
+	double spacing;
+	std::uint32_t has_gradients;
+	std::uint32_t reserved;
+};
+
+} // namespace
+
+static real_t primitive_distance(const sdf_primitive& primitive, const point_t<real_t, 3>& position, index_t dims)
+{
+	real_t distance = 0;
+
+	switch (primitive.shape)
+	{
+	case sdf_primitive::shape_t::sphere:
+	{
+		real_t length = 0;
+		for (index_t d = 0; d < dims; d++)
+			length += (position[d] - primitive.a[d]) * (position[d] - primitive.a[d]);
+
+		distance = std::sqrt(length) - primitive.radius;
+		break;
+	}
+	case sdf_primitive::shape_t::capsule:
+	{
+		real_t along = 0, segment_length = 0;
+		for (index_t d = 0; d < dims; d++)
+		{
+			along += (position[d] - primitive.a[d]) * (primitive.b[d] - primitive.a[d]);
+			segment_length += (primitive.b[d] - primitive.a[d]) * (primitive.b[d] - primitive.a[d]);
+		}
+
+		const real_t t = segment_length > 0 ? std::clamp<real_t>(along / segment_length, 0, 1) : 0;
+
+		real_t length = 0;
+		for (index_t d = 0; d < dims; d++)
+		{
+			const real_t closest = primitive.a[d] + t * (primitive.b[d] - primitive.a[d]);
+			length += (position[d] - closest) * (position[d] - closest);
+		}
+
+		distance = std::sqrt(length) - primitive.radius;
+		break;
+	}
+	case sdf_primitive::shape_t::box:
+	{
+		real_t outside = 0, inside = -std::numeric_limits<real_t>::max();
+		for (index_t d = 0; d < dims; d++)
+		{
+			const real_t center = (primitive.a[d] + primitive.b[d]) / 2;
+			const real_t half = std::abs(primitive.b[d] - primitive.a[d]) / 2;
+			const real_t q = std::abs(position[d] - center) - half;
+
+			outside += q > 0 ? q * q : 0;
+			inside = std::max(inside, q);
+		}
+
+		distance = std::sqrt(outside) + std::min<real_t>(inside, 0);
+		break;
+	}
+	}
+
+	// positive in the region of the agents
+	return primitive.inside ? -distance : distance;
+}
+
+signed_distance_field::signed_distance_field(index_t dims, point_t<index_t, 3> shape, point_t<real_t, 3> origin,
+											 real_t spacing, std::vector<real_t> distances,
+											 std::vector<real_t> gradients)
+	: dims_(dims),
+	  shape_(shape),
+	  origin_(origin),
+	  spacing_(spacing),
+	  distances_(std::move(distances)),
+	  gradients_(std::move(gradients))
+{
+	if (dims_ < 1 || dims_ > 3 || !(spacing_ > 0))
+		throw std::invalid_argument("signed_distance_field requires 1 to 3 dims and a positive spacing");
+
+	// interpolation needs a cell in each used dim
+	for (index_t d = 0; d < 3; d++)
+		if (d < dims_ ? shape_[d] < 2 : shape_[d] != 1)
+			throw std::invalid_argument("signed_distance_field shape does not match its dims");
+
+	strides_ = { 1, shape_[0], shape_[0] * shape_[1] };
+
+	const std::size_t nodes_count = (std::size_t)shape_[0] * shape_[1] * shape_[2];
+
+	if (distances_.size() != nodes_count || (!gradients_.empty() && gradients_.size() != nodes_count * dims_))
+		throw std::invalid_argument("signed_distance_field sizes do not match its shape");
+
+	if (gradients_.empty())
+		compute_gradients();
+}
+
+void signed_distance_field::compute_gradients()
+{
+	gradients_.resize(distances_.size() * dims_);
+
+#pragma omp parallel for
+	for (index_t z = 0; z < shape_[2]; z++)
+		for (index_t y = 0; y < shape_[1]; y++)
+			for (index_t x = 0; x < shape_[0]; x++)
+			{
+				const point_t<index_t, 3> node = { x, y, z };
+				const index_t index = x * strides_[0] + y * strides_[1] + z * strides_[2];
+
+				// central differences inside, one-sided on the sides of the grid
+				for (index_t d = 0; d < dims_; d++)
+				{
+					const index_t lower = node[d] > 0 ? index - strides_[d] : index;
+					const index_t upper = node[d] < shape_[d] - 1 ? index + strides_[d] : index;
+					const index_t steps = (node[d] > 0) + (node[d] < shape_[d] - 1);
+
+					gradients_[index * dims_ + d] = (distances_[upper] - distances_[lower]) / (steps * spacing_);
+				}
+			}
+}
+
+signed_distance_field signed_distance_field::from_primitives(const cartesian_mesh& mesh, real_t spacing,
+															 const std::vector<sdf_primitive>& primitives)
+{
+	if (primitives.empty() || !(spacing > 0))
+		throw std::invalid_argument("signed_distance_field requires primitives and a positive spacing");
+
+	const index_t dims = mesh.dims;
+
+	point_t<index_t, 3> shape = { 1, 1, 1 };
+	point_t<real_t, 3> origin = { 0, 0, 0 };
+
+	for (index_t d = 0; d < dims; d++)
+	{
+		origin[d] = mesh.bounding_box_mins[d];
+		shape[d] = std::max<index_t>(
+			2, (index_t)std::ceil((mesh.bounding_box_maxs[d] - mesh.bounding_box_mins[d]) / spacing) + 1);
+	}
+
+	std::vector<real_t> distances((std::size_t)shape[0] * shape[1] * shape[2]);
+
+#pragma omp parallel for
+	for (index_t z = 0; z < shape[2]; z++)
+		for (index_t y = 0; y < shape[1]; y++)
+			for (index_t x = 0; x < shape[0]; x++)
+			{
+				const point_t<real_t, 3> position = { origin[0] + x * spacing, origin[1] + y * spacing,
+													  origin[2] + z * spacing };
+
+				real_t distance = primitive_distance(primitives[0], position, dims);
+				for (std::size_t p = 1; p < primitives.size(); p++)
+				{
+					const real_t primitive = primitive_distance(primitives[p], position, dims);
+
+					if (primitives[p].combine == sdf_primitive::combine_t::intersect)
+						distance = std::min(distance, primitive);
+					else if (primitives[p].combine == sdf_primitive::combine_t::unite)
+						distance = std::max(distance, primitive);
+					else
+						distance = std::min(distance, -primitive);
+				}
+
+				distances[x + y * shape[0] + z * shape[0] * shape[1]] = distance;
+			}
+
+	return signed_distance_field(dims, shape, origin, spacing, std::move(distances));
+}
+
+signed_distance_field signed_distance_field::load(const std::string& path)
+{
+	std::ifstream file(path, std::ios::binary);
+	if (!file)
+		throw std::runtime_error("signed_distance_field can not be read from " + path);
+
+	file_header header;
+	file.read((char*)&header, sizeof(file_header));
+
+	if (!file || std::memcmp(header.magic, sdf_magic, sizeof(sdf_magic)) != 0 || header.version != sdf_version
+		|| header.dims < 1 || header.dims > 3)
+		throw std::runtime_error("signed_distance_field " + path + " is not a distance field");
+
+	const std::size_t nodes_count = header.shape[0] * header.shape[1] * header.shape[2];
+
+	std::vector<double> values(nodes_count * (header.has_gradients ? header.dims + 1 : 1));
+	file.read((char*)values.data(), values.size() * sizeof(double));
+
+	if (!file)
+		throw std::runtime_error("signed_distance_field " + path + " is truncated");
+
+	std::vector<real_t> distances(values.begin(), values.begin() + nodes_count);
+	std::vector<real_t> gradients(values.begin() + nodes_count, values.end());
+
+	try
+	{
+		return signed_distance_field(header.dims,
+									 { (index_t)header.shape[0], (index_t)header.shape[1], (index_t)header.shape[2] },
+									 { (real_t)header.origin[0], (real_t)header.origin[1], (real_t)header.origin[2] },
+									 header.spacing, std::move(distances), std::move(gradients));
+	}
+	catch (const std::invalid_argument& e)
+	{
+		throw std::runtime_error("signed_distance_field " + path + " is not a distance field: " + e.what());
+	}
+}
+
+void signed_distance_field::save(const std::string& path) const
+{
+	std::ofstream file(path, std::ios::binary | std::ios::trunc);
+	if (!file)
+		throw std::runtime_error("signed_distance_field can not be written to " + path);
+
+	file_header header {};
+	std::memcpy(header.magic, sdf_magic, sizeof(sdf_magic));
+	header.version = sdf_version;
+	header.dims = dims_;
+	header.spacing = spacing_;
+	header.has_gradients = 1;
+
+	for (index_t d = 0; d < 3; d++)
+	{
+		header.shape[d] = shape_[d];
+		header.origin[d] = origin_[d];
+	}
+
+	std::vector<double> values(distances_.begin(), distances_.end());
+	values.insert(values.end(), gradients_.begin(), gradients_.end());
+
+	file.write((const char*)&header, sizeof(file_header));
+	file.write((const char*)values.data(), values.size() * sizeof(double));
+
+	if (!file)
+		throw std::runtime_error("signed_distance_field can not be written to " + path);
+}
@@ -0,0 +1,17 @@
+#pragma once
+
+// Compiles the function for several instruction sets and lets the loader pick the best one the CPU supports
+#if defined(MICROMECH_TARGET_CLONES_ENABLED) && defined(__GNUC__) && defined(__x86_64__) && !defined(__clang__)
+	#define MICROMECH_TARGET_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+	#define MICROMECH_TARGET_CLONES
+#endif
+
+// Helpers of the cloned functions are inlined into each clone, so they are compiled for its instruction set too
+#if defined(__GNUC__)
+	#define MICROMECH_FORCE_INLINE inline __attribute__((always_inline))
+#elif defined(_MSC_VER)
+	#define MICROMECH_FORCE_INLINE __forceinline
+#else
+	#define MICROMECH_FORCE_INLINE inline
+#endif
@@ -0,0 +1,395 @@
+#include "trajectory_writer.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "base_potential_data.h"
+#include "mech_environment.h"
+
+using namespace biofvm;
+using namespace micromech;
+
+constexpr char trajectory_magic[8] = { 'M', 'M', 'T', 'R', 'A', 'J', 0, 0 };
+constexpr char frame_magic[4] = { 'M', 'M', 'F', 'R' };
+constexpr std::uint32_t trajectory_version = 1;
+
+// file formats local to this translation unit
+namespace {
+
+enum field_encoding : std::uint32_t
+{
+	// values as they are stored in the agent data
+	raw_encoding = 0,
+	// quantized or integer values as zigzag variable-length integers
+	varint_encoding,
+	// the same, differences from the previous frame
+	delta_varint_encoding
+};
+
+struct file_header
+{
+	char magic[8];
+	std::uint32_t version;
+	std::uint32_t dims;
+	std::uint32_t fields;
+	std::uint32_t delta;
+	double quantum;
+	std::uint32_t real_size;
+	std::uint32_t mech_real_size;
+	std::uint32_t index_size;
+	std::uint32_t reserved;
+};
+
+struct frame_header
+{
+	char magic[4];
+	std::uint32_t keyframe;
+	std::uint64_t step;
+	std::uint64_t agents_count;
+	// of the fields following the header
+	std::uint64_t bytes;
+};
+
+// followed by chunks_count chunks, each as its encoded size in a std::uint64_t and its bytes
+struct field_header
+{
+	std::uint32_t field;
+	std::uint32_t encoding;
+	std::uint32_t components;
+	std::uint32_t chunks_count;
+};
+
+} // namespace
+
+static std::int64_t now_ns()
+{
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+			   std::chrono::steady_clock::now().time_since_epoch())
+		.count();
+}
+
+template <typename T>
+static void append(std::vector<char>& bytes, const T& value)
+{
+	const std::size_t size = bytes.size();
+	bytes.resize(size + sizeof(T));
+	std::memcpy(bytes.data() + size, &value, sizeof(T));
+}
+
+static void append_varint(std::vector<char>& bytes, std::int64_t value)
+{
+	// zigzag keeps small negative differences short
+	std::uint64_t zigzag = ((std::uint64_t)value << 1) ^ (std::uint64_t)(value >> 63);
+
+	while (zigzag >= 0x80)
+	{
+		bytes.push_back((char)(zigzag | 0x80));
+		zigzag >>= 7;
+	}
+	bytes.push_back((char)zigzag);
+}
+
+trajectory_writer::trajectory_writer(const std::string& path, mech_environment& me, trajectory_options options)
+	: me_(me),
+	  potential_data_(dynamic_cast<base_potential_data*>(me.agent_data.potential_data.get())),
+	  options_(options),
+	  current_(0),
+	  closing_(false),
+	  frames_encoded_(0),
+	  previous_agents_count_(-1),
+	  frames_written_(0),
+	  bytes_written_(0),
+	  write_ns_(0),
+	  failed_(false),
+	  frames_reported_(0),
+	  bytes_reported_(0),
+	  write_ns_reported_(0)
+{
+	if ((options_.fields & (trajectory_simple_pressure | trajectory_springs_counts)) && potential_data_ == nullptr)
+		throw std::invalid_argument("trajectory_writer requires base_potential_data for pressure and springs");
+
+	if (options_.buffers_count < 1 || options_.chunk_agents < 1 || options_.keyframe_interval < 1
+		|| options_.quantum < 0)
+		throw std::invalid_argument("trajectory_writer options are out of range");
+
+	file_.open(path, std::ios::binary | std::ios::trunc);
+	if (!file_)
+		throw std::runtime_error("trajectory_writer can not write " + path);
+
+	file_header header {};
+	std::memcpy(header.magic, trajectory_magic, sizeof(trajectory_magic));
+	header.version = trajectory_version;
+	header.dims = me.m.mesh.dims;
+	header.fields = options_.fields;
+	header.delta = options_.delta;
+	header.quantum = options_.quantum;
+	header.real_size = sizeof(real_t);
+	header.mech_real_size = sizeof(mech_real_t);
+	header.index_size = sizeof(index_t);
+
+	file_.write((const char*)&header, sizeof(file_header));
+
+	buffers_.resize(options_.buffers_count);
+	for (std::size_t b = 0; b < buffers_.size(); b++)
+		free_.push_back(b);
+
+	thread_ = std::thread([this] { write_frames(); });
+}
+
+trajectory_writer::~trajectory_writer()
+{
+	try
+	{
+		close();
+	}
+	catch (const std::exception&)
+	{
+		// the failure is reported only by an explicit close
+	}
+}
+
+void trajectory_writer::capture(std::uint64_t step)
+{
+	me_.metrics.begin_phase(mech_phase::output);
+
+#pragma omp single
+	{
+		const std::int64_t wait_begin = now_ns();
+
+		{
+			std::unique_lock lock(mutex_);
+			changed_.wait(lock, [this] { return !free_.empty(); });
+
+			current_ = free_.front();
+			free_.pop_front();
+		}
+
+		me_.metrics.add(mech_counter::output_stall_ns, now_ns() - wait_begin);
+
+		// the counters of the background thread are reported by the steps, the frames written since the last capture
+		const std::uint64_t frames = frames_written_, bytes = bytes_written_, write_ns = write_ns_;
+		me_.metrics.add(mech_counter::output_frames, frames - frames_reported_);
+		me_.metrics.add(mech_counter::output_bytes, bytes - bytes_reported_);
+		me_.metrics.add(mech_counter::output_write_ns, write_ns - write_ns_reported_);
+		frames_reported_ = frames;
+		bytes_reported_ = bytes;
+		write_ns_reported_ = write_ns;
+
+		auto& frame = buffers_[current_];
+		const index_t agents_count = me_.agent_data.agents_count();
+		const index_t dims = me_.m.mesh.dims;
+
+		frame.step = step;
+		frame.agents_count = agents_count;
+
+		if (options_.fields & trajectory_positions)
+			frame.positions.resize(agents_count * dims);
+		if (options_.fields & trajectory_simple_pressure)
+			frame.simple_pressure.resize(agents_count);
+		if (options_.fields & trajectory_velocity)
+			frame.velocity.resize(agents_count * dims);
+		if (options_.fields & trajectory_agent_type)
+			frame.agent_type.resize(agents_count);
+		if (options_.fields & trajectory_springs_counts)
+			frame.springs_counts.resize(agents_count);
+	}
+
+	auto& frame = buffers_[current_];
+	const auto& data = me_.agent_data;
+	const index_t dims = me_.m.mesh.dims;
+	const std::uint32_t fields = options_.fields;
+
+#pragma omp for
+	for (index_t i = 0; i < frame.agents_count; i++)
+	{
+		if (fields & trajectory_positions)
+			for (index_t d = 0; d < dims; d++)
+				frame.positions[i * dims + d] = data.bio_agent_data.positions[i * dims + d];
+
+		if (fields & trajectory_simple_pressure)
+			frame.simple_pressure[i] = potential_data_->simple_pressure[i];
+
+		if (fields & trajectory_velocity)
+			for (index_t d = 0; d < dims; d++)
+				frame.velocity[i * dims + d] = data.velocity[i * dims + d];
+
+		if (fields & trajectory_agent_type)
+			frame.agent_type[i] = data.agent_type_indices[i];
+
+		if (fields & trajectory_springs_counts)
+			frame.springs_counts[i] = potential_data_->springs_counts[i];
+	}
+
+#pragma omp single
+	{
+		std::lock_guard lock(mutex_);
+		filled_.push_back(current_);
+		changed_.notify_all();
+	}
+
+	me_.metrics.end_phase(mech_phase::output);
+}
+
+void trajectory_writer::close()
+{
+	if (!thread_.joinable())
+		return;
+
+	{
+		std::lock_guard lock(mutex_);
+		closing_ = true;
+		changed_.notify_all();
+	}
+
+	thread_.join();
+	file_.close();
+
+	if (failed_ || file_.fail())
+		throw std::runtime_error("trajectory_writer failed to write the trajectory");
+}
+
+void trajectory_writer::write_frames()
+{
+	while (true)
+	{
+		std::size_t buffer;
+
+		{
+			std::unique_lock lock(mutex_);
+			changed_.wait(lock, [this] { return !filled_.empty() || closing_; });
+
+			if (filled_.empty())
+				return;
+
+			buffer = filled_.front();
+			filled_.pop_front();
+		}
+
+		// after a failure the frames are only released, so capture never waits for a stopped writer
+		if (!failed_)
+		{
+			const std::int64_t begin = now_ns();
+
+			encode(buffers_[buffer]);
+			file_.write(encoded_.data(), encoded_.size());
+
+			if (!file_)
+				failed_ = true;
+
+			write_ns_ += now_ns() - begin;
+			bytes_written_ += encoded_.size();
+			frames_written_++;
+		}
+
+		{
+			std::lock_guard lock(mutex_);
+			free_.push_back(buffer);
+			changed_.notify_all();
+		}
+	}
+}
+
+void trajectory_writer::encode(const frame_buffer& frame)
+{
+	const index_t dims = me_.m.mesh.dims;
+	const bool keyframe = !options_.delta || frame.agents_count != previous_agents_count_
+						  || frames_encoded_ % options_.keyframe_interval == 0;
+
+	encoded_.clear();
+
+	frame_header header;
+	std::memcpy(header.magic, frame_magic, sizeof(frame_magic));
+	header.keyframe = keyframe;
+	header.step = frame.step;
+	header.agents_count = frame.agents_count;
+	header.bytes = 0;
+	append(encoded_, header);
+
+	if (options_.fields & trajectory_positions)
+		encode_field(0, frame.positions.data(), dims, frame.agents_count, keyframe);
+	if (options_.fields & trajectory_simple_pressure)
+		encode_field(1, frame.simple_pressure.data(), 1, frame.agents_count, keyframe);
+	if (options_.fields & trajectory_velocity)
+		encode_field(2, frame.velocity.data(), dims, frame.agents_count, keyframe);
+	if (options_.fields & trajectory_agent_type)
+		encode_field(3, frame.agent_type.data(), 1, frame.agents_count, keyframe);
+	if (options_.fields & trajectory_springs_counts)
+		encode_field(4, frame.springs_counts.data(), 1, frame.agents_count, keyframe);
+
+	header.bytes = encoded_.size() - sizeof(frame_header);
+	std::memcpy(encoded_.data(), &header, sizeof(frame_header));
+
+	previous_agents_count_ = frame.agents_count;
+	frames_encoded_++;
+}
+
+template <typename T>
+void trajectory_writer::encode_field(std::size_t field_index, const T* values, index_t components,
+									 index_t agents_count, bool keyframe)
+{
+	constexpr bool real_field = std::is_floating_point_v<T>;
+
+	// real fields are integers once quantized, integer fields are always exact
+	const bool integral = !real_field || options_.quantum > 0;
+
+	std::uint32_t encoding = raw_encoding;
+	if (integral && options_.delta)
+		encoding = keyframe ? varint_encoding : delta_varint_encoding;
+	else if (real_field && options_.quantum > 0)
+		encoding = varint_encoding;
+
+	const std::size_t count = (std::size_t)agents_count * components;
+	const std::size_t chunk_values = (std::size_t)options_.chunk_agents * components;
+
+	field_header header;
+	header.field = 1u << field_index;
+	header.encoding = encoding;
+	header.components = components;
+	header.chunks_count = (count + chunk_values - 1) / chunk_values;
+	append(encoded_, header);
+
+	auto& previous = previous_values_[field_index];
+	if (encoding != raw_encoding && options_.delta)
+		previous.resize(count);
+
+	for (std::size_t begin = 0; begin < count; begin += chunk_values)
+	{
+		const std::size_t end = std::min(count, begin + chunk_values);
+
+		const std::size_t size_offset = encoded_.size();
+		append(encoded_, std::uint64_t(0));
+
+		if (encoding == raw_encoding)
+		{
+			const std::size_t offset = encoded_.size();
+			encoded_.resize(offset + (end - begin) * sizeof(T));
+			std::memcpy(encoded_.data() + offset, values + begin, (end - begin) * sizeof(T));
+		}
+		else
+		{
+			for (std::size_t k = begin; k < end; k++)
+			{
+				std::int64_t value;
+				if constexpr (real_field)
+					value = std::llround(values[k] / options_.quantum);
+				else
+					value = values[k];
+
+				if (encoding == delta_varint_encoding)
+					append_varint(encoded_, value - previous[k]);
+				else
+					append_varint(encoded_, value);
+
+				if (options_.delta)
+					previous[k] = value;
+			}
+		}
+
+		const std::uint64_t chunk_bytes = encoded_.size() - size_offset - sizeof(std::uint64_t);
+		std::memcpy(encoded_.data() + size_offset, &chunk_bytes, sizeof(std::uint64_t));
+	}
+}
@@ -0,0 +1,97 @@
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <BioFVM/microenvironment.h>
+
+#include "active_set.h"
+#include "base_motility_data.h"
+#include "mech_environment.h"
+
+using namespace biofvm;
+using namespace micromech;
+
+// Changes is_movable and is_motile of existing agents in place, without invalidate_active_sets, and requires the
+// active sets to follow the flags and the active sets version to be incremented.
+
+constexpr index_t agents_count = 1000;
+
+bool check(const active_set& set, const std::vector<std::uint8_t>& flags, const std::string& name)
+{
+	std::vector<index_t> expected;
+	for (index_t i = 0; i < (index_t)flags.size(); i++)
+		if (flags[i])
+			expected.push_back(i);
+
+	const bool passed = std::vector<index_t>(set.data(), set.data() + set.size()) == expected;
+
+	std::printf("%s: %d of %d agents - %s\n", name.c_str(), (int)set.size(), (int)flags.size(),
+				passed ? "passed" : "failed");
+
+	return passed;
+}
+
+int main()
+{
+	cartesian_mesh mesh(2, { 0, 0, 0 }, { 100, 100, 20 }, { 20, 20, 20 });
+	auto initial_conditions = std::make_unique<real_t[]>(1);
+	microenvironment m(mesh, 1, 1, initial_conditions.get());
+	mech_environment me(m, 1, 1);
+
+	auto& data = me.agent_data;
+	data.motility_data = std::make_unique<base_motility_data>(me);
+	auto& motility_data = static_cast<base_motility_data&>(*data.motility_data);
+
+	data.add(agents_count);
+
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		data.is_movable[i] = i % 2;
+		motility_data.is_motile[i] = i % 3 == 0;
+	}
+
+	auto update = [&] {
+#pragma omp parallel
+		{
+			data.update_movable_agents();
+			motility_data.update_motile_agents();
+		}
+	};
+
+	update();
+
+	bool passed = check(data.movable_agents, data.is_movable, "movable");
+	passed &= check(motility_data.motile_agents, motility_data.is_motile, "motile");
+
+	// the same flags keep the version
+	const std::uint64_t version = data.active_sets_version;
+	update();
+
+	if (data.active_sets_version != version)
+	{
+		std::printf("unchanged flags incremented the active sets version\n");
+		passed = false;
+	}
+
+	for (index_t i = 0; i < agents_count; i += 7)
+		data.is_movable[i] = !data.is_movable[i];
+	update();
+
+	passed &= check(data.movable_agents, data.is_movable, "movable changed in place");
+
+	for (index_t i = 0; i < agents_count; i += 11)
+		motility_data.is_motile[i] = !motility_data.is_motile[i];
+	update();
+
+	passed &= check(motility_data.motile_agents, motility_data.is_motile, "motile changed in place");
+
+	// the caches keyed on the version are rebuilt as well
+	if (data.active_sets_version == version)
+	{
+		std::printf("flags changed in place did not increment the active sets version\n");
+		passed = false;
+	}
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include <algorithm>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <BioFVM/microenvironment.h>
+
+#include "base_potential_data.h"
+#include "mech_environment.h"
+
+using namespace biofvm;
+using namespace micromech;
+
+// Removes agents with springs and neighbors, by a list and one by one, and adds agents into the freed slots. The
+// springs must stay symmetric, neighbors must refer to existing agents and the added agents must start without
+// springs and neighbors.
+
+constexpr index_t agents_count = 6;
+
+const std::vector<std::pair<index_t, index_t>> springs = { { 0, 1 }, { 2, 3 }, { 3, 5 }, { 1, 4 } };
+
+void setup(mech_agent_data& data)
+{
+	auto& potential_data = static_cast<base_potential_data&>(*data.potential_data);
+
+	potential_data.reserve_springs(4);
+	data.add(agents_count);
+
+	for (auto [i, j] : springs)
+	{
+		potential_data.springs[i * potential_data.springs_capacity + potential_data.springs_counts[i]++] = j;
+		potential_data.springs[j * potential_data.springs_capacity + potential_data.springs_counts[j]++] = i;
+	}
+
+	// each agent neighbors all the others
+	data.neighbors.clear();
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		data.neighbors_offsets[i] = data.neighbors.size();
+		data.neighbors_counts[i] = agents_count - 1;
+
+		for (index_t j = 0; j < agents_count; j++)
+			if (j != i)
+				data.neighbors.push_back(j);
+	}
+}
+
+bool check(const mech_agent_data& data, index_t added_count, const std::string& name)
+{
+	const auto& potential_data = static_cast<const base_potential_data&>(*data.potential_data);
+	const index_t count = data.agents_count();
+
+	bool passed = true;
+
+	auto fail = [&](const char* message, index_t i) {
+		std::printf("%s: agent %d %s\n", name.c_str(), (int)i, message);
+		passed = false;
+	};
+
+	for (index_t i = 0; i < count; i++)
+	{
+		const index_t* agent_springs = potential_data.springs.data() + i * potential_data.springs_capacity;
+
+		for (index_t k = 0; k < potential_data.springs_counts[i]; k++)
+		{
+			const index_t j = agent_springs[k];
+			const index_t* partner_springs = potential_data.springs.data() + j * potential_data.springs_capacity;
+
+			if (j < 0 || j >= count || j == i)
+				fail("has a spring to a missing agent", i);
+			else if (std::find(partner_springs, partner_springs + potential_data.springs_counts[j], i)
+					 == partner_springs + potential_data.springs_counts[j])
+				fail("has a spring which its partner does not have", i);
+		}
+
+		for (index_t k = 0; k < data.neighbors_counts[i]; k++)
+		{
+			const index_t j = data.neighbors[data.neighbors_offsets[i] + k];
+
+			if (j < 0 || j >= count || j == i)
+				fail("has a neighbor which is a missing agent", i);
+		}
+
+		if (i >= count - added_count && (potential_data.springs_counts[i] != 0 || data.neighbors_counts[i] != 0))
+			fail("was added with springs or neighbors", i);
+	}
+
+	std::printf("%s: %d agents - %s\n", name.c_str(), (int)count, passed ? "passed" : "failed");
+
+	return passed;
+}
+
+template <typename remove_t>
+bool test_removal(const std::string& name, remove_t remove)
+{
+	cartesian_mesh mesh(2, { 0, 0, 0 }, { 100, 100, 20 }, { 20, 20, 20 });
+	auto initial_conditions = std::make_unique<real_t[]>(1);
+	microenvironment m(mesh, 1, 1, initial_conditions.get());
+	mech_environment me(m, 1, 1);
+
+	auto& data = me.agent_data;
+	data.potential_data = std::make_unique<base_potential_data>(me);
+
+	setup(data);
+
+	remove(data);
+
+	const index_t added_count = agents_count - data.agents_count();
+	data.add(added_count);
+
+	return check(data, added_count, name);
+}
+
+int main()
+{
+	bool passed = true;
+
+	passed &= test_removal("list", [](mech_agent_data& data) {
+		const std::vector<index_t> indices = { 2, 5 };
+
+#pragma omp parallel
+#pragma omp single
+		data.remove(indices);
+	});
+
+	passed &= test_removal("list with the last agents", [](mech_agent_data& data) {
+		const std::vector<index_t> indices = { 3, 4, 5 };
+
+#pragma omp parallel
+#pragma omp single
+		data.remove(indices);
+	});
+
+	passed &= test_removal("one by one", [](mech_agent_data& data) {
+		data.remove(5);
+		data.remove(1);
+		data.remove(2);
+	});
+
+	return passed ? 0 : 1;
+}
@@ -0,0 +1,159 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <memory>
+#include <vector>
+
+#include <BioFVM/microenvironment.h>
+
+#include "agents_sorter.h"
+#include "base_membrane_data.h"
+#include "base_wall_membrane_model.h"
+#include "grid_space_partitioner.h"
+#include "mech_environment.h"
+#include "sdf_membrane_model.h"
+
+using namespace biofvm;
+using namespace micromech;
+
+// Compares the boundary bands of the membrane models with their scans of all movable agents, and the wall membrane
+// with the repulsion of each wall computed independently. Agents are placed on a grid of coordinates touching the
+// lower and the upper wall of each dimension, so corners and edges are covered as well as the interior.
+
+constexpr index_t voxel = 20;
+constexpr index_t size = 200;
+constexpr mech_real_t radius = 8;
+constexpr mech_real_t strength = 1.5;
+
+// coordinates closer than the radius to the lower wall, in the interior, and closer than the radius to the upper wall
+const std::vector<real_t> coordinates = { 0, 2, 5, 7.5, 60, 100, 140, 192.5, 195, 199.5 };
+
+// repulsion of a single wall along its normal, sign is the direction away from it
+mech_real_t expected_repulsion(real_t position, real_t wall, mech_real_t sign)
+{
+	const double distance = std::max(std::abs(wall - position), 0.00001);
+	const double repulsion = std::max(1 - distance / radius, 0.);
+
+	return repulsion * repulsion * strength * sign * distance;
+}
+
+template <index_t dims>
+bool test_band()
+{
+	cartesian_mesh mesh(dims, { 0, 0, 0 }, { size, dims > 1 ? size : voxel, dims > 2 ? size : voxel },
+						{ voxel, voxel, voxel });
+	auto initial_conditions = std::make_unique<real_t[]>(1);
+	microenvironment m(mesh, 1, 1, initial_conditions.get());
+	mech_environment me(m, 1, 1);
+	grid_space_partitioner partitioner(voxel, mesh);
+
+	// the walls of the mesh as a distance field
+	sdf_primitive walls { sdf_primitive::shape_t::box };
+	for (index_t d = 0; d < 3; d++)
+	{
+		walls.a[d] = mesh.bounding_box_mins[d];
+		walls.b[d] = mesh.bounding_box_maxs[d];
+	}
+	const auto field = signed_distance_field::from_primitives(mesh, voxel / 4., { walls });
+
+	base_wall_membrane_model full_scan(me);
+	base_wall_membrane_model band(me, partitioner);
+	sdf_membrane_model sdf_full_scan(me, field);
+	sdf_membrane_model sdf_band(me, field, partitioner);
+
+	auto& data = me.agent_data;
+	auto& membrane_data = static_cast<base_membrane_data&>(*data.membrane_data);
+
+	index_t agents_count = 1;
+	for (index_t d = 0; d < dims; d++)
+		agents_count *= coordinates.size();
+
+	data.add(agents_count);
+
+	for (index_t i = 0; i < agents_count; i++)
+	{
+		// every seventh agent is immovable and must not be repelled
+		data.radius[i] = radius;
+		data.is_movable[i] = i % 7 != 3;
+		data.agent_type_indices[i] = 0;
+		membrane_data.cell_BM_repulsion_strength[i] = strength;
+
+		for (index_t d = 0, rest = i; d < dims; d++, rest /= coordinates.size())
+			data.bio_agent_data.positions[i * dims + d] = coordinates[rest % coordinates.size()];
+	}
+
+	// sorting partitions the current agents, so the band is evaluated
+	agents_sorter sorter(partitioner, 1);
+
+#pragma omp parallel
+	sorter.sort(me);
+
+	if (partitioner.agents_version() != data.active_sets_version)
+	{
+		std::printf("%dD: the partitioning does not refer to the current agents\n", (int)dims);
+		return false;
+	}
+
+	auto interact = [&](auto& model) {
+		std::fill(data.velocity.begin(), data.velocity.end(), 0);
+
+#pragma omp parallel
+		model.template compute_basement_membrane_interactions<dims>(me);
+
+		return data.velocity;
+	};
+
+	const auto full_scan_velocity = interact(full_scan);
+	const auto band_velocity = interact(band);
+	const auto sdf_full_scan_velocity = interact(sdf_full_scan);
+	const auto sdf_band_velocity = interact(sdf_band);
+
+	bool passed = true;
+	index_t repelled = 0, sdf_repelled = 0;
+
+	for (index_t i = 0; i < agents_count; i++)
+		for (index_t d = 0; d < dims; d++)
+		{
+			const index_t k = i * dims + d;
+			const real_t position = data.bio_agent_data.positions[k];
+
+			mech_real_t expected = 0;
+			if (data.is_movable[i])
+				expected = expected_repulsion(position, mesh.bounding_box_mins[d], 1)
+						   + expected_repulsion(position, mesh.bounding_box_maxs[d], -1);
+
+			repelled += expected != 0;
+			sdf_repelled += sdf_full_scan_velocity[k] != 0;
+
+			if (band_velocity[k] != full_scan_velocity[k]
+				|| std::abs(full_scan_velocity[k] - expected) > 1e-5 * std::max<mech_real_t>(1, std::abs(expected)))
+			{
+				std::printf("%dD: agent %d at %g in dimension %d has velocity %g with the band, %g with the full scan, "
+							"expected %g\n",
+							(int)dims, (int)i, (double)position, (int)d, (double)band_velocity[k],
+							(double)full_scan_velocity[k], (double)expected);
+				passed = false;
+			}
+
+			if (sdf_band_velocity[k] != sdf_full_scan_velocity[k])
+			{
+				std::printf("%dD: agent %d at %g in dimension %d has velocity %g with the sdf band, %g with the sdf "
+							"full scan\n",
+							(int)dims, (int)i, (double)position, (int)d, (double)sdf_band_velocity[k],
+							(double)sdf_full_scan_velocity[k]);
+				passed = false;
+			}
+		}
+
+	std::printf("%dD: %d agents, %d repelled velocity components, %d by the sdf - %s\n", (int)dims, (int)agents_count,
+				(int)repelled, (int)sdf_repelled, passed ? "passed" : "failed");
+
+	return passed;
+}
+
+int main()
+{
+	const bool passed = test_band<1>() & test_band<2>() & test_band<3>();
+
+	return passed ? 0 : 1;
+}